@@ -277,6 +277,7 @@ void wd_boards_reply_threads(wi_string_t *board, wd_user_t *user, wi_p7_message_
 	wi_string_t					*query;
 	wi_runtime_instance_t		*thread, *login, *postdate, *editdate, *latestreply, *latestreplydate;
 	wd_board_privileges_t		*privileges;
+	wd_batch_t					batch;
 	
 	if(board) {
 		query = WI_STR("SELECT thread, threads.board, subject, post_date, edit_date, nick, login, "
@@ -306,6 +307,8 @@ void wd_boards_reply_threads(wi_string_t *board, wd_user_t *user, wi_p7_message_
 		return;
 	}
 	
+	wd_user_begin_batch(&batch, user, message);
+	
 	while((results = wi_sqlite3_fetch_statement_results(wd_database, statement)) && wi_dictionary_count(results) > 0) {
 		privileges = wd_board_privileges_with_sqlite3_results(results);
 		
@@ -337,10 +340,12 @@ void wd_boards_reply_threads(wi_string_t *board, wd_user_t *user, wi_p7_message_
 			wi_p7_message_set_string_for_name(reply, wi_dictionary_data_for_key(results, WI_STR("subject")), WI_STR("wired.board.subject"));
 			wi_p7_message_set_string_for_name(reply, wi_dictionary_data_for_key(results, WI_STR("nick")), WI_STR("wired.user.nick"));
 
-			wd_user_reply_message(user, reply, message);
+			wd_user_batch_reply_message(&batch, reply);
 		}
 	}
 	
+	wd_user_end_batch(&batch);
+	
 	if(!results) {
 		wi_log_error(WI_STR("Could not execute database statement: %m"));
 		wd_user_reply_internal_error(user, wi_error_string(), message);
@@ -28,13 +28,26 @@
 
 #include "config.h"
 
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
 #include <wired/wired.h>
 
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/fs.h>
+#endif
+
 #include "accounts.h"
 #include "events.h"
 #include "files.h"
+#include "fswalker.h"
 #include "index.h"
 #include "main.h"
 #include "server.h"
@@ -47,12 +60,68 @@
 #define WD_FILES_META_COMMENTS_PATH						".wired/comments"
 #define WD_FILES_META_PERMISSIONS_PATH					".wired/permissions"
 #define WD_FILES_META_LABELS_PATH						".wired/labels"
+#define WD_FILES_META_TRASH_PATH						".wired/trash"
 
 #define WD_FILES_PERMISSIONS_FIELD_SEPARATOR			"\34"
 
 #define WD_FILES_OLDSTYLE_COMMENT_FIELD_SEPARATOR		"\34"
 #define WD_FILES_OLDSTYLE_COMMENT_SEPARATOR				"\35"
 
+#define WD_FILES_PREVIEW_MAX_SIZE						((10 * 1024 * 1024) - (10 * 1024))
+#define WD_FILES_PREVIEW_CHUNK_SIZE						(256 * 1024)
+
+#define WD_FILES_COPY_BUFFER_SIZE						(1024 * 1024)
+#define WD_FILES_COPY_CHUNK_SIZE						(64 * 1024 * 1024)
+#define WD_FILES_COPY_PROGRESS_INTERVAL					1.0
+
+#define WD_FILES_METADATA_CACHE_SIZE					10000
+#define WD_FILES_METADATA_GENERATIONS_SIZE				50000
+#define WD_FILES_COUNT_CACHE_SIZE						50000
+
+#define WD_FILES_LIST_WORKERS							4
+
+#define WD_FILES_LISTING_CACHE_SIZE						500
+#define WD_FILES_LISTING_CACHE_MAX_ENTRIES				5000
+#define WD_FILES_LISTING_CACHE_MAX_NAMES				200000
+#define WD_FILES_LISTING_CACHE_TTL						10
+#define WD_FILES_LISTING_GENERATIONS_SIZE				50000
+
+#define WD_FILES_NOTIFY_INTERVAL						1.0
+
+
+struct _wd_files_copy {
+	wd_user_t											*user;
+	wi_p7_message_t										*message;
+	wi_string_t											*frompath, *topath;
+	wi_file_offset_t									size, copied;
+	wi_time_interval_t									interval;
+};
+typedef struct _wd_files_copy							wd_files_copy_t;
+
+struct _wd_files_list {
+	wi_runtime_base_t									base;
+	
+	wd_user_t											*user;
+	wi_p7_message_t										*message;
+	wd_account_t										*account;
+	wi_string_t											*path;
+	wi_boolean_t										root, recursive;
+	wi_uinteger_t										depthlimit;
+	wi_fs_stat_t										dsb;
+	wd_batch_t											batch;
+	wi_uinteger_t										pagesize, count;
+	wi_string_t											*cursor;
+	wi_boolean_t										more;
+	
+	wi_lock_t											*batchlock;
+	wi_condition_lock_t									*lock;
+	wi_mutable_array_t									*subtrees;
+	wi_uinteger_t										running;
+	
+	wi_mutable_array_t									*entries;
+};
+typedef struct _wd_files_list							wd_files_list_t;
+
 
 struct _wd_files_privileges {
 	wi_runtime_base_t									base;
@@ -63,18 +132,64 @@ struct _wd_files_privileges {
 };
 
 static void												wd_files_reply_list_thread(wi_runtime_instance_t *);
-static void												wd_files_delete_path_callback(wi_string_t *);
-static void												wd_files_move_path_copy_callback(wi_string_t *, wi_string_t *);
-static void												wd_files_move_path_delete_callback(wi_string_t *);
+static void												wd_files_list_walk(wd_files_list_t *, wd_fswalker_t *, wi_string_t *, wi_uinteger_t, wi_boolean_t);
+static void												wd_files_list_fan_out(wd_files_list_t *);
+static void												wd_files_list_run_subtrees(wd_files_list_t *);
+static void												wd_files_list_thread(wi_runtime_instance_t *);
+static void												wd_files_list_page(wd_files_list_t *, wi_string_t *, wi_string_t *, wi_array_t *, wi_uinteger_t);
+static wi_dictionary_t *								wd_files_list_entry(wd_files_list_t *, wi_string_t *, wi_string_t *, wi_fs_stat_t *, wi_fs_stat_t *);
+static wi_boolean_t										wd_files_list_reply_entry(wd_files_list_t *, wi_dictionary_t *);
+static wi_array_t *										wd_files_listing_snapshot(wi_fs_stat_t *, wi_string_t **);
+static wi_array_t *										wd_files_listing_names(wi_string_t *);
+static void												wd_files_set_listing_snapshot(wi_fs_stat_t *, wi_array_t *, wi_string_t *);
+static void												wd_files_invalidate_listing(wi_string_t *);
+static wi_string_t *									wd_files_listing_digest(wi_array_t *);
+static wi_string_t *									wd_files_listing_version(wi_fs_stat_t *, wi_string_t *);
+static void												wd_files_invalidate_count(wi_string_t *);
+static wi_boolean_t										wd_files_reply_preview_range(wi_string_t *, wi_string_t *, wi_file_offset_t, wi_file_offset_t, wi_file_offset_t, wd_user_t *, wi_p7_message_t *);
+static wi_string_t *									wd_files_trash_path(void);
+static wi_boolean_t										wd_files_trash_path_for_deletion(wi_string_t *);
+static void												wd_files_trash_thread(wi_runtime_instance_t *);
+static void												wd_files_empty_trash(void);
 static void												wd_files_move_thread(wi_runtime_instance_t *);
+static wi_boolean_t										wd_files_copy_path(wi_string_t *, wi_string_t *, wd_files_copy_t *);
+static wi_boolean_t										wd_files_copy_entry(wi_string_t *, wi_string_t *, wi_fs_stat_t *, wd_files_copy_t *);
+static wi_boolean_t										wd_files_copy_file(wi_string_t *, wi_string_t *, wi_fs_stat_t *, wd_files_copy_t *);
+static wi_file_offset_t									wd_files_size_of_path(wi_string_t *);
+static void												wd_files_copy_note_progress(wd_files_copy_t *, wi_boolean_t);
+static void												wd_files_copy_note_done(wd_files_copy_t *, wi_string_t *);
+static wi_p7_message_t *								wd_files_copy_progress_message(wd_files_copy_t *);
 
 static void												wd_files_fsevents_thread(wi_runtime_instance_t *);
 static void												wd_files_fsevents_callback(wi_string_t *);
+static void												wd_files_notify_changes(wi_timer_t *);
+
+static wi_dictionary_t *								wd_files_metadata(wi_string_t *, wi_fs_stat_t *);
+static wi_string_t *									wd_files_metadata_signature(wi_string_t *, wi_boolean_t *);
+static wi_uinteger_t									wd_files_metadata_generation_for_key(wi_string_t *);
+static void												wd_files_set_metadata_for_key(wi_dictionary_t *, wi_string_t *, wi_uinteger_t);
+static void												wd_files_invalidate_metadata(wi_string_t *);
+static wd_file_type_t									wd_files_read_type(wi_string_t *);
+static wd_files_privileges_t *							wd_files_read_drop_box_privileges(wi_string_t *);
+static wi_dictionary_t *								wd_files_read_dictionary(wi_string_t *);
+
+static void												wd_files_create_tables(void);
+static wi_string_t *									wd_files_database_path(wi_string_t *, wd_user_t *);
+static wi_runtime_instance_t *							wd_files_database_value(wi_string_t *, wi_string_t *);
+static wi_boolean_t										wd_files_database_set_value(wi_string_t *, wi_string_t *, wi_runtime_instance_t *);
+static wi_boolean_t										wd_files_database_reply_set_value(wi_string_t *, wi_string_t *, wi_runtime_instance_t *, wd_user_t *, wi_p7_message_t *);
+static void												wd_files_move_metadata(wi_string_t *, wi_string_t *);
+static void												wd_files_delete_metadata(wi_string_t *);
+static void												wd_files_import_metadata_in_directory(wi_string_t *, wi_boolean_t, wi_uinteger_t *);
 
 static wi_string_t *									wd_files_comment(wi_string_t *);
 
 static wi_string_t *									wd_files_drop_box_path_in_path(wi_string_t *, wd_user_t *);
 
+static wd_files_list_t *								wd_files_list_alloc(void);
+static wd_files_list_t *								wd_files_list_init(wd_files_list_t *);
+static void												wd_files_list_dealloc(wi_runtime_instance_t *);
+
 static wd_files_privileges_t *							wd_files_privileges_alloc(void);
 static wi_string_t *									wd_files_privileges_description(wi_runtime_instance_t *instance);
 static void												wd_files_privileges_dealloc(wi_runtime_instance_t *);
@@ -85,6 +200,16 @@ static wd_files_privileges_t *							wd_files_privileges_default_drop_box_privil
 static wi_string_t *									wd_files_privileges_string(wd_files_privileges_t *);
 
 
+static wi_runtime_id_t									wd_files_list_runtime_id = WI_RUNTIME_ID_NULL;
+static wi_runtime_class_t								wd_files_list_runtime_class = {
+	"wd_files_list_t",
+	wd_files_list_dealloc,
+	NULL,
+	NULL,
+	NULL,
+	NULL
+};
+
 static wi_runtime_id_t									wd_files_privileges_runtime_id = WI_RUNTIME_ID_NULL;
 static wi_runtime_class_t								wd_files_privileges_runtime_class = {
 	"wd_files_privileges_t",
@@ -99,6 +224,26 @@ wi_string_t												*wd_files;
 wi_uinteger_t											wd_files_root_volume;
 wi_fsevents_t											*wd_files_fsevents;
 
+static wi_condition_lock_t								*wd_files_trash_lock;
+static wi_mutable_dictionary_t							*wd_files_metadata_cache;
+static wi_mutable_dictionary_t							*wd_files_metadata_generations;
+static wi_uinteger_t									wd_files_metadata_generation;
+static wi_uinteger_t									wd_files_metadata_generation_floor;
+static wi_boolean_t										wd_files_metadata_database;
+static wi_mutable_dictionary_t							*wd_files_count_cache;
+static wi_mutable_dictionary_t							*wd_files_listing_cache;
+static wi_uinteger_t									wd_files_listing_cache_names;
+static wi_mutable_dictionary_t							*wd_files_listing_generations;
+static wi_uinteger_t									wd_files_listing_generation;
+static wi_uinteger_t									wd_files_listing_generation_floor;
+static time_t											wd_files_listing_epoch;
+static wi_timer_t										*wd_files_changes_timer;
+static wi_lock_t										*wd_files_changes_lock;
+static wi_mutable_set_t									*wd_files_changed_paths;
+static wi_uinteger_t									wd_files_trash_counter;
+static wi_condition_lock_t								*wd_files_list_lock;
+static wi_mutable_array_t								*wd_files_list_queue;
+
 
 
 void wd_files_initialize(void) {
@@ -109,7 +254,30 @@ void wd_files_initialize(void) {
 	else
 		wi_log_warn(WI_STR("Could not create fsevents: %m"));
 
+	wd_files_list_runtime_id = wi_runtime_register_class(&wd_files_list_runtime_class);
 	wd_files_privileges_runtime_id = wi_runtime_register_class(&wd_files_privileges_runtime_class);
+	
+	wd_files_metadata_cache = wi_dictionary_init(wi_mutable_dictionary_alloc());
+	wd_files_metadata_generations = wi_dictionary_init(wi_mutable_dictionary_alloc());
+	wd_files_count_cache = wi_dictionary_init(wi_mutable_dictionary_alloc());
+	wd_files_listing_cache = wi_dictionary_init(wi_mutable_dictionary_alloc());
+	wd_files_listing_generations = wi_dictionary_init(wi_mutable_dictionary_alloc());
+	wd_files_listing_epoch = time(NULL);
+	
+	wd_files_changes_lock = wi_lock_init(wi_lock_alloc());
+	wd_files_changed_paths = wi_set_init(wi_mutable_set_alloc());
+	wd_files_changes_timer = wi_timer_init_with_function(wi_timer_alloc(),
+														 wd_files_notify_changes,
+														 WD_FILES_NOTIFY_INTERVAL,
+														 true);
+	
+	wd_files_create_tables();
+	
+	/* start with the condition set so trash left over from the last run is emptied */
+	wd_files_trash_lock = wi_condition_lock_init_with_condition(wi_condition_lock_alloc(), 1);
+	
+	wd_files_list_lock = wi_condition_lock_init_with_condition(wi_condition_lock_alloc(), 0);
+	wd_files_list_queue = wi_array_init(wi_mutable_array_alloc());
 }
 
 
@@ -125,14 +293,66 @@ void wd_files_apply_settings(wi_set_t *changes) {
 	
 	if(wi_fs_stat_path(realpath, &sb))
 		wd_files_root_volume = sb.dev;
+	
+	wd_files_metadata_database = wi_config_bool_for_name(wd_config, WI_STR("metadata database"));
+	
+	/* cached entries have a different shape depending on the backend */
+	wi_dictionary_wrlock(wd_files_metadata_cache);
+	wi_mutable_dictionary_remove_all_data(wd_files_metadata_cache);
+	wi_dictionary_unlock(wd_files_metadata_cache);
+	
+	wi_dictionary_wrlock(wd_files_listing_cache);
+	wi_mutable_dictionary_remove_all_data(wd_files_listing_cache);
+	wd_files_listing_cache_names = 0;
+	wi_dictionary_unlock(wd_files_listing_cache);
+}
+
+
+
+static void wd_files_create_tables(void) {
+	wi_uinteger_t		version;
+	
+	version = wd_database_version_for_table(WI_STR("files_metadata"));
+	
+	switch(version) {
+		case 0:
+			if(!wi_sqlite3_execute_statement(wd_database, WI_STR("CREATE TABLE files_metadata ( "
+																 "directory TEXT NOT NULL, "
+																 "name TEXT NOT NULL, "
+																 "inode INTEGER NOT NULL, "
+																 "type INTEGER, "
+																 "permissions TEXT, "
+																 "label INTEGER, "
+																 "comment TEXT, "
+																 "PRIMARY KEY (directory, name) "
+																 ")"),
+											 NULL)) {
+				wi_log_fatal(WI_STR("Could not execute database statement: %m"));
+			}
+			break;
+	}
+	
+	wd_database_set_version_for_table(1, WI_STR("files_metadata"));
 }
 
 
 
 void wd_files_schedule(void) {
+	wi_uinteger_t		i;
+	
 	if(wd_files_fsevents) {
 		if(!wi_thread_create_thread(wd_files_fsevents_thread, NULL))
 			wi_log_error(WI_STR("Could not create an fsevents thread: %m"));
+		
+		wi_timer_schedule(wd_files_changes_timer);
+	}
+	
+	if(!wi_thread_create_thread_with_priority(wd_files_trash_thread, NULL, 0.0))
+		wi_log_error(WI_STR("Could not create a trash thread: %m"));
+	
+	for(i = 0; i < WD_FILES_LIST_WORKERS; i++) {
+		if(!wi_thread_create_thread(wd_files_list_thread, NULL))
+			wi_log_error(WI_STR("Could not create a list thread: %m"));
 	}
 }
 
@@ -170,31 +390,27 @@ static void wd_files_reply_list_thread(wi_runtime_instance_t *argument) {
 	wi_string_t 				*path;
 	wd_user_t 					*user;
 	wi_p7_message_t 			*message;
-	wi_boolean_t 				recursive;
 
 	wi_p7_message_t				*reply;
-	wi_string_t					*realpath, *filepath, *resolvedpath, *virtualpath;
-	wi_fsenumerator_t			*fsenumerator;
-	wd_account_t				*account;
+	wi_string_t					*realpath, *cursor, *version, *clientversion, *digest;
+	wi_array_t					*entries;
+	wd_fswalker_t				*walker;
+	wd_files_list_t				*list;
 	wd_files_privileges_t		*privileges;
 	wi_fs_statfs_t				sfb;
-	wi_fs_stat_t				dsb, sb, lsb;
-	wi_fsenumerator_status_t	status;
-	wi_file_offset_t			datasize, rsrcsize;
-	wd_file_label_t				label;
-	wi_uinteger_t				pathlength, depthlimit, directorycount;
-	wd_file_type_t				type, pathtype;
-	wi_boolean_t				root, upload, alias, readable, writable;
-	uint32_t					device;
+	wi_fs_stat_t				dsb;
+	wd_account_t				*account;
+	wd_file_type_t				pathtype;
+	wi_boolean_t				upload, readable, writable;
+	wi_uinteger_t				i, count;
+	uint32_t					pagesize;
 
 	pool			= wi_pool_init(wi_pool_alloc());
 
 	path			= WI_ARRAY(array, 0);
 	user			= WI_ARRAY(array, 1);
 	message			= WI_ARRAY(array, 2);
-	recursive		= wi_number_bool(WI_ARRAY(array, 3));
 
-	root			= wi_is_equal(path, WI_STR("/"));
 	realpath		= wi_string_by_resolving_aliases_in_path(wd_files_real_path(path, user));
 	account			= wd_user_account(user);
 	pathtype		= wd_files_type(realpath);
@@ -206,139 +422,105 @@ static void wd_files_reply_list_thread(wi_runtime_instance_t *argument) {
 		return;
 	}
 	
-	depthlimit		= wd_account_file_recursive_list_depth_limit(account);
-	fsenumerator	= wi_fs_enumerator_at_path(realpath);
-	
-	if(!fsenumerator) {
-		wi_log_error(WI_STR("Could not open \"%@\": %m"), realpath);
-		wd_user_reply_file_errno(user, message);
+	version				= NULL;
+	list				= wi_autorelease(wd_files_list_init(wd_files_list_alloc()));
+	list->path			= wi_retain(path);
+	list->user			= wi_retain(user);
+	list->message		= wi_retain(message);
+	list->account		= wi_retain(account);
+	list->recursive		= wi_number_bool(WI_ARRAY(array, 3));
+	list->root			= wi_is_equal(path, WI_STR("/"));
+	list->depthlimit	= wd_account_file_recursive_list_depth_limit(account);
+	list->dsb			= dsb;
+	
+	if(!wi_p7_message_get_uint32_for_name(message, &pagesize, WI_STR("wired.file.list_page_size")))
+		pagesize = 0;
+	
+	if(pagesize > 0) {
+		list->pagesize	= pagesize;
+		cursor			= wi_p7_message_string_for_name(message, WI_STR("wired.file.list_cursor"));
 		
-		return;
+		wd_user_begin_batch(&list->batch, user, message);
+		wd_files_list_page(list, realpath, WI_STR(""), cursor ? wi_string_components_separated_by_string(cursor, WI_STR("/")) : NULL, 1);
+		wd_user_end_batch(&list->batch);
 	}
-
-	pathlength = wi_string_length(realpath);
-	
-	if(pathlength == 1)
-		pathlength--;
-	
-	while((status = wi_fsenumerator_get_next_path(fsenumerator, &filepath)) != WI_FSENUMERATOR_EOF) {
-		if(status == WI_FSENUMERATOR_ERROR) {
-			wi_log_error(WI_STR("Could not list \"%@\": %m"), filepath);
+	else if(!list->recursive) {
+		entries = wd_files_listing_snapshot(&dsb, &digest);
+		
+		/* the version is derived from the entries, so they are collected before anything is replied */
+		if(!entries) {
+			walker = wd_fswalker_open(realpath);
 			
-			continue;
-		}
-	
-		if(depthlimit > 0 && wi_fsenumerator_level(fsenumerator) > depthlimit) {
-			wi_fsenumerator_skip_descendents(fsenumerator);
+			if(!walker) {
+				wi_log_error(WI_STR("Could not open \"%@\": %m"), realpath);
+				wd_user_reply_file_errno(user, message);
+				
+				return;
+			}
 			
-			continue;
-		}
-		
-		if(wi_fs_path_is_invisible(filepath)) {
-			wi_fsenumerator_skip_descendents(fsenumerator);
+			list->entries = wi_array_init(wi_mutable_array_alloc());
 			
-			continue;
+			wd_files_list_walk(list, walker, NULL, 0, false);
+			wd_fswalker_close(walker);
+			
+			entries	= list->entries;
+			digest	= wd_files_listing_digest(entries);
+			
+			wd_files_set_listing_snapshot(&dsb, entries, digest);
 		}
 		
-		if(!recursive)
-			wi_fsenumerator_skip_descendents(fsenumerator);
-		
-		virtualpath = wi_string_substring_from_index(filepath, pathlength);
-		
-		if(!root)
-			virtualpath = wi_string_by_inserting_string_at_index(virtualpath, path, 0);
-		
-		alias = wi_fs_path_is_alias(filepath);
+		version			= wd_files_listing_version(&dsb, digest);
+		clientversion	= wi_p7_message_string_for_name(message, WI_STR("wired.file.list_version"));
 		
-		if(alias)
-			resolvedpath = wi_string_by_resolving_aliases_in_path(filepath);
-		else
-			resolvedpath = filepath;
-
-		if(!wi_fs_lstat_path(resolvedpath, &lsb)) {
-			wi_log_error(WI_STR("Could not read info for \"%@\": %m"), resolvedpath);
-
-			continue;
-		}
-
-		if(!wi_fs_stat_path(resolvedpath, &sb))
-			sb = lsb;
-
-		readable	= false;
-		writable	= false;
-		type		= wd_files_type_with_stat(resolvedpath, &sb);
-		
-		if(type == WD_FILE_TYPE_DROPBOX) {
-			privileges	= wd_files_drop_box_privileges(resolvedpath);
-			readable	= wd_files_privileges_is_readable_by_account(privileges, account);
-			writable	= wd_files_privileges_is_writable_by_account(privileges, account);
-		}
-
-		switch(type) {
-			case WD_FILE_TYPE_DIR:
-			case WD_FILE_TYPE_UPLOADS:
-				datasize		= 0;
-				rsrcsize		= 0;
-				directorycount	= wd_files_count_path(resolvedpath, user, message);
-				break;
-				
-			case WD_FILE_TYPE_DROPBOX:
-				datasize		= 0;
-				rsrcsize		= 0;
-				directorycount	= readable ? wd_files_count_path(resolvedpath, user, message) : 0;
-				break;
-
-			case WD_FILE_TYPE_FILE:
-			default:
-				datasize		= sb.size;
-				rsrcsize		= wi_fs_resource_fork_size_for_path(resolvedpath);
-				directorycount	= 0;
-				break;
+		if(version && clientversion && wi_is_equal(version, clientversion)) {
+			reply = wi_p7_message_with_name(WI_STR("wired.file.file_list.not_modified"), wd_p7_spec);
+			wi_p7_message_set_string_for_name(reply, path, WI_STR("wired.file.path"));
+			wi_p7_message_set_string_for_name(reply, version, WI_STR("wired.file.list_version"));
+			wd_user_reply_message(user, reply, message);
+			
+			wi_release(pool);
+			
+			return;
 		}
 		
-		label = wd_files_label(filepath);
+		count = wi_array_count(entries);
 		
-		device = alias ? dsb.dev : sb.dev;
+		wd_user_begin_batch(&list->batch, user, message);
 		
-		if(device == wd_files_root_volume)
-			device = 0;
+		for(i = 0; i < count; i++)
+			wd_files_list_reply_entry(list, WI_ARRAY(entries, i));
 		
-		reply = wi_p7_message_init_with_name(wi_p7_message_alloc(), WI_STR("wired.file.file_list"), wd_p7_spec);
-		wi_p7_message_set_string_for_name(reply, virtualpath, WI_STR("wired.file.path"));
-		
-		if(type == WD_FILE_TYPE_FILE) {
-			wi_p7_message_set_uint64_for_name(reply, datasize, WI_STR("wired.file.data_size"));
-			wi_p7_message_set_uint64_for_name(reply, rsrcsize, WI_STR("wired.file.rsrc_size"));
-		} else {
-			wi_p7_message_set_uint32_for_name(reply, directorycount, WI_STR("wired.file.directory_count"));
-		}
+		wd_user_end_batch(&list->batch);
+	}
+	else {
+		walker = wd_fswalker_open(realpath);
 		
-		wi_p7_message_set_date_for_name(reply, wi_date_with_time(sb.birthtime), WI_STR("wired.file.creation_time"));
-		wi_p7_message_set_date_for_name(reply, wi_date_with_time(sb.mtime), WI_STR("wired.file.modification_time"));
-		wi_p7_message_set_enum_for_name(reply, type, WI_STR("wired.file.type"));
-		wi_p7_message_set_bool_for_name(reply, alias || S_ISLNK(lsb.mode), WI_STR("wired.file.link"));
-		wi_p7_message_set_bool_for_name(reply, (type == WD_FILE_TYPE_FILE && sb.mode & 0111), WI_STR("wired.file.executable"));
-		wi_p7_message_set_enum_for_name(reply, label, WI_STR("wired.file.label"));
-		wi_p7_message_set_uint32_for_name(reply, device, WI_STR("wired.file.volume"));
-		
-		if(type == WD_FILE_TYPE_DROPBOX) {
-			wi_p7_message_set_bool_for_name(reply, readable, WI_STR("wired.file.readable"));
-			wi_p7_message_set_bool_for_name(reply, writable, WI_STR("wired.file.writable"));
+		if(!walker) {
+			wi_log_error(WI_STR("Could not open \"%@\": %m"), realpath);
+			wd_user_reply_file_errno(user, message);
+			
+			return;
 		}
+
+		wd_user_begin_batch(&list->batch, user, message);
+		wd_files_list_walk(list, walker, NULL, 0, true);
+		wd_fswalker_close(walker);
 		
-		wd_user_reply_message(user, reply, message);
-		wi_release(reply);
+		if(wi_array_count(list->subtrees) > 0)
+			wd_files_list_fan_out(list);
 		
-		if(recursive && (type == WD_FILE_TYPE_DROPBOX && !readable)) {
-			wi_fsenumerator_skip_descendents(fsenumerator);
-				
-			continue;
-		}
+		wd_user_end_batch(&list->batch);
 	}
 	
 	reply = wi_p7_message_with_name(WI_STR("wired.file.file_list.done"), wd_p7_spec);
 	wi_p7_message_set_string_for_name(reply, path, WI_STR("wired.file.path"));
 	
+	if(list->more)
+		wi_p7_message_set_string_for_name(reply, list->cursor, WI_STR("wired.file.list_cursor"));
+	
+	if(version)
+		wi_p7_message_set_string_for_name(reply, version, WI_STR("wired.file.list_version"));
+	
 	if(pathtype == WD_FILE_TYPE_DROPBOX) {
 		privileges	= wd_files_drop_box_privileges(realpath);
 		readable	= wd_files_privileges_is_readable_by_account(privileges, account);
@@ -372,502 +554,2410 @@ static void wd_files_reply_list_thread(wi_runtime_instance_t *argument) {
 
 
 
-
-
-wi_file_offset_t wd_files_count_path(wi_string_t *path, wd_user_t *user, wi_p7_message_t *message) {
-	wi_mutable_string_t		*filepath;
-	DIR						*dir;
-	struct dirent			*de, *dep;
-	wi_file_offset_t		count = 0;
+static void wd_files_list_walk(wd_files_list_t *list, wd_fswalker_t *walker, wi_string_t *relativepath, wi_uinteger_t level, wi_boolean_t fanout) {
+	wi_pool_t					*pool;
+	wi_string_t					*filepath, *childpath;
+	wi_dictionary_t				*file;
+	wd_fswalker_entry_t			*entry;
+	wd_fswalker_status_t		status;
+	wi_uinteger_t				i = 0, depth;
 	
-	dir = opendir(wi_string_cstring(path));
+	pool = wi_pool_init(wi_pool_alloc());
 	
-	if(dir) {
-		filepath	= wi_mutable_copy(path);
-		de			= wi_malloc(sizeof(struct dirent) + WI_PATH_SIZE);
+	while((status = wd_fswalker_next(walker, &entry)) != WD_FSWALKER_EOF) {
+		if(status == WD_FSWALKER_ERROR) {
+			wi_log_error(WI_STR("Could not list \"%s\": %m"), entry->path);
+			
+			continue;
+		}
 		
-		wi_mutable_string_append_cstring(filepath, "/");
+		depth = level + entry->level;
+	
+		if(list->depthlimit > 0 && depth > list->depthlimit) {
+			wd_fswalker_skip_descendents(walker);
+			
+			continue;
+		}
 		
-		while(readdir_r(dir, de, &dep) == 0 && dep) {
-			if(dep->d_name[0] != '.') {
-				wi_mutable_string_append_cstring(filepath, dep->d_name);
-				
-				if(!wi_fs_path_is_invisible(filepath))
-					count++;
-				
-				wi_mutable_string_delete_characters_from_index(filepath, wi_string_length(filepath) - strlen(dep->d_name));
-			}
+		if(entry->name[0] == '.') {
+			wd_fswalker_skip_descendents(walker);
+			
+			continue;
 		}
 		
-		wi_release(filepath);
-
-		wi_free(de);
+		filepath = wd_fswalker_entry_path(entry);
+		
+		if(wi_fs_path_is_invisible(filepath)) {
+			wd_fswalker_skip_descendents(walker);
+			
+			continue;
+		}
+		
+		if(!list->recursive)
+			wd_fswalker_skip_descendents(walker);
+		
+		if(!wd_fswalker_stat_entry(walker, entry)) {
+			wi_log_error(WI_STR("Could not read info for \"%@\": %m"), filepath);
 
-		closedir(dir);
+			continue;
+		}
 		
-		return count;
-	} else {
-		wi_log_error(WI_STR("Could not open \"%@\": %s"),
-			path, strerror(errno));
+		childpath = wd_fswalker_entry_relative_path(walker, entry);
 		
-		if(user)
-			wd_user_reply_file_errno(user, message);
+		if(relativepath)
+			childpath = wi_string_by_appending_string(relativepath, childpath);
 		
-		return 0;
+		file = wd_files_list_entry(list, filepath, childpath, &entry->lsb, &entry->sb);
+		
+		/* collected entries are replied by the caller */
+		if(list->entries) {
+			if(file)
+				wi_mutable_array_add_data(list->entries, file);
+		}
+		else if(!file || !wd_files_list_reply_entry(list, file)) {
+			wd_fswalker_skip_descendents(walker);
+		}
+		else if(fanout && S_ISDIR(entry->lsb.mode) && (list->depthlimit == 0 || depth < list->depthlimit)) {
+			wi_mutable_array_add_data(list->subtrees, wi_array_with_data(filepath, childpath, (void *) NULL));
+			wd_fswalker_skip_descendents(walker);
+		}
+		
+		if(++i % 100 == 0)
+			wi_pool_drain(pool);
 	}
+	
+	wi_release(pool);
 }
 
 
 
+/*
+	Recursive listings only walk the first level on the list thread; every
+	subdirectory found there is queued as a subtree. The shared list workers
+	and the list thread itself then drain that queue, so a slow tree is
+	stat'ed by up to WD_FILES_LIST_WORKERS + 1 threads at once.
+*/
 
-wi_boolean_t wd_files_reply_info(wi_string_t *path, wd_user_t *user, wi_p7_message_t *message) {
-	wi_p7_message_t			*reply;
-	wi_string_t				*realpath, *parentpath, *comment;
-	wd_account_t			*account;
-	wd_files_privileges_t	*privileges = NULL;
-	wi_file_offset_t		datasize, rsrcsize;
-	wd_file_type_t			type;
-	wi_fs_stat_t			dsb, sb, lsb;
-	wd_file_label_t			label;
-	wi_uinteger_t			directorycount;
-	wi_boolean_t			alias, readable, writable;
-	uint32_t				device;
+static void wd_files_list_fan_out(wd_files_list_t *list) {
+	wi_uinteger_t		i, count;
 	
-	account			= wd_user_account(user);
-	realpath		= wd_files_real_path(path, user);
-	alias			= wi_fs_path_is_alias(realpath);
-	realpath		= wi_string_by_resolving_aliases_in_path(realpath);
-	parentpath		= wi_string_by_deleting_last_path_component(realpath);
+	count = wi_array_count(list->subtrees) - 1;
+	
+	if(count > WD_FILES_LIST_WORKERS)
+		count = WD_FILES_LIST_WORKERS;
+	
+	wi_condition_lock_lock(wd_files_list_lock);
+	
+	for(i = 0; i < count; i++)
+		wi_mutable_array_add_data(wd_files_list_queue, list);
+	
+	wi_condition_lock_unlock_with_condition(wd_files_list_lock, (wi_array_count(wd_files_list_queue) > 0) ? 1 : 0);
+	
+	wd_files_list_run_subtrees(list);
+	
+	wi_condition_lock_lock_when_condition(list->lock, 1, 0.0);
+	wi_condition_lock_unlock(list->lock);
+}
 
-	if(!wi_fs_stat_path(parentpath, &dsb)) {
-		wi_log_error(WI_STR("Could not read info for \"%@\": %m"), parentpath);
-		wd_user_reply_file_errno(user, message);
+
+
+static void wd_files_list_run_subtrees(wd_files_list_t *list) {
+	wi_array_t			*subtree;
+	wd_fswalker_t		*walker;
+	
+	while(true) {
+		wi_condition_lock_lock(list->lock);
 		
-		return false;
+		if(wi_array_count(list->subtrees) == 0) {
+			wi_condition_lock_unlock_with_condition(list->lock, (list->running == 0) ? 1 : 0);
+			
+			break;
+		}
+		
+		subtree = wi_autorelease(wi_retain(WI_ARRAY(list->subtrees, 0)));
+		wi_mutable_array_remove_data_at_index(list->subtrees, 0);
+		list->running++;
+		
+		wi_condition_lock_unlock_with_condition(list->lock, 0);
+		
+		walker = wd_fswalker_open(WI_ARRAY(subtree, 0));
+		
+		if(walker) {
+			wd_files_list_walk(list, walker, WI_ARRAY(subtree, 1), 1, false);
+			wd_fswalker_close(walker);
+		} else {
+			wi_log_error(WI_STR("Could not open \"%@\": %m"), WI_ARRAY(subtree, 0));
+		}
+		
+		wi_condition_lock_lock(list->lock);
+		list->running--;
+		wi_condition_lock_unlock_with_condition(list->lock,
+			(list->running == 0 && wi_array_count(list->subtrees) == 0) ? 1 : 0);
 	}
+}
+
+
+
+static void wd_files_list_thread(wi_runtime_instance_t *argument) {
+	wi_pool_t			*pool;
+	wd_files_list_t		*list;
 	
-	if(!wi_fs_lstat_path(realpath, &lsb)) {
-		wi_log_error(WI_STR("Could not read info for \"%@\": %m"), realpath);
-		wd_user_reply_file_errno(user, message);
+	pool = wi_pool_init(wi_pool_alloc());
+	
+	while(true) {
+		wi_condition_lock_lock_when_condition(wd_files_list_lock, 1, 0.0);
 		
-		return false;
+		list = wi_autorelease(wi_retain(WI_ARRAY(wd_files_list_queue, 0)));
+		wi_mutable_array_remove_data_at_index(wd_files_list_queue, 0);
+		
+		wi_condition_lock_unlock_with_condition(wd_files_list_lock, (wi_array_count(wd_files_list_queue) > 0) ? 1 : 0);
+		
+		wd_files_list_run_subtrees(list);
+		
+		wi_pool_drain(pool);
 	}
 	
-	if(!wi_fs_stat_path(realpath, &sb))
-		sb = lsb;
+	wi_release(pool);
+}
 
-	readable	= false;
-	writable	= false;
-	type		= wd_files_type_with_stat(realpath, &sb);
+
+
+/*
+	Paged listings walk each directory in sorted order so that the position
+	after the last entry sent can be described by its relative path alone.
+	The cursor handed to the client is that path; resuming skips every
+	sibling that sorts before the matching component at each level. The
+	sorted names are cached per directory, so a page costs a binary search
+	and the entries it sends rather than a fresh read of the directory.
+*/
+
+static void wd_files_list_page(wd_files_list_t *list, wi_string_t *realpath, wi_string_t *relativepath, wi_array_t *components, wi_uinteger_t level) {
+	wi_pool_t			*pool;
+	wi_array_t			*names;
+	wi_dictionary_t		*file;
+	wi_string_t			*name, *component, *filepath, *childpath;
+	wi_fs_stat_t		sb, lsb;
+	wi_uinteger_t		i, count, low, high, middle;
+	wi_boolean_t		descend;
 	
-	if(type == WD_FILE_TYPE_DROPBOX) {
-		privileges	= wd_files_drop_box_privileges(realpath);
-		readable	= wd_files_privileges_is_readable_by_account(privileges, account);
-		writable	= wd_files_privileges_is_writable_by_account(privileges, account);
+	names = wd_files_listing_names(realpath);
+	
+	if(!names) {
+		wi_log_error(WI_STR("Could not list \"%@\": %m"), realpath);
+		
+		return;
 	}
 	
-	comment = wd_files_comment(realpath);
+	component	= (components && wi_array_count(components) > level) ? WI_ARRAY(components, level) : NULL;
+	descend		= (list->recursive && (list->depthlimit == 0 || level < list->depthlimit));
+	count		= wi_array_count(names);
+	low			= 0;
+	
+	if(component) {
+		/* skip straight to the first name that does not sort before the cursor */
+		high = count;
+		
+		while(low < high) {
+			middle = low + ((high - low) / 2);
+			
+			if(wi_string_compare(WI_ARRAY(names, middle), component) < 0)
+				low = middle + 1;
+			else
+				high = middle;
+		}
+	}
+	
+	pool = wi_pool_init(wi_pool_alloc());
+	
+	for(i = low; i < count && !list->more; i++) {
+		name = WI_ARRAY(names, i);
+		
+		if(wi_string_has_prefix(name, WI_STR(".")))
+			continue;
+		
+		filepath	= wi_string_by_appending_path_component(realpath, name);
+		childpath	= wi_string_with_format(WI_STR("%@/%@"), relativepath, name);
+		
+		if(component) {
+			if(wi_is_equal(name, component)) {
+				if(descend && !wi_fs_path_is_invisible(filepath) && wi_fs_lstat_path(filepath, &lsb) && S_ISDIR(lsb.mode) &&
+				   (wd_files_type_with_stat(filepath, &lsb) != WD_FILE_TYPE_DROPBOX ||
+					wd_files_privileges_is_readable_by_account(wd_files_drop_box_privileges(filepath), list->account))) {
+					wd_files_list_page(list, filepath, childpath,
+						wi_array_count(components) > level + 1 ? components : NULL, level + 1);
+				}
+				
+				component = NULL;
+				
+				continue;
+			}
+			
+			component = NULL;
+		}
+		
+		if(wi_fs_path_is_invisible(filepath))
+			continue;
+		
+		if(list->count == list->pagesize) {
+			list->more = true;
+			
+			break;
+		}
+		
+		if(!wi_fs_lstat_path(filepath, &lsb)) {
+			wi_log_error(WI_STR("Could not read info for \"%@\": %m"), filepath);
+			
+			continue;
+		}
+		
+		if(!wi_fs_stat_path(filepath, &sb))
+			sb = lsb;
+		
+		wi_release(list->cursor);
+		list->cursor = wi_retain(childpath);
+		list->count++;
+		
+		file = wd_files_list_entry(list, filepath, childpath, &lsb, &sb);
+		
+		if(file && wd_files_list_reply_entry(list, file) && descend && S_ISDIR(lsb.mode))
+			wd_files_list_page(list, filepath, childpath, NULL, level + 1);
+		
+		if(i % 100 == 0)
+			wi_pool_drain(pool);
+	}
+	
+	wi_release(pool);
+}
+
+
+
+static wi_dictionary_t * wd_files_list_entry(wd_files_list_t *list, wi_string_t *filepath, wi_string_t *relativepath, wi_fs_stat_t *lsbp, wi_fs_stat_t *sbp) {
+	wi_mutable_dictionary_t		*entry;
+	wi_string_t					*resolvedpath;
+	wd_files_privileges_t		*privileges;
+	wi_fs_stat_t				sb, lsb;
+	wi_file_offset_t			datasize, rsrcsize;
+	wi_uinteger_t				directorycount;
+	wd_file_type_t				type;
+	wi_boolean_t				alias;
+	uint32_t					device;
+	
+	alias = wi_fs_path_is_alias(filepath);
+	
+	if(alias) {
+		resolvedpath = wi_string_by_resolving_aliases_in_path(filepath);
+
+		if(!wi_fs_lstat_path(resolvedpath, &lsb)) {
+			wi_log_error(WI_STR("Could not read info for \"%@\": %m"), resolvedpath);
+
+			return NULL;
+		}
+
+		if(!wi_fs_stat_path(resolvedpath, &sb))
+			sb = lsb;
+	} else {
+		resolvedpath	= filepath;
+		lsb				= *lsbp;
+		sb				= *sbp;
+	}
+
+	privileges	= NULL;
+	type		= wd_files_type_with_stat(resolvedpath, &sb);
 	
 	switch(type) {
 		case WD_FILE_TYPE_DIR:
 		case WD_FILE_TYPE_UPLOADS:
-			datasize		= 0;
-			rsrcsize		= 0;
-			directorycount	= wd_files_count_path(realpath, user, message);
-			break;
-			
 		case WD_FILE_TYPE_DROPBOX:
 			datasize		= 0;
 			rsrcsize		= 0;
-			directorycount	= readable ? wd_files_count_path(realpath, user, message) : 0;
+			directorycount	= wd_files_count_path(resolvedpath, list->user, list->message);
 			break;
 
 		case WD_FILE_TYPE_FILE:
 		default:
 			datasize		= sb.size;
-			rsrcsize		= wi_fs_resource_fork_size_for_path(realpath);
+			rsrcsize		= wi_fs_resource_fork_size_for_path(resolvedpath);
 			directorycount	= 0;
 			break;
 	}
-
-	label = wd_files_label(realpath);
 	
-	device = alias ? dsb.dev : sb.dev;
+	if(type == WD_FILE_TYPE_DROPBOX)
+		privileges = wd_files_drop_box_privileges(resolvedpath);
+	
+	device = alias ? list->dsb.dev : sb.dev;
 	
 	if(device == wd_files_root_volume)
 		device = 0;
 	
-	reply = wi_p7_message_with_name(WI_STR("wired.file.info"), wd_p7_spec);
-	wi_p7_message_set_string_for_name(reply, path, WI_STR("wired.file.path"));
-	wi_p7_message_set_enum_for_name(reply, type, WI_STR("wired.file.type"));
+	entry = wi_dictionary_init_with_data_and_keys(wi_mutable_dictionary_alloc(),
+		relativepath,												WI_STR("path"),
+		wi_number_with_int32(type),									WI_STR("type"),
+		wi_number_with_int64(datasize),								WI_STR("data_size"),
+		wi_number_with_int64(rsrcsize),								WI_STR("rsrc_size"),
+		wi_number_with_int64(directorycount),						WI_STR("directory_count"),
+		wi_date_with_time(sb.birthtime),							WI_STR("creation_time"),
+		wi_date_with_time(sb.mtime),								WI_STR("modification_time"),
+		wi_number_with_bool(alias || S_ISLNK(lsb.mode)),			WI_STR("link"),
+		wi_number_with_bool(type == WD_FILE_TYPE_FILE && sb.mode & 0111),	WI_STR("executable"),
+		wi_number_with_int32(wd_files_label(filepath)),				WI_STR("label"),
+		wi_number_with_int32(device),								WI_STR("volume"),
+		NULL);
+	
+	if(privileges)
+		wi_mutable_dictionary_set_data_for_key(entry, privileges, WI_STR("privileges"));
+	
+	return wi_autorelease(entry);
+}
+
+
+
+static wi_boolean_t wd_files_list_reply_entry(wd_files_list_t *list, wi_dictionary_t *entry) {
+	wi_p7_message_t				*reply;
+	wi_string_t					*virtualpath;
+	wd_files_privileges_t		*privileges;
+	wd_file_type_t				type;
+	wi_boolean_t				readable, writable;
+	
+	virtualpath = wi_dictionary_data_for_key(entry, WI_STR("path"));
+	
+	if(!list->root)
+		virtualpath = wi_string_by_inserting_string_at_index(virtualpath, list->path, 0);
+	
+	type		= wi_number_int32(wi_dictionary_data_for_key(entry, WI_STR("type")));
+	readable	= false;
+	writable	= false;
+	
+	if(type == WD_FILE_TYPE_DROPBOX) {
+		privileges	= wi_dictionary_data_for_key(entry, WI_STR("privileges"));
+		readable	= wd_files_privileges_is_readable_by_account(privileges, list->account);
+		writable	= wd_files_privileges_is_writable_by_account(privileges, list->account);
+	}
+
+	reply = wi_p7_message_init_with_name(wi_p7_message_alloc(), WI_STR("wired.file.file_list"), wd_p7_spec);
+	wi_p7_message_set_string_for_name(reply, virtualpath, WI_STR("wired.file.path"));
 	
 	if(type == WD_FILE_TYPE_FILE) {
-		wi_p7_message_set_uint64_for_name(reply, datasize, WI_STR("wired.file.data_size"));
-		wi_p7_message_set_uint64_for_name(reply, rsrcsize, WI_STR("wired.file.rsrc_size"));
-	} else {
-		wi_p7_message_set_uint32_for_name(reply, directorycount, WI_STR("wired.file.directory_count"));
+		wi_p7_message_set_uint64_for_name(reply, wi_number_int64(wi_dictionary_data_for_key(entry, WI_STR("data_size"))), WI_STR("wired.file.data_size"));
+		wi_p7_message_set_uint64_for_name(reply, wi_number_int64(wi_dictionary_data_for_key(entry, WI_STR("rsrc_size"))), WI_STR("wired.file.rsrc_size"));
+	}
+	else if(type == WD_FILE_TYPE_DROPBOX && !readable) {
+		wi_p7_message_set_uint32_for_name(reply, 0, WI_STR("wired.file.directory_count"));
+	}
+	else {
+		wi_p7_message_set_uint32_for_name(reply, wi_number_int64(wi_dictionary_data_for_key(entry, WI_STR("directory_count"))), WI_STR("wired.file.directory_count"));
 	}
 	
-	wi_p7_message_set_date_for_name(reply, wi_date_with_time(sb.birthtime), WI_STR("wired.file.creation_time"));
-	wi_p7_message_set_date_for_name(reply, wi_date_with_time(sb.mtime), WI_STR("wired.file.modification_time"));
-	wi_p7_message_set_string_for_name(reply, comment, WI_STR("wired.file.comment"));
-	wi_p7_message_set_bool_for_name(reply, (alias || S_ISLNK(lsb.mode)), WI_STR("wired.file.link"));
-	wi_p7_message_set_bool_for_name(reply, (type == WD_FILE_TYPE_FILE && sb.mode & 0111), WI_STR("wired.file.executable"));
-	wi_p7_message_set_enum_for_name(reply, label, WI_STR("wired.file.label"));
-	wi_p7_message_set_uint32_for_name(reply, device, WI_STR("wired.file.volume"));
+	wi_p7_message_set_date_for_name(reply, wi_dictionary_data_for_key(entry, WI_STR("creation_time")), WI_STR("wired.file.creation_time"));
+	wi_p7_message_set_date_for_name(reply, wi_dictionary_data_for_key(entry, WI_STR("modification_time")), WI_STR("wired.file.modification_time"));
+	wi_p7_message_set_enum_for_name(reply, type, WI_STR("wired.file.type"));
+	wi_p7_message_set_bool_for_name(reply, wi_number_bool(wi_dictionary_data_for_key(entry, WI_STR("link"))), WI_STR("wired.file.link"));
+	wi_p7_message_set_bool_for_name(reply, wi_number_bool(wi_dictionary_data_for_key(entry, WI_STR("executable"))), WI_STR("wired.file.executable"));
+	wi_p7_message_set_enum_for_name(reply, wi_number_int32(wi_dictionary_data_for_key(entry, WI_STR("label"))), WI_STR("wired.file.label"));
+	wi_p7_message_set_uint32_for_name(reply, wi_number_int32(wi_dictionary_data_for_key(entry, WI_STR("volume"))), WI_STR("wired.file.volume"));
 	
 	if(type == WD_FILE_TYPE_DROPBOX) {
-		wi_p7_message_set_string_for_name(reply, privileges->owner, WI_STR("wired.file.owner"));
-		wi_p7_message_set_bool_for_name(reply, (privileges->mode & WD_FILE_OWNER_WRITE), WI_STR("wired.file.owner.write"));
-		wi_p7_message_set_bool_for_name(reply, (privileges->mode & WD_FILE_OWNER_READ), WI_STR("wired.file.owner.read"));
-		wi_p7_message_set_string_for_name(reply, privileges->group, WI_STR("wired.file.group"));
-		wi_p7_message_set_bool_for_name(reply, (privileges->mode & WD_FILE_GROUP_WRITE), WI_STR("wired.file.group.write"));
-		wi_p7_message_set_bool_for_name(reply, (privileges->mode & WD_FILE_GROUP_READ), WI_STR("wired.file.group.read"));
-		wi_p7_message_set_bool_for_name(reply, (privileges->mode & WD_FILE_EVERYONE_WRITE), WI_STR("wired.file.everyone.write"));
-		wi_p7_message_set_bool_for_name(reply, (privileges->mode & WD_FILE_EVERYONE_READ), WI_STR("wired.file.everyone.read"));
 		wi_p7_message_set_bool_for_name(reply, readable, WI_STR("wired.file.readable"));
 		wi_p7_message_set_bool_for_name(reply, writable, WI_STR("wired.file.writable"));
 	}
 	
-	wd_user_reply_message(user, reply, message);
+	wi_lock_lock(list->batchlock);
+	wd_user_batch_reply_message(&list->batch, reply);
+	wi_lock_unlock(list->batchlock);
+	wi_release(reply);
 	
-	return true;
+	return !(list->recursive && type == WD_FILE_TYPE_DROPBOX && !readable);
 }
 
 
 
-wi_boolean_t wd_files_reply_preview(wi_string_t *path, wd_user_t *user, wi_p7_message_t *message) {
-	wi_p7_message_t			*reply;
-	wi_string_t				*realpath;
-	wi_data_t				*data;
+wi_file_offset_t wd_files_count_path(wi_string_t *path, wd_user_t *user, wi_p7_message_t *message) {
+	wi_mutable_string_t		*filepath;
+	wi_dictionary_t			*entry;
+	wi_string_t				*key;
+	DIR						*dir;
+	struct dirent			*de, *dep;
 	wi_fs_stat_t			sb;
+	wi_file_offset_t		count = 0;
+	wi_boolean_t			cached = false;
 	
-	realpath = wi_string_by_resolving_aliases_in_path(wd_files_real_path(path, user));
-
-	if(!wi_fs_stat_path(realpath, &sb)) {
-		wi_log_error(WI_STR("Could not preview \"%@\": %m"), realpath);
-		wd_user_reply_file_errno(user, message);
+	if(wi_fs_stat_path(path, &sb)) {
+		key = wi_string_with_format(WI_STR("%u:%llu"), sb.dev, (unsigned long long) sb.ino);
 		
-		return false;
-	}
-	
-	if(sb.size > (10 * 1024 * 1024) - (10 * 1024)) {
-		wi_log_error(WI_STR("Could not preview \"%@\": Too large"), realpath);
-		wd_user_reply_internal_error(user, WI_STR("File too large to preview"), message);
+		wi_dictionary_rdlock(wd_files_count_cache);
 		
-		return false;
+		entry = wi_dictionary_data_for_key(wd_files_count_cache, key);
+		
+		if(entry && wi_number_int64(wi_dictionary_data_for_key(entry, WI_STR("mtime"))) == sb.mtime) {
+			count	= wi_number_int64(wi_dictionary_data_for_key(entry, WI_STR("count")));
+			cached	= true;
+		}
+		
+		wi_dictionary_unlock(wd_files_count_cache);
+		
+		if(cached)
+			return count;
+	} else {
+		key = NULL;
 	}
 	
-	data = wi_data_with_contents_of_file(realpath);
+	dir = opendir(wi_string_cstring(path));
 	
-	if(!data) {
-		wi_log_error(WI_STR("Could not preview \"%@\": %m"), realpath);
-		wd_user_reply_file_errno(user, message);
+	if(dir) {
+		filepath	= wi_mutable_copy(path);
+		de			= wi_malloc(sizeof(struct dirent) + WI_PATH_SIZE);
 		
-		return false;
+		wi_mutable_string_append_cstring(filepath, "/");
+		
+		while(readdir_r(dir, de, &dep) == 0 && dep) {
+			if(dep->d_name[0] != '.') {
+				wi_mutable_string_append_cstring(filepath, dep->d_name);
+				
+				if(!wi_fs_path_is_invisible(filepath))
+					count++;
+				
+				wi_mutable_string_delete_characters_from_index(filepath, wi_string_length(filepath) - strlen(dep->d_name));
+			}
+		}
+		
+		wi_release(filepath);
+
+		wi_free(de);
+
+		closedir(dir);
+		
+		/* a change within the same second would not move the mtime, so don't trust it yet */
+		if(key && sb.mtime < time(NULL) - 1) {
+			wi_dictionary_wrlock(wd_files_count_cache);
+			
+			if(wi_dictionary_count(wd_files_count_cache) >= WD_FILES_COUNT_CACHE_SIZE)
+				wi_mutable_dictionary_remove_all_data(wd_files_count_cache);
+			
+			wi_mutable_dictionary_set_data_for_key(wd_files_count_cache,
+				wi_dictionary_with_data_and_keys(
+					wi_number_with_int64(count),		WI_STR("count"),
+					wi_number_with_int64(sb.mtime),		WI_STR("mtime"),
+					NULL),
+				key);
+			
+			wi_dictionary_unlock(wd_files_count_cache);
+		}
+		
+		return count;
+	} else {
+		wi_log_error(WI_STR("Could not open \"%@\": %s"),
+			path, strerror(errno));
+		
+		if(user)
+			wd_user_reply_file_errno(user, message);
+		
+		return 0;
 	}
-	
-	reply = wi_p7_message_with_name(WI_STR("wired.file.preview"), wd_p7_spec);
-	wi_p7_message_set_string_for_name(reply, path, WI_STR("wired.file.path"));
-	wi_p7_message_set_data_for_name(reply, data, WI_STR("wired.file.preview"));
-	
-	wd_user_reply_message(user, reply, message);
-	
-	return true;
 }
 
 
 
-wi_boolean_t wd_files_create_path(wi_string_t *path, wd_file_type_t type, wd_user_t *user, wi_p7_message_t *message) {
-	wi_string_t		*realpath;
+/*
+	Non-recursive listings keep a snapshot of the raw entries per directory,
+	shared by all users. Drop box readability is resolved per request from
+	the privileges stored with each entry. A snapshot is only served while
+	the directory mtime matches and it is younger than the TTL, which bounds
+	staleness from changes no event reports, like a growing upload.
+*/
+
+static wi_array_t * wd_files_listing_snapshot(wi_fs_stat_t *dsbp, wi_string_t **digest) {
+	wi_dictionary_t		*snapshot;
+	wi_array_t			*entries = NULL;
+	
+	wi_dictionary_rdlock(wd_files_listing_cache);
+	
+	snapshot = wi_dictionary_data_for_key(wd_files_listing_cache,
+		wi_string_with_format(WI_STR("%u:%llu"), dsbp->dev, (unsigned long long) dsbp->ino));
+	
+	if(snapshot &&
+	   wi_number_int64(wi_dictionary_data_for_key(snapshot, WI_STR("mtime"))) == (int64_t) dsbp->mtime &&
+	   wi_number_int64(wi_dictionary_data_for_key(snapshot, WI_STR("time"))) > (int64_t) time(NULL) - WD_FILES_LISTING_CACHE_TTL) {
+		entries = wi_autorelease(wi_retain(wi_dictionary_data_for_key(snapshot, WI_STR("entries"))));
+		*digest	= wi_autorelease(wi_retain(wi_dictionary_data_for_key(snapshot, WI_STR("digest"))));
+	}
 	
-	realpath = wi_string_by_resolving_aliases_in_path(wd_files_real_path(path, user));
+	wi_dictionary_unlock(wd_files_listing_cache);
 	
-	if(!wi_fs_create_directory(realpath, 0777)) {
-		wi_log_error(WI_STR("Could not create \"%@\": %m"), realpath);
-		wd_user_reply_file_errno(user, message);
+	return entries;
+}
 
-		return false;
-	}
 
-	if(type != WD_FILE_TYPE_DIR)
-		wd_files_set_type(path, type, user, message);
+
+static wi_array_t * wd_files_listing_names(wi_string_t *path) {
+	wi_dictionary_t		*snapshot;
+	wi_array_t			*names = NULL;
+	wi_string_t			*key;
+	wi_fs_stat_t		sb;
 	
-	wd_index_add_file(realpath);
+	if(!wi_fs_stat_path(path, &sb))
+		return NULL;
 	
-	return true;
+	/* names only come and go with the directory mtime, unlike the entries above */
+	key = wi_string_with_format(WI_STR("%u:%llu:names"), sb.dev, (unsigned long long) sb.ino);
+	
+	wi_dictionary_rdlock(wd_files_listing_cache);
+	
+	snapshot = wi_dictionary_data_for_key(wd_files_listing_cache, key);
+	
+	if(snapshot && wi_number_int64(wi_dictionary_data_for_key(snapshot, WI_STR("mtime"))) == (int64_t) sb.mtime)
+		names = wi_autorelease(wi_retain(wi_dictionary_data_for_key(snapshot, WI_STR("names"))));
+	
+	wi_dictionary_unlock(wd_files_listing_cache);
+	
+	if(names)
+		return names;
+	
+	names = wi_fs_directory_contents_at_path(path);
+	
+	if(!names)
+		return NULL;
+	
+	names = wi_array_by_sorting(names, wi_string_compare);
+	
+	/* a change within the same second would not move the mtime, so don't trust it yet */
+	if(sb.mtime < time(NULL) - 1 && wi_array_count(names) <= WD_FILES_LISTING_CACHE_MAX_NAMES) {
+		wi_dictionary_wrlock(wd_files_listing_cache);
+		
+		/* the names of all directories together are bounded too, not just their number */
+		if(wi_dictionary_count(wd_files_listing_cache) >= WD_FILES_LISTING_CACHE_SIZE ||
+		   wd_files_listing_cache_names + wi_array_count(names) > WD_FILES_LISTING_CACHE_MAX_NAMES) {
+			wi_mutable_dictionary_remove_all_data(wd_files_listing_cache);
+			
+			wd_files_listing_cache_names = 0;
+		}
+		
+		wd_files_listing_cache_names += wi_array_count(names);
+		
+		wi_mutable_dictionary_set_data_for_key(wd_files_listing_cache,
+			wi_dictionary_with_data_and_keys(
+				names,								WI_STR("names"),
+				wi_number_with_int64(sb.mtime),		WI_STR("mtime"),
+				NULL),
+			key);
+		
+		wi_dictionary_unlock(wd_files_listing_cache);
+	}
+	
+	return names;
 }
 
 
 
-wi_boolean_t wd_files_delete_path(wi_string_t *path, wd_user_t *user, wi_p7_message_t *message) {
-	wi_mutable_string_t		*realpath;
-	wi_string_t				*component;
-	wi_boolean_t			result;
-	
-	realpath	= wi_autorelease(wi_mutable_copy(wd_files_real_path(path, user)));
-	component	= wi_string_last_path_component(realpath);
-
-	wi_mutable_string_delete_last_path_component(realpath);
-	wi_mutable_string_resolve_aliases_in_path(realpath);
-	wi_mutable_string_append_path_component(realpath, component);
+static void wd_files_set_listing_snapshot(wi_fs_stat_t *dsbp, wi_array_t *entries, wi_string_t *digest) {
+	/* a change within the same second would not move the mtime, so don't trust it yet */
+	if(dsbp->mtime >= time(NULL) - 1 || wi_array_count(entries) > WD_FILES_LISTING_CACHE_MAX_ENTRIES)
+		return;
 	
-	result = wi_fs_delete_path_with_callback(realpath, wd_files_delete_path_callback);
+	wi_dictionary_wrlock(wd_files_listing_cache);
 	
-	if(result) {
-		wd_files_remove_comment(path, NULL, NULL);
-		wd_files_remove_label(path, NULL, NULL);
-	} else {
-		wi_log_error(WI_STR("Could not delete \"%@\": %m"), realpath);
-		wd_user_reply_file_errno(user, message);
+	if(wi_dictionary_count(wd_files_listing_cache) >= WD_FILES_LISTING_CACHE_SIZE) {
+		wi_mutable_dictionary_remove_all_data(wd_files_listing_cache);
+		
+		wd_files_listing_cache_names = 0;
 	}
 	
-	return result;
+	wi_mutable_dictionary_set_data_for_key(wd_files_listing_cache,
+		wi_dictionary_with_data_and_keys(
+			entries,								WI_STR("entries"),
+			digest,									WI_STR("digest"),
+			wi_number_with_int64(dsbp->mtime),		WI_STR("mtime"),
+			wi_number_with_int64(time(NULL)),		WI_STR("time"),
+			NULL),
+		wi_string_with_format(WI_STR("%u:%llu"), dsbp->dev, (unsigned long long) dsbp->ino));
+	
+	wi_dictionary_unlock(wd_files_listing_cache);
 }
 
 
 
-static void wd_files_delete_path_callback(wi_string_t *path) {
-	wd_index_delete_file(path);
+static void wd_files_invalidate_listing(wi_string_t *path) {
+	wi_string_t		*key;
+	wi_fs_stat_t	sb;
+	wi_uinteger_t	i;
+	
+	/* the directory's own entry lives in its parent's listing */
+	for(i = 0; i < 2; i++) {
+		if(i > 0)
+			path = wi_string_by_deleting_last_path_component(path);
+		
+		if(!wi_fs_stat_path(path, &sb))
+			continue;
+		
+		key = wi_string_with_format(WI_STR("%u:%llu"), sb.dev, (unsigned long long) sb.ino);
+		
+		wi_dictionary_wrlock(wd_files_listing_cache);
+		wi_mutable_dictionary_remove_data_for_key(wd_files_listing_cache, key);
+		wi_mutable_dictionary_remove_data_for_key(wd_files_listing_cache, wi_string_by_appending_string(key, WI_STR(":names")));
+		wi_dictionary_unlock(wd_files_listing_cache);
+		
+		wi_dictionary_wrlock(wd_files_listing_generations);
+		
+		if(wi_dictionary_count(wd_files_listing_generations) >= WD_FILES_LISTING_GENERATIONS_SIZE) {
+			wi_mutable_dictionary_remove_all_data(wd_files_listing_generations);
+			
+			wd_files_listing_generation_floor = wd_files_listing_generation;
+		}
+		
+		wi_mutable_dictionary_set_data_for_key(wd_files_listing_generations,
+			wi_number_with_int64(++wd_files_listing_generation), key);
+		
+		wi_dictionary_unlock(wd_files_listing_generations);
+	}
 }
 
 
 
-wi_boolean_t wd_files_move_path(wi_string_t *frompath, wi_string_t *topath, wd_user_t *user, wi_p7_message_t *message) {
+/*
+	The version of a listing combines the directory mtime with a generation
+	that the invalidation above bumps for changes that don't move it, like
+	labels or counts of subdirectories. Generations forgotten to bound the
+	table all read as the last value handed out before, so a tag never
+	repeats for a changed directory; the start time covers restarts.
+	Children can change without touching either, like a growing upload or
+	a subdirectory gaining entries, so the tag also carries a digest of the
+	entries themselves, taken when they are read.
+*/
+
+static wi_string_t * wd_files_listing_digest(wi_array_t *entries) {
+	wi_mutable_string_t		*string;
+	wi_dictionary_t			*entry;
+	wi_uinteger_t			i, count;
+	
+	string	= wi_mutable_string();
+	count	= wi_array_count(entries);
+	
+	for(i = 0; i < count; i++) {
+		entry = WI_ARRAY(entries, i);
+		
+		wi_mutable_string_append_format(string, WI_STR("%@:%d:%lld:%lld:%lld:%.0f:%d:%d:%d\n"),
+			wi_dictionary_data_for_key(entry, WI_STR("path")),
+			wi_number_int32(wi_dictionary_data_for_key(entry, WI_STR("type"))),
+			wi_number_int64(wi_dictionary_data_for_key(entry, WI_STR("data_size"))),
+			wi_number_int64(wi_dictionary_data_for_key(entry, WI_STR("rsrc_size"))),
+			wi_number_int64(wi_dictionary_data_for_key(entry, WI_STR("directory_count"))),
+			wi_date_time_interval(wi_dictionary_data_for_key(entry, WI_STR("modification_time"))),
+			wi_number_int32(wi_dictionary_data_for_key(entry, WI_STR("label"))),
+			wi_number_bool(wi_dictionary_data_for_key(entry, WI_STR("executable"))),
+			wi_number_bool(wi_dictionary_data_for_key(entry, WI_STR("link"))));
+	}
+	
+	return wi_string_sha1(string);
+}
+
+
+
+
+static wi_string_t * wd_files_listing_version(wi_fs_stat_t *dsbp, wi_string_t *digest) {
+	wi_number_t			*number;
+	wi_string_t			*key;
+	int64_t				generation;
+	
+	/* a change within the same second would not move the mtime, so don't tag it yet */
+	if(dsbp->mtime >= time(NULL) - 1)
+		return NULL;
+	
+	key = wi_string_with_format(WI_STR("%u:%llu"), dsbp->dev, (unsigned long long) dsbp->ino);
+	
+	wi_dictionary_rdlock(wd_files_listing_generations);
+	
+	number = wi_dictionary_data_for_key(wd_files_listing_generations, key);
+	generation = number ? wi_number_int64(number) : (int64_t) wd_files_listing_generation_floor;
+	
+	wi_dictionary_unlock(wd_files_listing_generations);
+	
+	return wi_string_with_format(WI_STR("%x-%llx-%x-%llx-%@"),
+		(unsigned int) wd_files_listing_epoch,
+		(unsigned long long) dsbp->ino,
+		(unsigned int) dsbp->mtime,
+		(unsigned long long) generation,
+		digest);
+}
+
+
+
+static void wd_files_invalidate_count(wi_string_t *path) {
+	wi_fs_stat_t	sb;
+	
+	wd_files_invalidate_listing(path);
+	
+	if(!wi_fs_stat_path(path, &sb))
+		return;
+	
+	wi_dictionary_wrlock(wd_files_count_cache);
+	wi_mutable_dictionary_remove_data_for_key(wd_files_count_cache,
+		wi_string_with_format(WI_STR("%u:%llu"), sb.dev, (unsigned long long) sb.ino));
+	wi_dictionary_unlock(wd_files_count_cache);
+}
+
+
+
+
+wi_boolean_t wd_files_reply_info(wi_string_t *path, wd_user_t *user, wi_p7_message_t *message) {
+	wi_p7_message_t			*reply;
+	wi_string_t				*realpath, *parentpath, *comment;
+	wd_account_t			*account;
+	wd_files_privileges_t	*privileges = NULL;
+	wi_file_offset_t		datasize, rsrcsize;
+	wd_file_type_t			type;
+	wi_fs_stat_t			dsb, sb, lsb;
+	wd_file_label_t			label;
+	wi_uinteger_t			directorycount;
+	wi_boolean_t			alias, readable, writable;
+	uint32_t				device;
+	
+	account			= wd_user_account(user);
+	realpath		= wd_files_real_path(path, user);
+	alias			= wi_fs_path_is_alias(realpath);
+	realpath		= wi_string_by_resolving_aliases_in_path(realpath);
+	parentpath		= wi_string_by_deleting_last_path_component(realpath);
+
+	if(!wi_fs_stat_path(parentpath, &dsb)) {
+		wi_log_error(WI_STR("Could not read info for \"%@\": %m"), parentpath);
+		wd_user_reply_file_errno(user, message);
+		
+		return false;
+	}
+	
+	if(!wi_fs_lstat_path(realpath, &lsb)) {
+		wi_log_error(WI_STR("Could not read info for \"%@\": %m"), realpath);
+		wd_user_reply_file_errno(user, message);
+		
+		return false;
+	}
+	
+	if(!wi_fs_stat_path(realpath, &sb))
+		sb = lsb;
+
+	readable	= false;
+	writable	= false;
+	type		= wd_files_type_with_stat(realpath, &sb);
+	
+	if(type == WD_FILE_TYPE_DROPBOX) {
+		privileges	= wd_files_drop_box_privileges(realpath);
+		readable	= wd_files_privileges_is_readable_by_account(privileges, account);
+		writable	= wd_files_privileges_is_writable_by_account(privileges, account);
+	}
+	
+	comment = wd_files_comment(realpath);
+	
+	switch(type) {
+		case WD_FILE_TYPE_DIR:
+		case WD_FILE_TYPE_UPLOADS:
+			datasize		= 0;
+			rsrcsize		= 0;
+			directorycount	= wd_files_count_path(realpath, user, message);
+			break;
+			
+		case WD_FILE_TYPE_DROPBOX:
+			datasize		= 0;
+			rsrcsize		= 0;
+			directorycount	= readable ? wd_files_count_path(realpath, user, message) : 0;
+			break;
+
+		case WD_FILE_TYPE_FILE:
+		default:
+			datasize		= sb.size;
+			rsrcsize		= wi_fs_resource_fork_size_for_path(realpath);
+			directorycount	= 0;
+			break;
+	}
+
+	label = wd_files_label(realpath);
+	
+	device = alias ? dsb.dev : sb.dev;
+	
+	if(device == wd_files_root_volume)
+		device = 0;
+	
+	reply = wi_p7_message_with_name(WI_STR("wired.file.info"), wd_p7_spec);
+	wi_p7_message_set_string_for_name(reply, path, WI_STR("wired.file.path"));
+	wi_p7_message_set_enum_for_name(reply, type, WI_STR("wired.file.type"));
+	
+	if(type == WD_FILE_TYPE_FILE) {
+		wi_p7_message_set_uint64_for_name(reply, datasize, WI_STR("wired.file.data_size"));
+		wi_p7_message_set_uint64_for_name(reply, rsrcsize, WI_STR("wired.file.rsrc_size"));
+	} else {
+		wi_p7_message_set_uint32_for_name(reply, directorycount, WI_STR("wired.file.directory_count"));
+	}
+	
+	wi_p7_message_set_date_for_name(reply, wi_date_with_time(sb.birthtime), WI_STR("wired.file.creation_time"));
+	wi_p7_message_set_date_for_name(reply, wi_date_with_time(sb.mtime), WI_STR("wired.file.modification_time"));
+	wi_p7_message_set_string_for_name(reply, comment, WI_STR("wired.file.comment"));
+	wi_p7_message_set_bool_for_name(reply, (alias || S_ISLNK(lsb.mode)), WI_STR("wired.file.link"));
+	wi_p7_message_set_bool_for_name(reply, (type == WD_FILE_TYPE_FILE && sb.mode & 0111), WI_STR("wired.file.executable"));
+	wi_p7_message_set_enum_for_name(reply, label, WI_STR("wired.file.label"));
+	wi_p7_message_set_uint32_for_name(reply, device, WI_STR("wired.file.volume"));
+	
+	if(type == WD_FILE_TYPE_DROPBOX) {
+		wi_p7_message_set_string_for_name(reply, privileges->owner, WI_STR("wired.file.owner"));
+		wi_p7_message_set_bool_for_name(reply, (privileges->mode & WD_FILE_OWNER_WRITE), WI_STR("wired.file.owner.write"));
+		wi_p7_message_set_bool_for_name(reply, (privileges->mode & WD_FILE_OWNER_READ), WI_STR("wired.file.owner.read"));
+		wi_p7_message_set_string_for_name(reply, privileges->group, WI_STR("wired.file.group"));
+		wi_p7_message_set_bool_for_name(reply, (privileges->mode & WD_FILE_GROUP_WRITE), WI_STR("wired.file.group.write"));
+		wi_p7_message_set_bool_for_name(reply, (privileges->mode & WD_FILE_GROUP_READ), WI_STR("wired.file.group.read"));
+		wi_p7_message_set_bool_for_name(reply, (privileges->mode & WD_FILE_EVERYONE_WRITE), WI_STR("wired.file.everyone.write"));
+		wi_p7_message_set_bool_for_name(reply, (privileges->mode & WD_FILE_EVERYONE_READ), WI_STR("wired.file.everyone.read"));
+		wi_p7_message_set_bool_for_name(reply, readable, WI_STR("wired.file.readable"));
+		wi_p7_message_set_bool_for_name(reply, writable, WI_STR("wired.file.writable"));
+	}
+	
+	wd_user_reply_message(user, reply, message);
+	
+	return true;
+}
+
+
+
+wi_boolean_t wd_files_reply_preview(wi_string_t *path, wd_user_t *user, wi_p7_message_t *message) {
+	wi_p7_message_t			*reply;
+	wi_string_t				*realpath;
+	wi_data_t				*data;
+	wi_fs_stat_t			sb;
+	wi_p7_uint64_t			offset, length;
+	wi_boolean_t			ranged;
+	
+	realpath = wi_string_by_resolving_aliases_in_path(wd_files_real_path(path, user));
+
+	if(!wi_fs_stat_path(realpath, &sb)) {
+		wi_log_error(WI_STR("Could not preview \"%@\": %m"), realpath);
+		wd_user_reply_file_errno(user, message);
+		
+		return false;
+	}
+	
+	offset	= 0;
+	length	= 0;
+	ranged	= wi_p7_message_get_uint64_for_name(message, &offset, WI_STR("wired.file.preview_offset"));
+	ranged	= wi_p7_message_get_uint64_for_name(message, &length, WI_STR("wired.file.preview_length")) || ranged;
+	
+	if(ranged)
+		return wd_files_reply_preview_range(path, realpath, sb.size, offset, length, user, message);
+	
+	if(sb.size > WD_FILES_PREVIEW_MAX_SIZE) {
+		wi_log_error(WI_STR("Could not preview \"%@\": Too large"), realpath);
+		wd_user_reply_internal_error(user, WI_STR("File too large to preview"), message);
+		
+		return false;
+	}
+	
+	data = wi_data_with_contents_of_file(realpath);
+	
+	if(!data) {
+		wi_log_error(WI_STR("Could not preview \"%@\": %m"), realpath);
+		wd_user_reply_file_errno(user, message);
+		
+		return false;
+	}
+	
+	reply = wi_p7_message_with_name(WI_STR("wired.file.preview"), wd_p7_spec);
+	wi_p7_message_set_string_for_name(reply, path, WI_STR("wired.file.path"));
+	wi_p7_message_set_data_for_name(reply, data, WI_STR("wired.file.preview"));
+	
+	wd_user_reply_message(user, reply, message);
+	
+	return true;
+}
+
+
+
+static wi_boolean_t wd_files_reply_preview_range(wi_string_t *path, wi_string_t *realpath, wi_file_offset_t size, wi_file_offset_t offset, wi_file_offset_t length, wd_user_t *user, wi_p7_message_t *message) {
+	wi_pool_t				*pool;
+	wi_p7_message_t			*reply;
+	void					*buffer;
+	ssize_t					readbytes = 0;
+	int						fd;
+	
+	if(offset > size)
+		offset = size;
+	
+	if(length == 0 || length > size - offset)
+		length = size - offset;
+	
+	if(length > WD_FILES_PREVIEW_MAX_SIZE)
+		length = WD_FILES_PREVIEW_MAX_SIZE;
+	
+	fd = open(wi_string_cstring(realpath), O_RDONLY, 0);
+	
+	if(fd < 0) {
+		wi_error_set_errno(errno);
+		
+		wi_log_error(WI_STR("Could not preview \"%@\": %m"), realpath);
+		wd_user_reply_file_errno(user, message);
+		
+		return false;
+	}
+	
+	buffer	= wi_malloc(WD_FILES_PREVIEW_CHUNK_SIZE);
+	pool	= wi_pool_init(wi_pool_alloc());
+	
+	/* send the range in bounded chunks so a preview never holds more than one in memory */
+	while(length > 0) {
+		readbytes = pread(fd, buffer, WI_MIN(length, WD_FILES_PREVIEW_CHUNK_SIZE), offset);
+		
+		if(readbytes <= 0)
+			break;
+		
+		reply = wi_p7_message_with_name(WI_STR("wired.file.preview"), wd_p7_spec);
+		wi_p7_message_set_string_for_name(reply, path, WI_STR("wired.file.path"));
+		wi_p7_message_set_data_for_name(reply, wi_data_with_bytes(buffer, readbytes), WI_STR("wired.file.preview"));
+		wi_p7_message_set_uint64_for_name(reply, offset, WI_STR("wired.file.preview_offset"));
+		wd_user_reply_message(user, reply, message);
+		
+		offset	+= readbytes;
+		length	-= readbytes;
+		
+		wi_pool_drain(pool);
+	}
+	
+	if(readbytes < 0)
+		wi_error_set_errno(errno);
+	
+	wi_release(pool);
+	wi_free(buffer);
+	
+	close(fd);
+	
+	if(readbytes < 0) {
+		wi_log_error(WI_STR("Could not preview \"%@\": %m"), realpath);
+		wd_user_reply_file_errno(user, message);
+		
+		return false;
+	}
+	
+	reply = wi_p7_message_with_name(WI_STR("wired.file.preview.done"), wd_p7_spec);
+	wi_p7_message_set_string_for_name(reply, path, WI_STR("wired.file.path"));
+	wi_p7_message_set_uint64_for_name(reply, size, WI_STR("wired.file.data_size"));
+	wd_user_reply_message(user, reply, message);
+	
+	return true;
+}
+
+
+
+wi_boolean_t wd_files_create_path(wi_string_t *path, wd_file_type_t type, wd_user_t *user, wi_p7_message_t *message) {
+	wi_string_t		*realpath;
+	
+	realpath = wi_string_by_resolving_aliases_in_path(wd_files_real_path(path, user));
+	
+	if(!wi_fs_create_directory(realpath, 0777)) {
+		wi_log_error(WI_STR("Could not create \"%@\": %m"), realpath);
+		wd_user_reply_file_errno(user, message);
+
+		return false;
+	}
+
+	wd_files_invalidate_path(realpath);
+
+	if(type != WD_FILE_TYPE_DIR)
+		wd_files_set_type(path, type, user, message);
+	
+	wd_index_add_file(realpath);
+	
+	return true;
+}
+
+
+
+wi_boolean_t wd_files_delete_path(wi_string_t *path, wd_user_t *user, wi_p7_message_t *message) {
+	wi_mutable_string_t		*realpath;
+	wi_string_t				*component;
+	wi_boolean_t			result;
+	
+	realpath	= wi_autorelease(wi_mutable_copy(wd_files_real_path(path, user)));
+	component	= wi_string_last_path_component(realpath);
+
+	wi_mutable_string_delete_last_path_component(realpath);
+	wi_mutable_string_resolve_aliases_in_path(realpath);
+	wi_mutable_string_append_path_component(realpath, component);
+	
+	result = wd_files_trash_path_for_deletion(realpath);
+	
+	if(!result)
+		result = wi_fs_delete_path(realpath);
+	
+	if(result) {
+		wd_files_invalidate_path(realpath);
+		wd_index_delete_files(realpath);
+
+		if(wd_files_metadata_database) {
+			wd_files_delete_metadata(realpath);
+		} else {
+			wd_files_remove_comment(path, NULL, NULL);
+			wd_files_remove_label(path, NULL, NULL);
+		}
+	} else {
+		wi_log_error(WI_STR("Could not delete \"%@\": %m"), realpath);
+		wd_user_reply_file_errno(user, message);
+	}
+	
+	return result;
+}
+
+
+
+static wi_string_t * wd_files_trash_path(void) {
+	wi_string_t		*path;
+	
+	path = wi_string_by_appending_path_component(wi_string_by_resolving_aliases_in_path(wd_files),
+		WI_STR(WD_FILES_META_TRASH_PATH));
+	
+	if(!wi_fs_path_exists(path, NULL)) {
+		if(!wi_fs_path_exists(wi_string_by_deleting_last_path_component(path), NULL))
+			wi_fs_create_directory(wi_string_by_deleting_last_path_component(path), 0777);
+
+		if(!wi_fs_create_directory(path, 0700))
+			return NULL;
+	}
+	
+	return path;
+}
+
+
+
+static wi_boolean_t wd_files_trash_path_for_deletion(wi_string_t *path) {
+	wi_string_t		*trashpath;
+	wi_fs_stat_t	sb;
+	wi_uinteger_t	counter;
+	
+	/* plain files are cheap to unlink, only whole directories are worth handing to the reaper */
+	if(!wi_fs_lstat_path(path, &sb) || !S_ISDIR(sb.mode))
+		return false;
+	
+	trashpath = wd_files_trash_path();
+	
+	if(!trashpath)
+		return false;
+	
+	wi_condition_lock_lock(wd_files_trash_lock);
+	counter = ++wd_files_trash_counter;
+	wi_condition_lock_unlock(wd_files_trash_lock);
+	
+	trashpath = wi_string_by_appending_path_component(trashpath,
+		wi_string_with_format(WI_STR("%u.%u"), (unsigned int) time(NULL), counter));
+	
+	/* fails with EXDEV for paths on other volumes, which are then deleted in place */
+	if(rename(wi_string_cstring(path), wi_string_cstring(trashpath)) < 0)
+		return false;
+	
+	wi_condition_lock_lock(wd_files_trash_lock);
+	wi_condition_lock_unlock_with_condition(wd_files_trash_lock, 1);
+	
+	return true;
+}
+
+
+
+static void wd_files_trash_thread(wi_runtime_instance_t *argument) {
+	wi_pool_t		*pool;
+	
+	pool = wi_pool_init(wi_pool_alloc());
+	
+	while(true) {
+		wi_condition_lock_lock_when_condition(wd_files_trash_lock, 1, 0.0);
+		wi_condition_lock_unlock_with_condition(wd_files_trash_lock, 0);
+		
+		wd_files_empty_trash();
+		
+		wi_pool_drain(pool);
+	}
+	
+	wi_release(pool);
+}
+
+
+
+static void wd_files_empty_trash(void) {
+	wi_array_t			*paths;
+	wi_string_t			*trashpath, *path;
+	wi_time_interval_t	interval;
+	wi_uinteger_t		i, count;
+	
+	trashpath = wi_string_by_appending_path_component(wi_string_by_resolving_aliases_in_path(wd_files),
+		WI_STR(WD_FILES_META_TRASH_PATH));
+	
+	if(!wi_fs_path_exists(trashpath, NULL))
+		return;
+	
+	paths = wi_fs_directory_contents_at_path(trashpath);
+	
+	if(!paths) {
+		wi_log_error(WI_STR("Could not read \"%@\": %m"), trashpath);
+		
+		return;
+	}
+	
+	count = wi_array_count(paths);
+	
+	for(i = 0; i < count; i++) {
+		path		= wi_string_by_appending_path_component(trashpath, WI_ARRAY(paths, i));
+		interval	= wi_time_interval();
+		
+		if(wi_fs_delete_path(path))
+			wi_log_debug(WI_STR("Reaped \"%@\" in %.2f seconds"), path, wi_time_interval() - interval);
+		else
+			wi_log_error(WI_STR("Could not delete \"%@\": %m"), path);
+	}
+}
+
+
+
+wi_boolean_t wd_files_move_path(wi_string_t *frompath, wi_string_t *topath, wd_user_t *user, wi_p7_message_t *message) {
 	wi_array_t				*array;
 	wi_mutable_string_t		*realfrompath, *realtopath;
-	wi_string_t				*realfromname, *realtoname;
-	wi_string_t				*path;
+	wi_string_t				*realfromname, *realtoname;
+	wi_string_t				*path;
+	wi_fs_stat_t			sb;
+	wi_boolean_t			result = false;
+	
+	realfrompath	= wi_autorelease(wi_mutable_copy(wd_files_real_path(frompath, user)));
+	realtopath		= wi_autorelease(wi_mutable_copy(wd_files_real_path(topath, user)));
+	realfromname	= wi_string_last_path_component(realfrompath);
+	realtoname		= wi_string_last_path_component(realtopath);
+
+	wi_mutable_string_delete_last_path_component(realfrompath);
+	wi_mutable_string_resolve_aliases_in_path(realfrompath);
+	wi_mutable_string_append_path_component(realfrompath, realfromname);
+
+	wi_mutable_string_delete_last_path_component(realtopath);
+	wi_mutable_string_resolve_aliases_in_path(realtopath);
+	wi_mutable_string_append_path_component(realtopath, realtoname);
+	
+	if(!wi_fs_lstat_path(realfrompath, &sb)) {
+		wi_log_error(WI_STR("Could not read info for \"%@\": %m"), realfrompath);
+		wd_user_reply_file_errno(user, message);
+
+		return false;
+	}
+
+	if(wi_string_case_insensitive_compare(realfrompath, realtopath) == 0) {
+		path = wi_fs_temporary_path_with_template(
+			wi_string_with_format(WI_STR("%@/.%@.XXXXXXXX"),
+				  wi_string_by_deleting_last_path_component(realfrompath),
+				  wi_string_last_path_component(realfromname)));
+		
+		if(path) {
+			result = wi_fs_rename_path(realfrompath, path);
+		
+			if(result)
+				result = wi_fs_rename_path(path, realtopath);
+		}
+	} else {
+		if(wi_fs_lstat_path(realtopath, &sb)) {
+			wd_user_reply_error(user, WI_STR("wired.error.file_exists"), message);
+
+			return false;
+		}
+		
+		result = wi_fs_rename_path(realfrompath, realtopath);
+	}
+	
+	if(result) {
+		wd_files_invalidate_path(realfrompath);
+		wd_files_invalidate_path(realtopath);
+		
+		if(wd_files_metadata_database) {
+			wd_files_move_metadata(realfrompath, realtopath);
+		} else {
+			wd_files_move_comment(frompath, topath, user, message);
+			wd_files_move_label(frompath, topath, user, message);
+		}
+		
+		wd_index_move_files(realfrompath, realtopath);
+	} else {
+		if(wi_error_code() == EXDEV) {
+			array = wi_array_init_with_data(wi_array_alloc(),
+				frompath,
+				topath,
+				realfrompath,
+				realtopath,
+				user,
+				message,
+				(void *) NULL);
+			
+			result = wi_thread_create_thread(wd_files_move_thread, array);
+			
+			if(!result) {
+				wi_log_error(WI_STR("Could not create a copy thread: %m"));
+				wd_user_reply_internal_error(user, wi_error_string(), message);
+			}
+			
+			wi_release(array);
+		} else {
+			wi_log_error(WI_STR("Could not rename \"%@\" to \"%@\": %m"),
+				realfrompath, realtopath);
+			wd_user_reply_file_errno(user, message);
+		}
+	}
+	
+	return result;
+}
+
+
+
+static void wd_files_move_thread(wi_runtime_instance_t *argument) {
+	wi_pool_t			*pool;
+	wi_array_t			*array = argument;
+	wi_string_t			*frompath, *topath, *realfrompath, *realtopath, *temporarypath;
+	wd_files_copy_t		copy;
+	wi_time_interval_t	interval;
+	
+	pool			= wi_pool_init(wi_pool_alloc());
+	frompath		= WI_ARRAY(array, 0);
+	topath			= WI_ARRAY(array, 1);
+	realfrompath	= WI_ARRAY(array, 2);
+	realtopath		= WI_ARRAY(array, 3);
+	interval		= wi_time_interval();
+	
+	copy.user		= WI_ARRAY(array, 4);
+	copy.message	= WI_ARRAY(array, 5);
+	copy.frompath	= frompath;
+	copy.topath		= topath;
+	copy.size		= wd_files_size_of_path(realfrompath);
+	copy.copied		= 0;
+	copy.interval	= 0.0;
+	
+	/* a directory tree is copied under a hidden name too, and appears in one rename when complete */
+	temporarypath	= wi_fs_temporary_path_with_template(
+		wi_string_with_format(WI_STR("%@/.%@.XXXXXXXX"),
+			  wi_string_by_deleting_last_path_component(realtopath),
+			  wi_string_last_path_component(realtopath)));
+	
+	if(temporarypath && wd_files_copy_path(realfrompath, temporarypath, &copy) && wi_fs_rename_path(temporarypath, realtopath)) {
+		wd_files_copy_note_done(&copy, NULL);
+		wd_files_invalidate_path(realtopath);
+		
+		if(wd_files_metadata_database) {
+			wd_files_move_metadata(realfrompath, realtopath);
+		} else {
+			wd_files_move_comment(frompath, topath, NULL, NULL);
+			wd_files_move_label(frompath, topath, NULL, NULL);
+		}
+		
+		wd_index_move_files(realfrompath, realtopath);
+		
+		if(!wi_fs_delete_path(realfrompath))
+			wi_log_error(WI_STR("Could not delete \"%@\": %m"), realfrompath);
+		else
+			wd_files_invalidate_path(realfrompath);
+		
+		wi_log_info(WI_STR("Moved \"%@\" to \"%@\" across volumes, %@ in %.2f seconds"),
+			realfrompath, realtopath, wd_files_string_for_bytes(copy.copied), wi_time_interval() - interval);
+	} else {
+		wi_log_error(WI_STR("Could not copy \"%@\" to \"%@\": %m"), realfrompath, realtopath);
+		wd_files_copy_note_done(&copy, wi_error_string());
+		
+		/* whatever made it across is incomplete, the original is still where it was */
+		if(temporarypath)
+			wi_fs_delete_path(temporarypath);
+	}
+	
+	wi_release(pool);
+}
+
+
+
+static wi_boolean_t wd_files_copy_path(wi_string_t *frompath, wi_string_t *topath, wd_files_copy_t *copy) {
+	wi_pool_t					*pool;
+	wi_fsenumerator_t			*fsenumerator;
+	wi_mutable_array_t			*directories;
+	wi_array_t					*directory;
+	wi_string_t					*path, *childpath;
+	wi_fs_stat_t				sb;
+	wi_fsenumerator_status_t	status;
+	wi_uinteger_t				i = 0, pathlength;
+	wi_boolean_t				result = true;
+	
+	if(!wi_fs_lstat_path(frompath, &sb))
+		return false;
+	
+	if(!wd_files_copy_entry(frompath, topath, &sb, copy))
+		return false;
+	
+	if(!S_ISDIR(sb.mode))
+		return true;
+	
+	fsenumerator = wi_fs_enumerator_at_path(frompath);
+	
+	if(!fsenumerator)
+		return false;
+	
+	directories	= wi_mutable_array();
+	
+	wi_mutable_array_add_data(directories, wi_array_with_data(topath, wi_number_with_int32(sb.mode & 07777), NULL));
+	
+	pool		= wi_pool_init(wi_pool_alloc());
+	pathlength	= wi_string_length(frompath);
+	
+	while((status = wi_fsenumerator_get_next_path(fsenumerator, &path)) != WI_FSENUMERATOR_EOF) {
+		if(status == WI_FSENUMERATOR_ERROR || !wi_fs_lstat_path(path, &sb)) {
+			result = false;
+			
+			break;
+		}
+		
+		childpath = wi_string_by_appending_string(topath, wi_string_substring_from_index(path, pathlength));
+		
+		if(!wd_files_copy_entry(path, childpath, &sb, copy)) {
+			result = false;
+			
+			break;
+		}
+		
+		if(S_ISDIR(sb.mode))
+			wi_mutable_array_add_data(directories, wi_array_with_data(childpath, wi_number_with_int32(sb.mode & 07777), NULL));
+		
+		if(++i % 100 == 0)
+			wi_pool_drain(pool);
+	}
+	
+	/* deepest first, so that a parent without search permission doesn't lock out its children */
+	for(i = wi_array_count(directories); result && i > 0; i--) {
+		directory = WI_ARRAY(directories, i - 1);
+		
+		if(!wi_fs_set_mode_for_path(WI_ARRAY(directory, 0), wi_number_int32(WI_ARRAY(directory, 1))))
+			result = false;
+	}
+	
+	wi_release(pool);
+	
+	return result;
+}
+
+
+
+static wi_boolean_t wd_files_copy_entry(wi_string_t *frompath, wi_string_t *topath, wi_fs_stat_t *sbp, wd_files_copy_t *copy) {
+	char		buffer[WI_PATH_SIZE];
+	ssize_t		length;
+	
+	if(S_ISDIR(sbp->mode)) {
+		/* the source's mode may not let us write into it, wd_files_copy_path applies it once the contents are in */
+		if(mkdir(wi_string_cstring(topath), 0700) < 0) {
+			wi_error_set_errno(errno);
+			
+			return false;
+		}
+	}
+	else if(S_ISLNK(sbp->mode)) {
+		length = readlink(wi_string_cstring(frompath), buffer, sizeof(buffer) - 1);
+		
+		if(length < 0) {
+			wi_error_set_errno(errno);
+			
+			return false;
+		}
+		
+		buffer[length] = '\0';
+		
+		if(symlink(buffer, wi_string_cstring(topath)) < 0) {
+			wi_error_set_errno(errno);
+			
+			return false;
+		}
+	}
+	else if(S_ISREG(sbp->mode)) {
+		return wd_files_copy_file(frompath, topath, sbp, copy);
+	}
+	
+	return true;
+}
+
+
+
+static wi_boolean_t wd_files_copy_file(wi_string_t *frompath, wi_string_t *topath, wi_fs_stat_t *sbp, wd_files_copy_t *copy) {
+	struct timeval		tv[2];
+	wi_string_t			*temporarypath;
+	char				*buffer;
+	wi_file_offset_t	offset = 0;
+	ssize_t				readbytes, writtenbytes, bytes;
+	int					fromfd, tofd;
+	wi_boolean_t		result = true;
+	
+	fromfd = open(wi_string_cstring(frompath), O_RDONLY, 0);
+	
+	if(fromfd < 0) {
+		wi_error_set_errno(errno);
+		
+		return false;
+	}
+	
+	/* clients only ever see the finished copy, it is renamed into place at the end */
+	temporarypath	= wi_string_by_appending_path_component(wi_string_by_deleting_last_path_component(topath),
+		wi_string_with_format(WI_STR(".%@.WiredCopy"), wi_string_last_path_component(topath)));
+	tofd			= open(wi_string_cstring(temporarypath), O_WRONLY | O_CREAT | O_TRUNC, sbp->mode & 0777);
+	
+	if(tofd < 0) {
+		wi_error_set_errno(errno);
+		
+		close(fromfd);
+		
+		return false;
+	}
+	
+#ifdef FICLONE
+	/* separate devices can still share a filesystem, e.g. btrfs subvolumes */
+	if(ioctl(tofd, FICLONE, fromfd) == 0) {
+		offset			= sbp->size;
+		copy->copied	+= sbp->size;
+	}
+#endif
+	
+#ifdef SYS_copy_file_range
+	while(offset < (wi_file_offset_t) sbp->size) {
+		bytes = syscall(SYS_copy_file_range, fromfd, NULL, tofd, NULL, WI_MIN(sbp->size - offset, WD_FILES_COPY_CHUNK_SIZE), 0);
+		
+		/* EXDEV, ENOSYS and friends leave both offsets alone, so the loop below takes over */
+		if(bytes <= 0)
+			break;
+		
+		offset			+= bytes;
+		copy->copied	+= bytes;
+		
+		wd_files_copy_note_progress(copy, false);
+	}
+#endif
+	
+	if(offset < (wi_file_offset_t) sbp->size) {
+		buffer = wi_malloc(WD_FILES_COPY_BUFFER_SIZE);
+		
+		while(result && (readbytes = read(fromfd, buffer, WD_FILES_COPY_BUFFER_SIZE)) != 0) {
+			if(readbytes < 0) {
+				wi_error_set_errno(errno);
+				
+				result = false;
+				break;
+			}
+			
+			for(writtenbytes = 0; writtenbytes < readbytes; writtenbytes += bytes) {
+				bytes = write(tofd, buffer + writtenbytes, readbytes - writtenbytes);
+				
+				if(bytes < 0) {
+					wi_error_set_errno(errno);
+					
+					result = false;
+					break;
+				}
+			}
+			
+			copy->copied += readbytes;
+			
+			wd_files_copy_note_progress(copy, false);
+		}
+		
+		wi_free(buffer);
+	}
+	
+	close(fromfd);
+	
+	if(close(tofd) < 0 && result) {
+		wi_error_set_errno(errno);
+		
+		result = false;
+	}
+	
+	if(result) {
+		tv[0].tv_sec	= sbp->atime;
+		tv[0].tv_usec	= 0;
+		tv[1].tv_sec	= sbp->mtime;
+		tv[1].tv_usec	= 0;
+		
+		utimes(wi_string_cstring(temporarypath), tv);
+		
+		if(rename(wi_string_cstring(temporarypath), wi_string_cstring(topath)) < 0) {
+			wi_error_set_errno(errno);
+			
+			result = false;
+		}
+	}
+	
+	if(!result)
+		unlink(wi_string_cstring(temporarypath));
+	
+	return result;
+}
+
+
+
+static wi_file_offset_t wd_files_size_of_path(wi_string_t *path) {
+	wi_pool_t					*pool;
+	wi_fsenumerator_t			*fsenumerator;
+	wi_string_t					*childpath;
+	wi_fs_stat_t				sb;
+	wi_fsenumerator_status_t	status;
+	wi_file_offset_t			size = 0;
+	wi_uinteger_t				i = 0;
+	
+	if(!wi_fs_lstat_path(path, &sb))
+		return 0;
+	
+	if(!S_ISDIR(sb.mode))
+		return S_ISREG(sb.mode) ? sb.size : 0;
+	
+	fsenumerator = wi_fs_enumerator_at_path(path);
+	
+	if(!fsenumerator)
+		return 0;
+	
+	pool = wi_pool_init(wi_pool_alloc());
+	
+	while((status = wi_fsenumerator_get_next_path(fsenumerator, &childpath)) != WI_FSENUMERATOR_EOF) {
+		if(status == WI_FSENUMERATOR_PATH && wi_fs_lstat_path(childpath, &sb) && S_ISREG(sb.mode))
+			size += sb.size;
+		
+		if(++i % 100 == 0)
+			wi_pool_drain(pool);
+	}
+	
+	wi_release(pool);
+	
+	return size;
+}
+
+
+
+static void wd_files_copy_note_progress(wd_files_copy_t *copy, wi_boolean_t force) {
+	wi_time_interval_t	interval;
+	
+	if(!copy->user)
+		return;
+	
+	interval = wi_time_interval();
+	
+	if(!force && interval - copy->interval < WD_FILES_COPY_PROGRESS_INTERVAL)
+		return;
+	
+	copy->interval = interval;
+	
+	if(wd_user_state(copy->user) != WD_USER_LOGGED_IN)
+		return;
+	
+	wd_user_reply_message(copy->user, wd_files_copy_progress_message(copy), copy->message);
+}
+
+
+
+static void wd_files_copy_note_done(wd_files_copy_t *copy, wi_string_t *error) {
+	wi_p7_message_t		*reply;
+	
+	if(!copy->user || wd_user_state(copy->user) != WD_USER_LOGGED_IN)
+		return;
+	
+	/* the move was already acknowledged, this tells the client how it ended */
+	reply = wd_files_copy_progress_message(copy);
+	wi_p7_message_set_bool_for_name(reply, true, WI_STR("wired.file.move_done"));
+	
+	if(error)
+		wi_p7_message_set_string_for_name(reply, error, WI_STR("wired.error.string"));
+	
+	wd_user_reply_message(copy->user, reply, copy->message);
+}
+
+
+
+static wi_p7_message_t * wd_files_copy_progress_message(wd_files_copy_t *copy) {
+	wi_p7_message_t		*reply;
+	
+	reply = wi_p7_message_with_name(WI_STR("wired.file.move_progress"), wd_p7_spec);
+	wi_p7_message_set_string_for_name(reply, copy->frompath, WI_STR("wired.file.path"));
+	wi_p7_message_set_string_for_name(reply, copy->topath, WI_STR("wired.file.new_path"));
+	wi_p7_message_set_uint64_for_name(reply, copy->size, WI_STR("wired.transfer.data_size"));
+	wi_p7_message_set_uint64_for_name(reply, copy->copied, WI_STR("wired.transfer.transferred"));
+	
+	return reply;
+}
+
+
+
+wi_boolean_t wd_files_unshare_path(wi_string_t *path) {
+	struct stat			lsb;
+	wi_fs_stat_t		sb;
+	wd_files_copy_t		copy;
+	
+	/* deduplicated uploads may be hard links, give this one its own inode before it changes in place */
+	if(lstat(wi_string_cstring(path), &lsb) < 0 || !S_ISREG(lsb.st_mode) || lsb.st_nlink <= 1)
+		return true;
+	
+	if(!wi_fs_lstat_path(path, &sb))
+		return false;
+	
+	memset(&copy, 0, sizeof(copy));
+	
+	/* the copy replaces the link by renaming over it */
+	return wd_files_copy_file(path, path, &sb, &copy);
+}
+
+
+
+void wd_files_invalidate_path(wi_string_t *path) {
+	/* a count carried over by delta could miss changes nobody told us about, so the next list recounts */
+	wd_files_invalidate_count(wi_string_by_deleting_last_path_component(path));
+}
+
+
+
+wi_boolean_t wd_files_link_path(wi_string_t *frompath, wi_string_t *topath, wd_user_t *user, wi_p7_message_t *message) {
+	wi_mutable_string_t		*realfrompath, *realtopath;
+	wi_string_t				*realfromname, *realpath;
 	wi_fs_stat_t			sb;
-	wi_boolean_t			result = false;
 	
-	realfrompath	= wi_autorelease(wi_mutable_copy(wd_files_real_path(frompath, user)));
-	realtopath		= wi_autorelease(wi_mutable_copy(wd_files_real_path(topath, user)));
-	realfromname	= wi_string_last_path_component(realfrompath);
-	realtoname		= wi_string_last_path_component(realtopath);
+	realfrompath	= wi_autorelease(wi_mutable_copy(wd_files_real_path(frompath, user)));
+	realtopath		= wi_autorelease(wi_mutable_copy(wd_files_real_path(topath, user)));
+	realfromname	= wi_string_last_path_component(realfrompath);
+
+	wi_mutable_string_delete_last_path_component(realfrompath);
+	wi_mutable_string_resolve_aliases_in_path(realfrompath);
+	wi_mutable_string_resolve_aliases_in_path(realtopath);
+	wi_mutable_string_append_path_component(realfrompath, realfromname);
+	
+	if(!wi_fs_lstat_path(realfrompath, &sb)) {
+		wi_log_error(WI_STR("Could not read info for \"%@\": %m"), realfrompath);
+		wd_user_reply_file_errno(user, message);
+
+		return false;
+	}
+
+	if(wi_fs_lstat_path(realtopath, &sb)) {
+		wd_user_reply_error(user, WI_STR("wired.error.file_exists"), message);
+
+		return false;
+	}
+	
+	realpath = wi_fs_real_path_for_path(realfrompath);
+	
+	if(!realpath) {
+		wi_log_error(WI_STR("Could not get real path for \"%@\": %m"), realfrompath);
+		wd_user_reply_file_errno(user, message);
+
+		return false;
+	}
+	
+	if(!wi_fs_symlink_path(realpath, realtopath)) {
+		wi_log_error(WI_STR("Could not symlink \"%@\" to \"%@\": %m"), realpath, realtopath);
+		wd_user_reply_file_errno(user, message);
+		
+		return false;
+	}
+	
+	wd_files_invalidate_path(realtopath);
+	wd_index_add_file(realtopath);
+	
+	return true;
+}
+
+
+
+#pragma mark -
+
+#pragma mark -
+
+static void wd_files_fsevents_thread(wi_runtime_instance_t *instance) {
+	wi_pool_t		*pool;
+	
+	pool = wi_pool_init(wi_pool_alloc());
+	
+	while(true) {
+		if(!wi_fsevents_run_with_timeout(wd_files_fsevents, 0.0))
+			wi_log_error(WI_STR("Could not listen on fsevents: %m"));
+		
+		wi_pool_drain(pool);
+	}
+	
+	wi_release(pool);
+}
 
-	wi_mutable_string_delete_last_path_component(realfrompath);
-	wi_mutable_string_resolve_aliases_in_path(realfrompath);
-	wi_mutable_string_append_path_component(realfrompath, realfromname);
 
-	wi_mutable_string_delete_last_path_component(realtopath);
-	wi_mutable_string_resolve_aliases_in_path(realtopath);
-	wi_mutable_string_append_path_component(realtopath, realtoname);
+
+static void wd_files_fsevents_callback(wi_string_t *path) {
+	wi_pool_t			*pool;
 	
-	if(!wi_fs_lstat_path(realfrompath, &sb)) {
-		wi_log_error(WI_STR("Could not read info for \"%@\": %m"), realfrompath);
-		wd_user_reply_file_errno(user, message);
+	pool = wi_pool_init(wi_pool_alloc());
+	
+	wd_files_invalidate_metadata(path);
+	wd_files_invalidate_count(path);
+	wd_index_invalidate_directory(path);
+	
+	/* busy directories fire many events, subscribers hear about them once per interval */
+	wi_lock_lock(wd_files_changes_lock);
+	wi_mutable_set_add_data(wd_files_changed_paths, path);
+	wi_lock_unlock(wd_files_changes_lock);
+	
+	wi_release(pool);
+}
 
-		return false;
-	}
 
-	if(wi_string_case_insensitive_compare(realfrompath, realtopath) == 0) {
-		path = wi_fs_temporary_path_with_template(
-			wi_string_with_format(WI_STR("%@/.%@.XXXXXXXX"),
-				  wi_string_by_deleting_last_path_component(realfrompath),
-				  wi_string_last_path_component(realfromname)));
-		
-		if(path) {
-			result = wi_fs_rename_path(realfrompath, path);
-		
-			if(result)
-				result = wi_fs_rename_path(path, realtopath);
-		}
-	} else {
-		if(wi_fs_lstat_path(realtopath, &sb)) {
-			wd_user_reply_error(user, WI_STR("wired.error.file_exists"), message);
 
-			return false;
-		}
+static void wd_files_notify_changes(wi_timer_t *timer) {
+	wi_pool_t					*pool;
+	wi_enumerator_t				*enumerator, *pathenumerator;
+	wi_mutable_dictionary_t		*notified;
+	wi_mutable_set_t			*paths, *virtualpaths;
+	wi_array_t					*users;
+	wi_p7_message_t				*message;
+	wi_string_t					*path, *virtualpath;
+	wi_number_t					*key;
+	wd_user_t					*user;
+	wi_uinteger_t				i, count;
+	wi_boolean_t				exists, directory;
+	
+	wi_lock_lock(wd_files_changes_lock);
+	
+	if(wi_set_count(wd_files_changed_paths) == 0) {
+		wi_lock_unlock(wd_files_changes_lock);
 		
-		result = wi_fs_rename_path(realfrompath, realtopath);
+		return;
 	}
 	
-	if(result) {
-		wd_files_move_comment(frompath, topath, user, message);
-		wd_files_move_label(frompath, topath, user, message);
+	paths = wd_files_changed_paths;
+	wd_files_changed_paths = wi_set_init(wi_mutable_set_alloc());
+	
+	wi_lock_unlock(wd_files_changes_lock);
+	
+	pool = wi_pool_init(wi_pool_alloc());
+	
+	notified = wi_mutable_dictionary();
+	enumerator = wi_array_data_enumerator(wi_set_all_data(paths));
+	
+	while((path = wi_enumerator_next_data(enumerator))) {
+		users = wd_users_subscribers_for_path(path);
 		
-		wd_index_delete_file(realfrompath);
-		wd_index_add_file(realtopath);
-	} else {
-		if(wi_error_code() == EXDEV) {
-			array = wi_array_init_with_data(wi_array_alloc(),
-				frompath,
-				topath,
-				realfrompath,
-				realtopath,
-				(void *) NULL);
+		if(!users)
+			continue;
+		
+		exists = (wi_fs_path_exists(path, &directory) && directory);
+		count = wi_array_count(users);
+		
+		for(i = 0; i < count; i++) {
+			user = WI_ARRAY(users, i);
 			
-			result = wi_thread_create_thread(wd_files_move_thread, array);
+			if(wd_user_state(user) != WD_USER_LOGGED_IN)
+				continue;
 			
-			if(!result) {
-				wi_log_error(WI_STR("Could not create a copy thread: %m"));
-				wd_user_reply_internal_error(user, wi_error_string(), message);
+			key = wi_number_with_int32(wd_user_id(user));
+			virtualpaths = wi_dictionary_data_for_key(notified, key);
+			
+			if(!virtualpaths) {
+				virtualpaths = wi_autorelease(wi_set_init(wi_mutable_set_alloc()));
+				wi_mutable_dictionary_set_data_for_key(notified, virtualpaths, key);
 			}
 			
-			wi_release(array);
+			pathenumerator = wi_array_data_enumerator(wd_user_subscribed_virtual_paths_for_path(user, path));
+			
+			while((virtualpath = wi_enumerator_next_data(pathenumerator))) {
+				if(wi_set_contains_data(virtualpaths, virtualpath))
+					continue;
+				
+				wi_mutable_set_add_data(virtualpaths, virtualpath);
+				
+				if(exists)
+					message = wi_p7_message_with_name(WI_STR("wired.file.directory_changed"), wd_p7_spec);
+				else
+					message = wi_p7_message_with_name(WI_STR("wired.file.directory_deleted"), wd_p7_spec);
+				
+				wi_p7_message_set_string_for_name(message, virtualpath, WI_STR("wired.file.path"));
+				wd_user_send_message(user, message);
+			}
+			
+			if(!exists)
+				wd_user_unsubscribe_path(user, path);
+		}
+	}
+	
+	wi_release(paths);
+	wi_release(pool);
+}
+
+
+
+#pragma mark -
+
+static wi_dictionary_t * wd_files_metadata(wi_string_t *path, wi_fs_stat_t *sbp) {
+	wi_mutable_dictionary_t		*metadata;
+	wi_runtime_instance_t		*instance;
+	wi_string_t					*key, *signature;
+	wi_fs_stat_t				sb;
+	wi_uinteger_t				generation;
+	wi_boolean_t				recent;
+	
+	if(!sbp) {
+		if(!wi_fs_stat_path(path, &sb))
+			return NULL;
+		
+		sbp = &sb;
+	}
+	
+	if(!S_ISDIR(sbp->mode))
+		return NULL;
+	
+	signature = wd_files_metadata_signature(path, &recent);
+	
+	if(!signature)
+		return NULL;
+	
+	key = wi_string_with_format(WI_STR("%u:%llu"), sbp->dev, (unsigned long long) sbp->ino);
+	
+	wi_dictionary_rdlock(wd_files_metadata_cache);
+	
+	metadata = wi_dictionary_data_for_key(wd_files_metadata_cache, key);
+	
+	if(metadata && wi_is_equal(wi_dictionary_data_for_key(metadata, WI_STR("signature")), signature))
+		wi_autorelease(wi_retain(metadata));
+	else
+		metadata = NULL;
+	
+	wi_dictionary_unlock(wd_files_metadata_cache);
+	
+	if(metadata)
+		return metadata;
+	
+	generation	= wd_files_metadata_generation_for_key(key);
+	metadata	= wi_mutable_dictionary();
+	
+	wi_mutable_dictionary_set_data_for_key(metadata, signature, WI_STR("signature"));
+	wi_mutable_dictionary_set_data_for_key(metadata, WI_INT32(wd_files_read_type(path)), WI_STR("type"));
+	wi_mutable_dictionary_set_data_for_key(metadata, wd_files_read_drop_box_privileges(path), WI_STR("privileges"));
+	
+	instance = wd_files_read_dictionary(wi_string_by_appending_path_component(path, WI_STR(WD_FILES_META_LABELS_PATH)));
+	
+	if(instance)
+		wi_mutable_dictionary_set_data_for_key(metadata, instance, WI_STR("labels"));
+
+	instance = wd_files_read_dictionary(wi_string_by_appending_path_component(path, WI_STR(WD_FILES_META_COMMENTS_PATH)));
+	
+	if(instance)
+		wi_mutable_dictionary_set_data_for_key(metadata, instance, WI_STR("comments"));
+	
+	/* a change within the same second would not move the mtime, so don't trust it yet */
+	if(!recent)
+		wd_files_set_metadata_for_key(metadata, key, generation);
+	
+	return metadata;
+}
+
+
+
+/*
+	Invalidation bumps a generation for the directory before it drops the
+	cached entry. Readers note the generation before they read and only
+	store what they read if it is still the same, so a read that raced a
+	write is used once but never cached. Generations forgotten to bound the
+	table all read as the last value handed out before.
+*/
+
+static wi_uinteger_t wd_files_metadata_generation_for_key(wi_string_t *key) {
+	wi_number_t			*number;
+	wi_uinteger_t		generation;
+	
+	wi_dictionary_rdlock(wd_files_metadata_generations);
+	
+	number		= wi_dictionary_data_for_key(wd_files_metadata_generations, key);
+	generation	= number ? (wi_uinteger_t) wi_number_int64(number) : wd_files_metadata_generation_floor;
+	
+	wi_dictionary_unlock(wd_files_metadata_generations);
+	
+	return generation;
+}
+
+
+
+static void wd_files_set_metadata_for_key(wi_dictionary_t *metadata, wi_string_t *key, wi_uinteger_t generation) {
+	wi_dictionary_wrlock(wd_files_metadata_cache);
+	
+	if(wd_files_metadata_generation_for_key(key) == generation) {
+		if(wi_dictionary_count(wd_files_metadata_cache) >= WD_FILES_METADATA_CACHE_SIZE)
+			wi_mutable_dictionary_remove_all_data(wd_files_metadata_cache);
+		
+		wi_mutable_dictionary_set_data_for_key(wd_files_metadata_cache, metadata, key);
+	}
+	
+	wi_dictionary_unlock(wd_files_metadata_cache);
+}
+
+
+
+static wi_string_t * wd_files_metadata_signature(wi_string_t *path, wi_boolean_t *recent) {
+	static const char		*names[] = {
+		WD_FILES_META_TYPE_PATH,
+		WD_FILES_META_PERMISSIONS_PATH,
+		WD_FILES_META_LABELS_PATH,
+		WD_FILES_META_COMMENTS_PATH,
+		NULL
+	};
+	wi_mutable_string_t		*signature;
+	wi_fs_stat_t			sb;
+	time_t					now;
+	wi_uinteger_t			i;
+	
+	if(!wi_fs_stat_path(wi_string_by_appending_path_component(path, WI_STR(WD_FILES_META_PATH)), &sb))
+		return NULL;
+	
+	/* files rewritten in place don't move the mtime of .wired, so each of them is checked too */
+	signature	= wi_mutable_string();
+	now			= time(NULL);
+	
+	wi_mutable_string_append_format(signature, WI_STR("%lld"), (long long) sb.mtime);
+	
+	*recent		= (sb.mtime >= now - 1);
+	
+	for(i = 0; names[i]; i++) {
+		if(wi_fs_stat_path(wi_string_by_appending_path_component(path, wi_string_with_cstring(names[i])), &sb)) {
+			wi_mutable_string_append_format(signature, WI_STR(":%lld-%llu-%llu"),
+				(long long) sb.mtime, (unsigned long long) sb.size, (unsigned long long) sb.ino);
+			
+			if(sb.mtime >= now - 1)
+				*recent = true;
 		} else {
-			wi_log_error(WI_STR("Could not rename \"%@\" to \"%@\": %m"),
-				realfrompath, realtopath);
-			wd_user_reply_file_errno(user, message);
+			wi_mutable_string_append_string(signature, WI_STR(":-"));
 		}
 	}
 	
-	return result;
+	return signature;
+}
+
+
+
+static void wd_files_invalidate_metadata(wi_string_t *path) {
+	wi_string_t		*key;
+	wi_fs_stat_t	sb;
+	
+	wd_files_invalidate_listing(path);
+	
+	if(!wi_fs_stat_path(path, &sb))
+		return;
+	
+	key = wi_string_with_format(WI_STR("%u:%llu"), sb.dev, (unsigned long long) sb.ino);
+	
+	wi_dictionary_wrlock(wd_files_metadata_cache);
+	wi_dictionary_wrlock(wd_files_metadata_generations);
+	
+	if(wi_dictionary_count(wd_files_metadata_generations) >= WD_FILES_METADATA_GENERATIONS_SIZE) {
+		wi_mutable_dictionary_remove_all_data(wd_files_metadata_generations);
+		
+		wd_files_metadata_generation_floor = wd_files_metadata_generation;
+	}
+	
+	wi_mutable_dictionary_set_data_for_key(wd_files_metadata_generations,
+		wi_number_with_int64(++wd_files_metadata_generation), key);
+	
+	wi_dictionary_unlock(wd_files_metadata_generations);
+	
+	wi_mutable_dictionary_remove_data_for_key(wd_files_metadata_cache, key);
+	
+	wi_dictionary_unlock(wd_files_metadata_cache);
+}
+
+
+
+static wd_file_type_t wd_files_read_type(wi_string_t *realpath) {
+	wi_string_t		*typepath, *string;
+	wi_fs_stat_t	sb;
+	wd_file_type_t	type;
+	
+	typepath = wi_string_by_appending_path_component(realpath, WI_STR(WD_FILES_META_TYPE_PATH));
+	
+	if(!wi_fs_stat_path(typepath, &sb) || sb.size > 8)
+		return WD_FILE_TYPE_DIR;
+	
+	string = wi_autorelease(wi_string_init_with_contents_of_file(wi_string_alloc(), typepath));
+	
+	if(!string)
+		return WD_FILE_TYPE_DIR;
+	
+	type = wi_string_uint32(wi_string_by_deleting_surrounding_whitespace(string));
+	
+	if(type == WD_FILE_TYPE_FILE)
+		type = WD_FILE_TYPE_DIR;
+	
+	return type;
+}
+
+
+
+static wd_files_privileges_t * wd_files_read_drop_box_privileges(wi_string_t *path) {
+	wi_string_t				*permissionspath, *string;
+	wd_files_privileges_t	*privileges;
+	wi_fs_stat_t			sb;
+	
+	permissionspath = wi_string_by_appending_path_component(path, WI_STR(WD_FILES_META_PERMISSIONS_PATH));
+	
+	if(!wi_fs_stat_path(permissionspath, &sb))
+		return wd_files_privileges_default_drop_box_privileges();
+	
+	if(sb.size > 128) {
+		wi_log_error(WI_STR("Could not read \"%@\": Size is too large (%u"), permissionspath, sb.size);
+		
+		return wd_files_privileges_default_drop_box_privileges();
+	}
+	
+	string = wi_autorelease(wi_string_init_with_contents_of_file(wi_string_alloc(), permissionspath));
+	
+	if(!string) {
+		wi_log_error(WI_STR("Could not read \"%@\": %m"), permissionspath);
+		
+		return wd_files_privileges_default_drop_box_privileges();
+	}
+	
+	privileges = wd_files_privileges_with_string(string);
+	
+	if(!privileges) {
+		wi_log_error(WI_STR("Could not read \"%@\": Contents is malformed (\"%@\")"), permissionspath, string);
+		
+		return wd_files_privileges_default_drop_box_privileges();
+	}
+	
+	return privileges;
+}
+
+
+
+static wi_dictionary_t * wd_files_read_dictionary(wi_string_t *path) {
+	wi_runtime_instance_t	*instance;
+	
+	if(!wi_fs_path_exists(path, NULL))
+		return NULL;
+	
+	instance = wi_plist_read_instance_from_file(path);
+	
+	if(!instance || wi_runtime_id(instance) != wi_dictionary_runtime_id())
+		return NULL;
+	
+	return instance;
+}
+
+
+
+#pragma mark -
+
+static wi_string_t * wd_files_database_path(wi_string_t *path, wd_user_t *user) {
+	wi_string_t		*realdirpath;
+	
+	realdirpath = wi_string_by_resolving_aliases_in_path(wd_files_real_path(wi_string_by_deleting_last_path_component(path), user));
+	
+	return wi_string_by_appending_path_component(realdirpath, wi_string_last_path_component(path));
 }
 
 
 
-static void wd_files_move_thread(wi_runtime_instance_t *argument) {
-	wi_pool_t		*pool;
-	wi_array_t		*array = argument;
-	wi_string_t		*frompath, *topath, *realfrompath, *realtopath;
+static wi_runtime_instance_t * wd_files_database_value(wi_string_t *realpath, wi_string_t *column) {
+	wi_mutable_dictionary_t		*entries;
+	wi_sqlite3_statement_t		*statement;
+	wi_dictionary_t				*results, *entry;
+	wi_runtime_instance_t		*value;
+	wi_number_t					*inode;
+	wi_string_t					*dirpath, *key;
+	wi_fs_stat_t				sb;
+	wi_uinteger_t				generation;
 	
-	pool			= wi_pool_init(wi_pool_alloc());
-	frompath		= WI_ARRAY(array, 0);
-	topath			= WI_ARRAY(array, 1);
-	realfrompath	= WI_ARRAY(array, 2);
-	realtopath		= WI_ARRAY(array, 3);
+	dirpath = wi_string_by_deleting_last_path_component(realpath);
+	
+	if(!wi_fs_stat_path(dirpath, &sb))
+		return NULL;
+	
+	key = wi_string_with_format(WI_STR("%u:%llu"), sb.dev, (unsigned long long) sb.ino);
+	
+	wi_dictionary_rdlock(wd_files_metadata_cache);
+	
+	entries = wi_dictionary_data_for_key(wd_files_metadata_cache, key);
+	
+	if(entries)
+		wi_autorelease(wi_retain(entries));
 	
-	if(wi_fs_copy_path_with_callback(realfrompath, realtopath, wd_files_move_path_copy_callback)) {
-		wd_files_move_comment(frompath, topath, NULL, NULL);
-		wd_files_move_label(frompath, topath, NULL, NULL);
+	wi_dictionary_unlock(wd_files_metadata_cache);
+	
+	if(!entries) {
+		generation = wd_files_metadata_generation_for_key(key);
 		
-		if(!wi_fs_delete_path_with_callback(realfrompath, wd_files_move_path_delete_callback))
-			wi_log_error(WI_STR("Could not delete \"%@\": %m"), realfrompath);
-	} else {
-		wi_log_error(WI_STR("Could not copy \"%@\" to \"%@\": %m"), realfrompath, realtopath);
+		/* fetch the whole directory at once, so listing it costs a single query */
+		statement = wi_sqlite3_prepare_statement(wd_database, WI_STR("SELECT name, inode, type, permissions, label, comment "
+																	 "FROM files_metadata "
+																	 "WHERE directory = ?"),
+												 dirpath,
+												 NULL);
+		
+		if(!statement) {
+			wi_log_error(WI_STR("Could not execute database statement: %m"));
+			
+			return NULL;
+		}
+		
+		entries = wi_mutable_dictionary();
+		
+		while((results = wi_sqlite3_fetch_statement_results(wd_database, statement)) && wi_dictionary_count(results) > 0)
+			wi_mutable_dictionary_set_data_for_key(entries, results, wi_dictionary_data_for_key(results, WI_STR("name")));
+		
+		wd_files_set_metadata_for_key(entries, key, generation);
 	}
 	
-	wi_release(pool);
+	entry = wi_dictionary_data_for_key(entries, wi_string_last_path_component(realpath));
+	
+	if(!entry)
+		return NULL;
+	
+	/* metadata left behind by a file that was replaced outside of the server does not carry over */
+	inode = wi_dictionary_data_for_key(entry, WI_STR("inode"));
+	
+	if(inode && wi_number_int64(inode) != 0) {
+		if(!wi_fs_lstat_path(realpath, &sb) || (int64_t) sb.ino != wi_number_int64(inode))
+			return NULL;
+	}
+	
+	value = wi_dictionary_data_for_key(entry, column);
+	
+	return (value && value != wi_null()) ? value : NULL;
 }
 
 
 
-static void wd_files_move_path_copy_callback(wi_string_t *frompath, wi_string_t *topath) {
-	wd_index_add_file(topath);
+static wi_boolean_t wd_files_database_set_value(wi_string_t *realpath, wi_string_t *column, wi_runtime_instance_t *value) {
+	wi_string_t		*dirpath, *name;
+	wi_fs_stat_t	sb;
+	wi_boolean_t	result = true;
+	
+	dirpath		= wi_string_by_deleting_last_path_component(realpath);
+	name		= wi_string_last_path_component(realpath);
+	
+	if(!wi_fs_lstat_path(realpath, &sb))
+		sb.ino = 0;
+	
+	if(!wi_sqlite3_execute_statement(wd_database, WI_STR("INSERT OR IGNORE INTO files_metadata "
+														 "(directory, name, inode) "
+														 "VALUES "
+														 "(?, ?, ?)"),
+									 dirpath,
+									 name,
+									 wi_number_with_int64(sb.ino),
+									 NULL)) {
+		result = false;
+	}
+	
+	/* column is one of our own names, never user input */
+	if(result && !wi_sqlite3_execute_statement(wd_database, wi_string_with_format(WI_STR("UPDATE files_metadata "
+																						 "SET %@ = ?, inode = ? "
+																						 "WHERE directory = ? AND name = ?"), column),
+											   value ? value : wi_null(),
+											   wi_number_with_int64(sb.ino),
+											   dirpath,
+											   name,
+											   NULL)) {
+		result = false;
+	}
+	
+	if(result && !value) {
+		if(!wi_sqlite3_execute_statement(wd_database, WI_STR("DELETE FROM files_metadata "
+															 "WHERE directory = ? AND name = ? AND "
+															 "type IS NULL AND permissions IS NULL AND label IS NULL AND comment IS NULL"),
+										 dirpath,
+										 name,
+										 NULL)) {
+			result = false;
+		}
+	}
+	
+	if(!result)
+		wi_log_error(WI_STR("Could not execute database statement: %m"));
+	
+	wd_files_invalidate_metadata(dirpath);
+	
+	return result;
 }
 
 
 
-static void wd_files_move_path_delete_callback(wi_string_t *path) {
-	wd_index_delete_file(path);
+static wi_boolean_t wd_files_database_reply_set_value(wi_string_t *realpath, wi_string_t *column, wi_runtime_instance_t *value, wd_user_t *user, wi_p7_message_t *message) {
+	if(!wd_files_database_set_value(realpath, column, value)) {
+		if(user)
+			wd_user_reply_internal_error(user, wi_error_string(), message);
+		
+		return false;
+	}
+	
+	return true;
 }
 
 
 
-wi_boolean_t wd_files_link_path(wi_string_t *frompath, wi_string_t *topath, wd_user_t *user, wi_p7_message_t *message) {
-	wi_mutable_string_t		*realfrompath, *realtopath;
-	wi_string_t				*realfromname, *realpath;
-	wi_fs_stat_t			sb;
+static void wd_files_move_metadata(wi_string_t *frompath, wi_string_t *topath) {
+	wi_fs_stat_t	sb;
+	wi_boolean_t	copied;
+	
+	/* a copy across volumes still has its original, and new inodes throughout */
+	copied = wi_fs_lstat_path(frompath, &sb);
+	
+	if(!wi_fs_lstat_path(topath, &sb))
+		sb.ino = 0;
+	
+	wd_files_delete_metadata(topath);
+	
+	if(!wi_sqlite3_execute_statement(wd_database, WI_STR("UPDATE files_metadata "
+														 "SET directory = ?, name = ?, inode = ? "
+														 "WHERE directory = ? AND name = ?"),
+									 wi_string_by_deleting_last_path_component(topath),
+									 wi_string_last_path_component(topath),
+									 wi_number_with_int64(sb.ino),
+									 wi_string_by_deleting_last_path_component(frompath),
+									 wi_string_last_path_component(frompath),
+									 NULL)) {
+		wi_log_error(WI_STR("Could not execute database statement: %m"));
+	}
 	
-	realfrompath	= wi_autorelease(wi_mutable_copy(wd_files_real_path(frompath, user)));
-	realtopath		= wi_autorelease(wi_mutable_copy(wd_files_real_path(topath, user)));
-	realfromname	= wi_string_last_path_component(realfrompath);
-
-	wi_mutable_string_delete_last_path_component(realfrompath);
-	wi_mutable_string_resolve_aliases_in_path(realfrompath);
-	wi_mutable_string_resolve_aliases_in_path(realtopath);
-	wi_mutable_string_append_path_component(realfrompath, realfromname);
+	if(!wi_sqlite3_execute_statement(wd_database, WI_STR("UPDATE files_metadata "
+														 "SET directory = ? || substr(directory, length(?) + 1) "
+														 "WHERE directory = ? OR (directory > ? AND directory < ?)"),
+									 topath,
+									 frompath,
+									 frompath,
+									 wi_string_by_appending_string(frompath, WI_STR("/")),
+									 wi_string_by_appending_string(frompath, WI_STR("0")),
+									 NULL)) {
+		wi_log_error(WI_STR("Could not execute database statement: %m"));
+	}
 	
-	if(!wi_fs_lstat_path(realfrompath, &sb)) {
-		wi_log_error(WI_STR("Could not read info for \"%@\": %m"), realfrompath);
-		wd_user_reply_file_errno(user, message);
-
-		return false;
+	if(copied) {
+		if(!wi_sqlite3_execute_statement(wd_database, WI_STR("UPDATE files_metadata SET inode = 0 "
+															 "WHERE directory = ? OR (directory > ? AND directory < ?)"),
+										 topath,
+										 wi_string_by_appending_string(topath, WI_STR("/")),
+										 wi_string_by_appending_string(topath, WI_STR("0")),
+										 NULL)) {
+			wi_log_error(WI_STR("Could not execute database statement: %m"));
+		}
 	}
+	
+	wd_files_invalidate_metadata(wi_string_by_deleting_last_path_component(frompath));
+	wd_files_invalidate_metadata(wi_string_by_deleting_last_path_component(topath));
+}
 
-	if(wi_fs_lstat_path(realtopath, &sb)) {
-		wd_user_reply_error(user, WI_STR("wired.error.file_exists"), message);
 
-		return false;
+
+static void wd_files_delete_metadata(wi_string_t *path) {
+	if(!wi_sqlite3_execute_statement(wd_database, WI_STR("DELETE FROM files_metadata "
+														 "WHERE (directory = ? AND name = ?) OR directory = ? OR (directory > ? AND directory < ?)"),
+									 wi_string_by_deleting_last_path_component(path),
+									 wi_string_last_path_component(path),
+									 path,
+									 wi_string_by_appending_string(path, WI_STR("/")),
+									 wi_string_by_appending_string(path, WI_STR("0")),
+									 NULL)) {
+		wi_log_error(WI_STR("Could not execute database statement: %m"));
 	}
 	
-	realpath = wi_fs_real_path_for_path(realfrompath);
-	
-	if(!realpath) {
-		wi_log_error(WI_STR("Could not get real path for \"%@\": %m"), realfrompath);
-		wd_user_reply_file_errno(user, message);
+	wd_files_invalidate_metadata(wi_string_by_deleting_last_path_component(path));
+}
 
-		return false;
-	}
+
+
+wi_boolean_t wd_files_import_metadata(void) {
+	wi_pool_t					*pool;
+	wi_fsenumerator_t			*fsenumerator;
+	wi_string_t					*rootpath, *path;
+	wi_fs_stat_t				sb;
+	wi_fsenumerator_status_t	status;
+	wi_uinteger_t				i = 0, count = 0;
 	
-	if(!wi_fs_symlink_path(realpath, realtopath)) {
-		wi_log_error(WI_STR("Could not symlink \"%@\" to \"%@\": %m"), realpath, realtopath);
-		wd_user_reply_file_errno(user, message);
+	rootpath		= wi_string_by_resolving_aliases_in_path(wd_files);
+	fsenumerator	= wi_fs_enumerator_at_path(rootpath);
+	
+	if(!fsenumerator) {
+		wi_log_error(WI_STR("Could not open \"%@\": %m"), rootpath);
 		
 		return false;
 	}
 	
-	wd_index_add_file(realtopath);
+	pool = wi_pool_init(wi_pool_alloc());
 	
-	return true;
-}
-
-
-
-#pragma mark -
-
-#pragma mark -
-
-static void wd_files_fsevents_thread(wi_runtime_instance_t *instance) {
-	wi_pool_t		*pool;
+	wi_sqlite3_begin_immediate_transaction(wd_database);
 	
-	pool = wi_pool_init(wi_pool_alloc());
+	wd_files_import_metadata_in_directory(rootpath, true, &count);
 	
-	while(true) {
-		if(!wi_fsevents_run_with_timeout(wd_files_fsevents, 0.0))
-			wi_log_error(WI_STR("Could not listen on fsevents: %m"));
+	while((status = wi_fsenumerator_get_next_path(fsenumerator, &path)) != WI_FSENUMERATOR_EOF) {
+		if(status == WI_FSENUMERATOR_ERROR) {
+			wi_log_error(WI_STR("Could not list \"%@\": %m"), path);
+			
+			continue;
+		}
 		
-		wi_pool_drain(pool);
+		if(wi_is_equal(wi_string_last_path_component(path), WI_STR(WD_FILES_META_PATH))) {
+			wi_fsenumerator_skip_descendents(fsenumerator);
+			
+			continue;
+		}
+		
+		if(wi_fs_lstat_path(path, &sb) && S_ISDIR(sb.mode))
+			wd_files_import_metadata_in_directory(path, false, &count);
+		
+		if(++i % 100 == 0)
+			wi_pool_drain(pool);
 	}
 	
+	wi_sqlite3_commit_transaction(wd_database);
+	
+	wi_log_info(WI_STR("Imported metadata for %u %@ from \"%@\""),
+		count, count == 1 ? WI_STR("entry") : WI_STR("entries"), rootpath);
+	
 	wi_release(pool);
+	
+	return true;
 }
 
 
 
-static void wd_files_fsevents_callback(wi_string_t *path) {
-	wi_pool_t			*pool;
-	wi_enumerator_t		*enumerator, *pathenumerator;
-	wi_p7_message_t		*message;
-	wi_string_t			*virtualpath;
-	wd_user_t			*user;
-	wi_boolean_t		exists, directory;
+static void wd_files_import_metadata_in_directory(wi_string_t *path, wi_boolean_t root, wi_uinteger_t *count) {
+	wi_enumerator_t		*enumerator;
+	wi_dictionary_t		*instance;
+	wi_file_t			*file;
+	wi_array_t			*array;
+	wi_string_t			*string, *name;
+	wd_file_type_t		type;
 	
-	pool = wi_pool_init(wi_pool_alloc());
+	if(!wi_fs_path_exists(wi_string_by_appending_path_component(path, WI_STR(WD_FILES_META_PATH)), NULL))
+		return;
 	
-	wi_retain(path);
+	if(!root) {
+		type = wd_files_read_type(path);
+		
+		if(type != WD_FILE_TYPE_DIR && wd_files_database_set_value(path, WI_STR("type"), WI_INT32(type)))
+			(*count)++;
+		
+		string = wi_autorelease(wi_string_init_with_contents_of_file(wi_string_alloc(),
+			wi_string_by_appending_path_component(path, WI_STR(WD_FILES_META_PERMISSIONS_PATH))));
+		
+		if(string && wd_files_database_set_value(path, WI_STR("permissions"), wi_string_by_deleting_surrounding_whitespace(string)))
+			(*count)++;
+	}
 	
-	exists = (wi_fs_path_exists(path, &directory) && directory);
+	instance = wd_files_read_dictionary(wi_string_by_appending_path_component(path, WI_STR(WD_FILES_META_LABELS_PATH)));
 	
-	wi_dictionary_rdlock(wd_users);
-
-	enumerator = wi_dictionary_data_enumerator(wd_users);
+	if(instance) {
+		enumerator = wi_dictionary_key_enumerator(instance);
+		
+		while((name = wi_enumerator_next_data(enumerator))) {
+			if(wd_files_database_set_value(wi_string_by_appending_path_component(path, name), WI_STR("label"), wi_dictionary_data_for_key(instance, name)))
+				(*count)++;
+		}
+	}
 	
-	while((user = wi_enumerator_next_data(enumerator))) {
-		if(wd_user_state(user) == WD_USER_LOGGED_IN && wi_set_contains_data(wd_user_subscribed_paths(user), path)) {
-			pathenumerator = wi_array_data_enumerator(wd_user_subscribed_virtual_paths_for_path(user, path));
-			
-			while((virtualpath = wi_enumerator_next_data(pathenumerator))) {
-				if(exists)
-					message = wi_p7_message_with_name(WI_STR("wired.file.directory_changed"), wd_p7_spec);
-				else
-					message = wi_p7_message_with_name(WI_STR("wired.file.directory_deleted"), wd_p7_spec);
-				
-				wi_p7_message_set_string_for_name(message, virtualpath, WI_STR("wired.file.path"));
-				wd_user_send_message(user, message);
-			}
+	string		= wi_string_by_appending_path_component(path, WI_STR(WD_FILES_META_COMMENTS_PATH));
+	instance	= wd_files_read_dictionary(string);
+	
+	if(instance) {
+		enumerator = wi_dictionary_key_enumerator(instance);
+		
+		while((name = wi_enumerator_next_data(enumerator))) {
+			if(wd_files_database_set_value(wi_string_by_appending_path_component(path, name), WI_STR("comment"), wi_dictionary_data_for_key(instance, name)))
+				(*count)++;
+		}
+	} else {
+		file = wi_file_for_reading(string);
+		
+		while(file && (string = wi_file_read_to_string(file, WI_STR(WD_FILES_OLDSTYLE_COMMENT_SEPARATOR)))) {
+			array = wi_string_components_separated_by_string(string, WI_STR(WD_FILES_OLDSTYLE_COMMENT_FIELD_SEPARATOR));
 			
-			if(!exists)
-				wd_user_unsubscribe_path(user, path);
+			if(wi_array_count(array) == 2 && wd_files_database_set_value(wi_string_by_appending_path_component(path, WI_ARRAY(array, 0)), WI_STR("comment"), WI_ARRAY(array, 1)))
+				(*count)++;
 		}
 	}
-
-	wi_dictionary_unlock(wd_users);
-	
-	wi_release(path);
-	wi_release(pool);
 }
 
 
@@ -877,6 +2967,11 @@ static void wd_files_fsevents_callback(wi_string_t *path) {
 wi_boolean_t wd_files_set_type(wi_string_t *path, wd_file_type_t type, wd_user_t *user, wi_p7_message_t *message) {
 	wi_string_t		*realpath, *metapath, *typepath;
 	
+	if(wd_files_metadata_database) {
+		return wd_files_database_reply_set_value(wd_files_database_path(path, user), WI_STR("type"),
+			type != WD_FILE_TYPE_DIR ? WI_INT32(type) : NULL, user, message);
+	}
+	
 	realpath = wi_string_by_resolving_aliases_in_path(wd_files_real_path(path, user));
 	metapath = wi_string_by_appending_path_component(realpath, WI_STR(WD_FILES_META_PATH));
 	typepath = wi_string_by_appending_path_component(realpath, WI_STR(WD_FILES_META_TYPE_PATH));
@@ -906,6 +3001,8 @@ wi_boolean_t wd_files_set_type(wi_string_t *path, wd_file_type_t type, wd_user_t
 		}
 	}
 	
+	wd_files_invalidate_metadata(realpath);
+	
 	return true;
 }
 
@@ -923,29 +3020,24 @@ wd_file_type_t wd_files_type(wi_string_t *path) {
 
 
 wd_file_type_t wd_files_type_with_stat(wi_string_t *realpath, wi_fs_stat_t *sbp) {
-	wi_string_t		*typepath, *string;
-	wi_fs_stat_t	sb;
-	wd_file_type_t	type;
+	wi_dictionary_t		*metadata;
+	wi_number_t			*type;
 	
 	if(!S_ISDIR(sbp->mode))
 		return WD_FILE_TYPE_FILE;
 	
-	typepath = wi_string_by_appending_path_component(realpath, WI_STR(WD_FILES_META_TYPE_PATH));
-	
-	if(!wi_fs_stat_path(typepath, &sb) || sb.size > 8)
-		return WD_FILE_TYPE_DIR;
+	if(wd_files_metadata_database) {
+		type = wd_files_database_value(realpath, WI_STR("type"));
+		
+		return (type && wi_number_int32(type) != WD_FILE_TYPE_FILE) ? wi_number_int32(type) : WD_FILE_TYPE_DIR;
+	}
 	
-	string = wi_autorelease(wi_string_init_with_contents_of_file(wi_string_alloc(), typepath));
+	metadata = wd_files_metadata(realpath, sbp);
 	
-	if(!string)
+	if(!metadata)
 		return WD_FILE_TYPE_DIR;
 	
-	type = wi_string_uint32(wi_string_by_deleting_surrounding_whitespace(string));
-	
-	if(type == WD_FILE_TYPE_FILE)
-		type = WD_FILE_TYPE_DIR;
-	
-	return type;
+	return wi_number_int32(wi_dictionary_data_for_key(metadata, WI_STR("type")));
 }
 
 
@@ -957,6 +3049,13 @@ wi_boolean_t wd_files_set_executable(wi_string_t *path, wi_boolean_t executable,
 	
 	realpath = wi_string_by_resolving_aliases_in_path(wd_files_real_path(path, user));
 	
+	if(!wd_files_unshare_path(realpath)) {
+		wi_log_error(WI_STR("Could not copy \"%@\" before setting its mode: %m"), realpath);
+		wd_user_reply_file_errno(user, message);
+		
+		return false;
+	}
+	
 	if(!wi_fs_set_mode_for_path(realpath, executable ? 0755 : 0644)) {
 		wi_log_error(WI_STR("Could not set mode for \"%@\": %m"), realpath);
 		wd_user_reply_file_errno(user, message);
@@ -973,19 +3072,30 @@ wi_boolean_t wd_files_set_executable(wi_string_t *path, wi_boolean_t executable,
 
 static wi_string_t * wd_files_comment(wi_string_t *path) {
 #ifdef HAVE_CORESERVICES_CORESERVICES_H
+	if(wd_files_metadata_database)
+		return wd_files_database_value(path, WI_STR("comment"));
+	
 	return wi_fs_finder_comment_for_path(path);
 #else
-	wi_runtime_instance_t	*instance;
+	wi_dictionary_t			*metadata, *instance;
 	wi_file_t				*file;
 	wi_array_t				*array;
 	wi_string_t				*name, *dirpath, *commentspath, *string;
 
+	if(wd_files_metadata_database)
+		return wd_files_database_value(path, WI_STR("comment"));
+	
 	name			= wi_string_last_path_component(path);
 	dirpath			= wi_string_by_deleting_last_path_component(path);
 	commentspath	= wi_string_by_appending_path_component(dirpath, WI_STR(WD_FILES_META_COMMENTS_PATH));
-	instance		= wi_plist_read_instance_from_file(commentspath);
+	metadata		= wd_files_metadata(dirpath, NULL);
+	
+	if(!metadata)
+		return NULL;
+	
+	instance		= wi_dictionary_data_for_key(metadata, WI_STR("comments"));
 	
-	if(!instance || wi_runtime_id(instance) != wi_dictionary_runtime_id()) {
+	if(!instance) {
 		file = wi_file_for_reading(commentspath);
 		
 		if(!file)
@@ -1012,6 +3122,9 @@ wi_boolean_t wd_files_set_comment(wi_string_t *path, wi_string_t *comment, wd_us
 #endif
 	wi_string_t				*name, *dirpath, *realdirpath, *metapath, *commentspath;
 	
+	if(wd_files_metadata_database)
+		return wd_files_database_reply_set_value(wd_files_database_path(path, user), WI_STR("comment"), comment, user, message);
+	
 	name			= wi_string_last_path_component(path);
 	dirpath			= wi_string_by_deleting_last_path_component(path);
 	realdirpath		= wi_string_by_resolving_aliases_in_path(wd_files_real_path(dirpath, user));
@@ -1045,6 +3158,8 @@ wi_boolean_t wd_files_set_comment(wi_string_t *path, wi_string_t *comment, wd_us
 		return false;
 	}
 
+	wd_files_invalidate_metadata(realdirpath);
+	
 #ifdef HAVE_CORESERVICES_CORESERVICES_H
 	realpath = wi_string_by_resolving_aliases_in_path(wd_files_real_path(path, user));
 
@@ -1084,6 +3199,9 @@ wi_boolean_t wd_files_remove_comment(wi_string_t *path, wd_user_t *user, wi_p7_m
 #endif
 	wi_string_t				*name, *dirpath, *realdirpath, *metapath, *commentspath;
 	
+	if(wd_files_metadata_database)
+		return wd_files_database_reply_set_value(wd_files_database_path(path, user), WI_STR("comment"), NULL, user, message);
+	
 	name			= wi_string_last_path_component(path);
 	dirpath			= wi_string_by_deleting_last_path_component(path);
 	realdirpath		= wi_string_by_resolving_aliases_in_path(wd_files_real_path(dirpath, user));
@@ -1116,6 +3234,8 @@ wi_boolean_t wd_files_remove_comment(wi_string_t *path, wd_user_t *user, wi_p7_m
 		}
 	}
 	
+	wd_files_invalidate_metadata(realdirpath);
+	
 #ifdef HAVE_CORESERVICES_CORESERVICES_H
 	realpath = wi_string_by_resolving_aliases_in_path(wd_files_real_path(path, user));
 
@@ -1143,6 +3263,9 @@ wi_boolean_t wd_files_set_label(wi_string_t *path, wd_file_label_t label, wd_use
 #endif
 	wi_string_t				*name, *dirpath, *realdirpath, *metapath, *labelspath;
 	
+	if(wd_files_metadata_database)
+		return wd_files_database_reply_set_value(wd_files_database_path(path, user), WI_STR("label"), WI_INT32(label), user, message);
+	
 	name			= wi_string_last_path_component(path);
 	dirpath			= wi_string_by_deleting_last_path_component(path);
 	realdirpath		= wi_string_by_resolving_aliases_in_path(wd_files_real_path(dirpath, user));
@@ -1176,6 +3299,8 @@ wi_boolean_t wd_files_set_label(wi_string_t *path, wd_file_label_t label, wd_use
 		return false;
 	}
 	
+	wd_files_invalidate_metadata(realdirpath);
+	
 #ifdef HAVE_CORESERVICES_CORESERVICES_H
 	realpath = wi_string_by_resolving_aliases_in_path(wd_files_real_path(path, user));
 
@@ -1195,17 +3320,25 @@ wi_boolean_t wd_files_set_label(wi_string_t *path, wd_file_label_t label, wd_use
 
 
 wd_file_label_t wd_files_label(wi_string_t *path) {
+	wi_number_t				*label;
+#ifndef HAVE_CORESERVICES_CORESERVICES_H
+	wi_dictionary_t			*metadata, *instance;
+	wi_string_t				*name, *dirpath;
+#endif
+	
+	if(wd_files_metadata_database) {
+		label = wd_files_database_value(path, WI_STR("label"));
+		
+		return label ? wi_number_int32(label) : WD_FILE_LABEL_NONE;
+	}
+	
 #ifdef HAVE_CORESERVICES_CORESERVICES_H
 	return (wd_file_label_t)wi_fs_finder_label_for_path(path);
 #else
-	wi_runtime_instance_t	*instance;
-	wi_number_t				*label;
-	wi_string_t				*name, *dirpath, *labelspath;
-
 	name			= wi_string_last_path_component(path);
 	dirpath			= wi_string_by_deleting_last_path_component(path);
-	labelspath		= wi_string_by_appending_path_component(dirpath, WI_STR(WD_FILES_META_LABELS_PATH));
-	instance		= wi_plist_read_instance_from_file(labelspath);
+	metadata		= wd_files_metadata(dirpath, NULL);
+	instance		= metadata ? wi_dictionary_data_for_key(metadata, WI_STR("labels")) : NULL;
 	label			= instance ? wi_dictionary_data_for_key(instance, name) : NULL;
 	
 	return label ? wi_number_int32(label) : WD_FILE_LABEL_NONE;
@@ -1221,6 +3354,9 @@ wi_boolean_t wd_files_remove_label(wi_string_t *path, wd_user_t *user, wi_p7_mes
 #endif
 	wi_string_t				*name, *dirpath, *realdirpath, *metapath, *labelspath;
 	
+	if(wd_files_metadata_database)
+		return wd_files_database_reply_set_value(wd_files_database_path(path, user), WI_STR("label"), NULL, user, message);
+	
 	name			= wi_string_last_path_component(path);
 	dirpath			= wi_string_by_deleting_last_path_component(path);
 	realdirpath		= wi_string_by_resolving_aliases_in_path(wd_files_real_path(dirpath, user));
@@ -1253,6 +3389,8 @@ wi_boolean_t wd_files_remove_label(wi_string_t *path, wd_user_t *user, wi_p7_mes
 		}
 	}
 	
+	wd_files_invalidate_metadata(realdirpath);
+	
 #ifdef HAVE_CORESERVICES_CORESERVICES_H
 	realpath = wi_string_by_resolving_aliases_in_path(wd_files_real_path(path, user));
 
@@ -1296,6 +3434,11 @@ wi_boolean_t wd_files_set_privileges(wi_string_t *path, wd_files_privileges_t *p
 	metapath			= wi_string_by_appending_path_component(realpath, WI_STR(WD_FILES_META_PATH));
 	permissionspath		= wi_string_by_appending_path_component(realpath, WI_STR(WD_FILES_META_PERMISSIONS_PATH));
 	
+	if(wd_files_metadata_database) {
+		return wd_files_database_reply_set_value(wd_files_database_path(path, user), WI_STR("permissions"),
+			wd_files_privileges_string(privileges), user, message);
+	}
+	
 	if(!wi_fs_create_directory(metapath, 0777)) {
 		if(wi_error_code() != EEXIST) {
 			wi_log_error(WI_STR("Could not create \"%@\": %m"), metapath);
@@ -1314,6 +3457,8 @@ wi_boolean_t wd_files_set_privileges(wi_string_t *path, wd_files_privileges_t *p
 		return false;
 	}
 	
+	wd_files_invalidate_metadata(realpath);
+	
 	return true;
 }
 
@@ -1333,38 +3478,23 @@ wd_files_privileges_t * wd_files_privileges(wi_string_t *path, wd_user_t *user)
 
 
 wd_files_privileges_t * wd_files_drop_box_privileges(wi_string_t *path) {
-	wi_string_t				*permissionspath, *string;
+	wi_dictionary_t			*metadata;
+	wi_string_t				*string;
 	wd_files_privileges_t	*privileges;
-	wi_fs_stat_t			sb;
-	
-	permissionspath = wi_string_by_appending_path_component(path, WI_STR(WD_FILES_META_PERMISSIONS_PATH));
-	
-	if(!wi_fs_stat_path(permissionspath, &sb))
-		return wd_files_privileges_default_drop_box_privileges();
-	
-	if(sb.size > 128) {
-		wi_log_error(WI_STR("Could not read \"%@\": Size is too large (%u"), permissionspath, sb.size);
-		
-		return wd_files_privileges_default_drop_box_privileges();
-	}
-	
-	string = wi_autorelease(wi_string_init_with_contents_of_file(wi_string_alloc(), permissionspath));
 	
-	if(!string) {
-		wi_log_error(WI_STR("Could not read \"%@\": %m"), permissionspath);
+	if(wd_files_metadata_database) {
+		string		= wd_files_database_value(path, WI_STR("permissions"));
+		privileges	= string ? wd_files_privileges_with_string(string) : NULL;
 		
-		return wd_files_privileges_default_drop_box_privileges();
+		return privileges ? privileges : wd_files_privileges_default_drop_box_privileges();
 	}
 	
-	privileges = wd_files_privileges_with_string(string);
+	metadata = wd_files_metadata(path, NULL);
 	
-	if(!privileges) {
-		wi_log_error(WI_STR("Could not read \"%@\": Contents is malformed (\"%@\")"), permissionspath, string);
-		
+	if(!metadata)
 		return wd_files_privileges_default_drop_box_privileges();
-	}
 	
-	return privileges;
+	return wi_dictionary_data_for_key(metadata, WI_STR("privileges"));
 }
 
 
@@ -1521,6 +3651,40 @@ wi_string_t * wd_files_string_for_bytes(wi_file_offset_t bytes) {
 
 
 
+#pragma mark -
+
+static wd_files_list_t * wd_files_list_alloc(void) {
+	return wi_runtime_create_instance(wd_files_list_runtime_id, sizeof(wd_files_list_t));
+}
+
+
+
+static wd_files_list_t * wd_files_list_init(wd_files_list_t *list) {
+	list->batchlock		= wi_lock_init(wi_lock_alloc());
+	list->lock			= wi_condition_lock_init_with_condition(wi_condition_lock_alloc(), 0);
+	list->subtrees		= wi_array_init(wi_mutable_array_alloc());
+	
+	return list;
+}
+
+
+
+static void wd_files_list_dealloc(wi_runtime_instance_t *instance) {
+	wd_files_list_t		*list = instance;
+	
+	wi_release(list->user);
+	wi_release(list->message);
+	wi_release(list->account);
+	wi_release(list->path);
+	wi_release(list->cursor);
+	wi_release(list->batchlock);
+	wi_release(list->lock);
+	wi_release(list->subtrees);
+	wi_release(list->entries);
+}
+
+
+
 #pragma mark -
 
 static wd_files_privileges_t * wd_files_privileges_alloc(void) {
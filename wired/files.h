@@ -81,6 +81,10 @@ wi_boolean_t							wd_files_create_path(wi_string_t *, wd_file_type_t, wd_user_t
 wi_boolean_t							wd_files_delete_path(wi_string_t *, wd_user_t *, wi_p7_message_t *);
 wi_boolean_t							wd_files_move_path(wi_string_t *, wi_string_t *, wd_user_t *, wi_p7_message_t *);
 wi_boolean_t							wd_files_link_path(wi_string_t *, wi_string_t *, wd_user_t *, wi_p7_message_t *);
+wi_boolean_t							wd_files_unshare_path(wi_string_t *);
+void									wd_files_invalidate_path(wi_string_t *);
+
+wi_boolean_t							wd_files_import_metadata(void);
 
 wi_boolean_t							wd_files_set_type(wi_string_t *, wd_file_type_t, wd_user_t *, wi_p7_message_t *);
 wd_file_type_t							wd_files_type(wi_string_t *);
@@ -0,0 +1,489 @@
+/* $Id$ */
+
+/*
+ *  Copyright (c) 2003-2009 Axel Andersson
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <wired/wired.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#endif
+
+#include "fswalker.h"
+
+#if defined(__linux__) && defined(SYS_getdents64)
+#define WD_FSWALKER_GETDENTS64			1
+#endif
+
+#if defined(__linux__) && defined(STATX_BTIME)
+#define WD_FSWALKER_STATX				1
+#endif
+
+#ifndef O_CLOEXEC
+#define O_CLOEXEC						0
+#endif
+
+#define WD_FSWALKER_BUFFER_SIZE			(32 * 1024)
+#define WD_FSWALKER_MAX_DEPTH			256
+
+
+#ifdef WD_FSWALKER_GETDENTS64
+struct _wd_fswalker_dirent64 {
+	uint64_t							d_ino;
+	int64_t								d_off;
+	unsigned short						d_reclen;
+	unsigned char						d_type;
+	char								d_name[];
+};
+#endif
+
+struct _wd_fswalker_frame {
+	int									fd;
+	wi_uinteger_t						pathlength;
+	
+#ifdef WD_FSWALKER_GETDENTS64
+	char								*buffer;
+	long								position;
+	long								length;
+#else
+	DIR									*dir;
+#endif
+};
+typedef struct _wd_fswalker_frame		wd_fswalker_frame_t;
+
+struct _wd_fswalker {
+	wd_fswalker_frame_t					*frames;
+	wi_uinteger_t						depth;
+	wi_uinteger_t						capacity;
+	
+	char								*path;
+	wi_uinteger_t						pathcapacity;
+	wi_uinteger_t						rootlength;
+	
+	wd_fswalker_entry_t					entry;
+	wi_boolean_t						descend;
+};
+
+
+static wi_boolean_t						wd_fswalker_push(wd_fswalker_t *, int);
+static void								wd_fswalker_pop(wd_fswalker_t *);
+static wi_boolean_t						wd_fswalker_read(wd_fswalker_t *, wd_fswalker_frame_t *, const char **, unsigned char *, int *);
+static void								wd_fswalker_reserve_path(wd_fswalker_t *, wi_uinteger_t);
+static int								wd_fswalker_statat(int, const char *, wi_boolean_t, wi_fs_stat_t *);
+
+
+
+/*
+	wd_fswalker_t walks a directory tree through open directory descriptors,
+	reading entries in bulk and stat'ing them relative to their parent, so
+	no absolute path is resolved by the kernel for each entry. All path
+	storage lives in one buffer that is reused for the whole walk; callers
+	only create strings for the entries they actually keep.
+*/
+
+wd_fswalker_t * wd_fswalker_open(wi_string_t *path) {
+	wd_fswalker_t		*walker;
+	const char			*cpath;
+	wi_uinteger_t		length;
+	int					fd;
+	
+	cpath	= wi_string_cstring(path);
+	fd		= open(cpath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	
+	if(fd < 0) {
+		wi_error_set_errno(errno);
+		
+		return NULL;
+	}
+	
+	walker = wi_malloc(sizeof(wd_fswalker_t));
+	memset(walker, 0, sizeof(wd_fswalker_t));
+	
+	length = strlen(cpath);
+	
+	while(length > 0 && cpath[length - 1] == '/')
+		length--;
+	
+	wd_fswalker_reserve_path(walker, length + WI_PATH_SIZE);
+	
+	memcpy(walker->path, cpath, length);
+	walker->path[length] = '\0';
+	walker->rootlength = length;
+	
+	if(!wd_fswalker_push(walker, fd)) {
+		wd_fswalker_close(walker);
+		
+		return NULL;
+	}
+	
+	walker->frames[0].pathlength = length;
+	
+	return walker;
+}
+
+
+
+void wd_fswalker_close(wd_fswalker_t *walker) {
+	wi_uinteger_t		i;
+	
+	while(walker->depth > 0)
+		wd_fswalker_pop(walker);
+	
+#ifdef WD_FSWALKER_GETDENTS64
+	for(i = 0; i < walker->capacity; i++) {
+		if(walker->frames[i].buffer)
+			wi_free(walker->frames[i].buffer);
+	}
+#else
+	(void) i;
+#endif
+	
+	if(walker->frames)
+		wi_free(walker->frames);
+	
+	if(walker->path)
+		wi_free(walker->path);
+	
+	wi_free(walker);
+}
+
+
+
+#pragma mark -
+
+wd_fswalker_status_t wd_fswalker_next(wd_fswalker_t *walker, wd_fswalker_entry_t **entry) {
+	wd_fswalker_frame_t		*frame;
+	const char				*name;
+	wi_uinteger_t			namelength, pathlength;
+	unsigned char			type;
+	int						fd, error;
+	
+	*entry = &walker->entry;
+	
+	if(walker->descend) {
+		walker->descend = false;
+		
+		if(walker->depth >= WD_FSWALKER_MAX_DEPTH) {
+			wi_error_set_errno(ELOOP);
+			
+			return WD_FSWALKER_ERROR;
+		}
+		
+		frame	= &walker->frames[walker->depth - 1];
+		fd		= openat(frame->fd, walker->entry.name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+		
+		if(fd < 0) {
+			wi_error_set_errno(errno);
+			
+			return WD_FSWALKER_ERROR;
+		}
+		
+		pathlength = walker->entry.pathlength;
+		
+		if(!wd_fswalker_push(walker, fd))
+			return WD_FSWALKER_ERROR;
+		
+		walker->frames[walker->depth - 1].pathlength = pathlength;
+	}
+	
+	while(walker->depth > 0) {
+		frame = &walker->frames[walker->depth - 1];
+		
+		if(!wd_fswalker_read(walker, frame, &name, &type, &error)) {
+			if(error != 0) {
+				walker->path[frame->pathlength] = '\0';
+				walker->entry.path			= walker->path;
+				walker->entry.pathlength	= frame->pathlength;
+				
+				wd_fswalker_pop(walker);
+				wi_error_set_errno(error);
+				
+				return WD_FSWALKER_ERROR;
+			}
+			
+			wd_fswalker_pop(walker);
+			
+			continue;
+		}
+		
+		if(name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+			continue;
+		
+		namelength = strlen(name);
+		pathlength = frame->pathlength + 1 + namelength;
+		
+		wd_fswalker_reserve_path(walker, pathlength + 1);
+		
+		walker->path[frame->pathlength] = '/';
+		memcpy(walker->path + frame->pathlength + 1, name, namelength + 1);
+		
+		walker->entry.path			= walker->path;
+		walker->entry.name			= walker->path + frame->pathlength + 1;
+		walker->entry.pathlength	= pathlength;
+		walker->entry.level			= walker->depth;
+		walker->entry.type			= type;
+		walker->entry.statted		= false;
+		
+		if(type == DT_UNKNOWN) {
+			if(wd_fswalker_statat(frame->fd, walker->entry.name, false, &walker->entry.lsb) == 0) {
+				walker->entry.type = S_ISDIR(walker->entry.lsb.mode) ? DT_DIR : S_ISLNK(walker->entry.lsb.mode) ? DT_LNK : DT_REG;
+				
+				if(walker->entry.type != DT_LNK) {
+					walker->entry.sb		= walker->entry.lsb;
+					walker->entry.statted	= true;
+				}
+			}
+		}
+		
+		walker->descend = (walker->entry.type == DT_DIR);
+		
+		return WD_FSWALKER_ENTRY;
+	}
+	
+	return WD_FSWALKER_EOF;
+}
+
+
+
+void wd_fswalker_skip_descendents(wd_fswalker_t *walker) {
+	walker->descend = false;
+}
+
+
+
+wi_boolean_t wd_fswalker_stat_entry(wd_fswalker_t *walker, wd_fswalker_entry_t *entry) {
+	int		fd;
+	
+	if(entry->statted)
+		return true;
+	
+	fd = walker->frames[walker->depth - 1].fd;
+	
+	if(wd_fswalker_statat(fd, entry->name, false, &entry->lsb) < 0) {
+		wi_error_set_errno(errno);
+		
+		return false;
+	}
+	
+	if(!S_ISLNK(entry->lsb.mode) || wd_fswalker_statat(fd, entry->name, true, &entry->sb) < 0)
+		entry->sb = entry->lsb;
+	
+	entry->statted = true;
+	
+	return true;
+}
+
+
+
+#pragma mark -
+
+wi_string_t * wd_fswalker_entry_path(wd_fswalker_entry_t *entry) {
+	return wi_string_with_cstring(entry->path);
+}
+
+
+
+wi_string_t * wd_fswalker_entry_relative_path(wd_fswalker_t *walker, wd_fswalker_entry_t *entry) {
+	return wi_string_with_cstring(entry->path + walker->rootlength);
+}
+
+
+
+#pragma mark -
+
+static wi_boolean_t wd_fswalker_push(wd_fswalker_t *walker, int fd) {
+	wd_fswalker_frame_t		*frame;
+	
+	if(walker->depth == walker->capacity) {
+		walker->capacity	= (walker->capacity == 0) ? 16 : walker->capacity * 2;
+		walker->frames		= wi_realloc(walker->frames, walker->capacity * sizeof(wd_fswalker_frame_t));
+		
+		memset(walker->frames + walker->depth, 0, (walker->capacity - walker->depth) * sizeof(wd_fswalker_frame_t));
+	}
+	
+	frame = &walker->frames[walker->depth];
+	frame->fd = fd;
+	
+#ifdef WD_FSWALKER_GETDENTS64
+	if(!frame->buffer)
+		frame->buffer = wi_malloc(WD_FSWALKER_BUFFER_SIZE);
+	
+	frame->position	= 0;
+	frame->length	= 0;
+#else
+	frame->dir = fdopendir(fd);
+	
+	if(!frame->dir) {
+		wi_error_set_errno(errno);
+		close(fd);
+		
+		return false;
+	}
+#endif
+	
+	walker->depth++;
+	
+	return true;
+}
+
+
+
+static void wd_fswalker_pop(wd_fswalker_t *walker) {
+	wd_fswalker_frame_t		*frame;
+	
+	frame = &walker->frames[--walker->depth];
+	
+#ifdef WD_FSWALKER_GETDENTS64
+	close(frame->fd);
+#else
+	closedir(frame->dir);
+	
+	frame->dir = NULL;
+#endif
+	
+	frame->fd = -1;
+	
+	walker->descend = false;
+}
+
+
+
+static wi_boolean_t wd_fswalker_read(wd_fswalker_t *walker, wd_fswalker_frame_t *frame, const char **name, unsigned char *type, int *error) {
+#ifdef WD_FSWALKER_GETDENTS64
+	struct _wd_fswalker_dirent64	*de;
+	long							bytes;
+	
+	*error = 0;
+	
+	if(frame->position >= frame->length) {
+		bytes = syscall(SYS_getdents64, frame->fd, frame->buffer, WD_FSWALKER_BUFFER_SIZE);
+		
+		if(bytes < 0) {
+			*error = errno;
+			
+			return false;
+		}
+		
+		if(bytes == 0)
+			return false;
+		
+		frame->position	= 0;
+		frame->length	= bytes;
+	}
+	
+	de = (struct _wd_fswalker_dirent64 *) (frame->buffer + frame->position);
+	frame->position += de->d_reclen;
+	
+	*name = de->d_name;
+	*type = de->d_type;
+	
+	return true;
+#else
+	struct dirent		*de;
+	
+	errno = 0;
+	de = readdir(frame->dir);
+	
+	if(!de) {
+		*error = errno;
+		
+		return false;
+	}
+	
+	*error = 0;
+	*name = de->d_name;
+	*type = de->d_type;
+	
+	return true;
+#endif
+}
+
+
+
+static void wd_fswalker_reserve_path(wd_fswalker_t *walker, wi_uinteger_t length) {
+	if(length <= walker->pathcapacity)
+		return;
+	
+	while(walker->pathcapacity < length)
+		walker->pathcapacity = (walker->pathcapacity == 0) ? WI_PATH_SIZE : walker->pathcapacity * 2;
+	
+	walker->path			= wi_realloc(walker->path, walker->pathcapacity);
+	walker->entry.path		= walker->path;
+}
+
+
+
+static int wd_fswalker_statat(int fd, const char *name, wi_boolean_t follow, wi_fs_stat_t *sbp) {
+#ifdef WD_FSWALKER_STATX
+	struct statx		stx;
+	
+	if(statx(fd, name, follow ? 0 : AT_SYMLINK_NOFOLLOW,
+			 STATX_TYPE | STATX_MODE | STATX_INO | STATX_SIZE | STATX_MTIME | STATX_BTIME, &stx) < 0)
+		return -1;
+	
+	memset(sbp, 0, sizeof(*sbp));
+	
+	sbp->dev		= makedev(stx.stx_dev_major, stx.stx_dev_minor);
+	sbp->ino		= stx.stx_ino;
+	sbp->mode		= stx.stx_mode;
+	sbp->size		= stx.stx_size;
+	sbp->mtime		= stx.stx_mtime.tv_sec;
+	sbp->birthtime	= (stx.stx_mask & STATX_BTIME) ? stx.stx_btime.tv_sec : stx.stx_mtime.tv_sec;
+#else
+	struct stat			sb;
+	
+	if(fstatat(fd, name, &sb, follow ? 0 : AT_SYMLINK_NOFOLLOW) < 0)
+		return -1;
+	
+	memset(sbp, 0, sizeof(*sbp));
+	
+	sbp->dev		= sb.st_dev;
+	sbp->ino		= sb.st_ino;
+	sbp->mode		= sb.st_mode;
+	sbp->size		= sb.st_size;
+	sbp->atime		= sb.st_atime;
+	sbp->mtime		= sb.st_mtime;
+	
+#if defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__)
+	sbp->birthtime	= sb.st_birthtime;
+#else
+	sbp->birthtime	= sb.st_mtime;
+#endif
+#endif
+	
+	return 0;
+}
@@ -0,0 +1,67 @@
+/* $Id$ */
+
+/*
+ *  Copyright (c) 2003-2009 Axel Andersson
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef WD_FSWALKER_H
+#define WD_FSWALKER_H 1
+
+#include <wired/wired.h>
+
+
+enum _wd_fswalker_status {
+	WD_FSWALKER_ENTRY					= 0,
+	WD_FSWALKER_ERROR,
+	WD_FSWALKER_EOF
+};
+typedef enum _wd_fswalker_status		wd_fswalker_status_t;
+
+struct _wd_fswalker_entry {
+	const char							*path;
+	const char							*name;
+	wi_uinteger_t						pathlength;
+	wi_uinteger_t						level;
+	unsigned char						type;
+	
+	wi_boolean_t						statted;
+	wi_fs_stat_t						sb, lsb;
+};
+typedef struct _wd_fswalker_entry		wd_fswalker_entry_t;
+
+typedef struct _wd_fswalker				wd_fswalker_t;
+
+
+wd_fswalker_t *							wd_fswalker_open(wi_string_t *);
+void									wd_fswalker_close(wd_fswalker_t *);
+
+wd_fswalker_status_t					wd_fswalker_next(wd_fswalker_t *, wd_fswalker_entry_t **);
+void									wd_fswalker_skip_descendents(wd_fswalker_t *);
+wi_boolean_t							wd_fswalker_stat_entry(wd_fswalker_t *, wd_fswalker_entry_t *);
+
+wi_string_t *							wd_fswalker_entry_path(wd_fswalker_entry_t *);
+wi_string_t *							wd_fswalker_entry_relative_path(wd_fswalker_t *, wd_fswalker_entry_t *);
+
+#endif /* WD_FSWALKER_H */
@@ -28,52 +28,292 @@
 
 #include "config.h"
 
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
 #include <wired/wired.h>
 
 #include "accounts.h"
 #include "files.h"
+#include "fswalker.h"
 #include "index.h"
+#include "indeximage.h"
 #include "main.h"
 #include "server.h"
 #include "settings.h"
 #include "trackers.h"
 
-#define WD_INDEX_MAX_LEVEL						20
+#define WD_INDEX_MAX_LEVEL						256
+#define WD_INDEX_VERIFY_PASSES					24
+#define WD_INDEX_TRANSACTION_SIZE				1000
+#define WD_INDEX_TRANSACTION_TIME				1.0
+#define WD_INDEX_MAX_THREADS					64
+#define WD_INDEX_IMAGE_PATH						"index.image"
+#define WD_INDEX_IMAGE_DELAY					10.0
+#define WD_INDEX_IMAGE_REBUILD_DELAY			300.0
+#define WD_INDEX_IMAGE_MAX_CHANGES				4096
+#define WD_INDEX_CACHE_MAX_SIZE					(16 * 1024 * 1024)
+#define WD_INDEX_CACHE_ENTRY_SIZE				256
+#define WD_INDEX_CACHE_HIT_SIZE					512
+#define WD_INDEX_ALL_TYPES						0xFFFFFFFF
+#define WD_INDEX_SEARCH_WINDOW					50000
+
+
+enum _wd_index_change {
+	WD_INDEX_ADD_FILE,
+	WD_INDEX_DELETE_FILE,
+	WD_INDEX_DELETE_FILES,
+	WD_INDEX_MOVE_FILES
+};
+typedef enum _wd_index_change					wd_index_change_t;
+
+
+struct _wd_index_directory {
+	wi_runtime_base_t							base;
+	
+	wi_string_t									*path;
+	wi_string_t									*virtualpath;
+	wi_string_t									*parentpath;
+	wi_uinteger_t								level;
+	wi_boolean_t								dropbox;
+	
+	int64_t										inode, mtime;
+	wi_uinteger_t								filescount, directoriescount;
+	wi_file_offset_t							filessize;
+	
+	wi_mutable_array_t							*deletions;
+	wi_mutable_array_t							*additions;
+	wi_mutable_array_t							*updates;
+};
+typedef struct _wd_index_directory				wd_index_directory_t;
+
+
+struct _wd_index_search {
+	wd_user_t									*user;
+	wd_account_t								*account;
+	wi_uinteger_t								accountpathlength;
+	wd_batch_t									batch;
+	
+	wi_uinteger_t								limit, count;
+	wi_time_interval_t							interval;
+	wi_integer_t								lastrowid;
+	wi_boolean_t								truncated, timedout;
+	wi_mutable_array_t							*hits;
+	
+	wd_indeximage_filter_t						filter;
+	wi_string_t									*extension;
+	
+	wi_integer_t								*changes;
+	wi_uinteger_t								changescount;
+};
+typedef struct _wd_index_search					wd_index_search_t;
 
 
 static void										wd_index_create_tables(void);
+static wi_boolean_t								wd_index_create_search_table(void);
+static wi_boolean_t								wd_index_create_search_triggers(void);
+static wi_string_t *							wd_index_like_pattern(wi_string_t *, wi_boolean_t);
+static wi_uinteger_t							wd_index_character_count(wi_string_t *);
 
 static void										wd_index_update_index(wi_timer_t *);
 static void										wd_index_thread(wi_runtime_instance_t *);
-static void										wd_index_index_path(wi_string_t *, wi_string_t *);
+static void										wd_index_crawl(wi_string_t *);
+static void										wd_index_crawl_thread(wi_runtime_instance_t *);
+static wi_boolean_t								wd_index_crawl_directory(wd_index_directory_t *, wi_mutable_array_t *);
+static wi_boolean_t								wd_index_read_directory(wd_index_directory_t *, wi_fs_stat_t *, wi_mutable_array_t *);
+static void										wd_index_indexed_directories(wd_index_directory_t *, wi_mutable_array_t *);
+static void										wd_index_write_directory(wd_index_directory_t *);
+static void										wd_index_delete_below_path(wi_string_t *);
+static wi_array_t *								wd_index_metadata(wi_string_t *, wi_fs_stat_t *, wi_fs_stat_t *, wi_boolean_t);
+static void										wd_index_begin_transaction(void);
+static void										wd_index_commit_transaction(wi_boolean_t);
+
+static void										wd_index_update_image(wi_timer_t *);
+static void										wd_index_image_thread(wi_runtime_instance_t *);
+static wi_boolean_t								wd_index_load_image(void);
+static void										wd_index_write_image(void);
+static void										wd_index_invalidate_image(void);
+static void										wd_index_note_image_changes(wi_string_t *);
+static wd_indeximage_t *						wd_index_copy_image(wi_array_t **);
+static void										wd_index_set_image(wd_indeximage_t *);
+
+static void										wd_index_change(wd_index_change_t, wi_string_t *, wi_string_t *);
+static void										wd_index_apply_change(wd_index_change_t, wi_string_t *, wi_string_t *);
+static void										wd_index_apply_add_file(wi_string_t *);
+static void										wd_index_apply_delete_file(wi_string_t *);
+static void										wd_index_apply_delete_files(wi_string_t *);
+static void										wd_index_apply_move_files(wi_string_t *, wi_string_t *);
+static wi_boolean_t								wd_index_entry_counts(wi_string_t *, wi_integer_t *, wi_integer_t *, int64_t *);
+static void										wd_index_adjust_counts(wi_string_t *, wi_integer_t, wi_integer_t, int64_t);
+static void										wd_index_write_counts(void);
+
+static wd_index_directory_t *					wd_index_directory_with_path(wi_string_t *, wi_string_t *, wi_string_t *, wi_uinteger_t);
+static void										wd_index_directory_dealloc(wi_runtime_instance_t *);
+
+static wi_boolean_t								wd_index_search_database(wd_index_search_t *, wi_string_t *, wi_string_t *, wi_array_t *);
+static wi_boolean_t								wd_index_search_changes(wd_index_search_t *, wi_string_t *, wi_string_t *, wi_array_t *, wi_integer_t);
+static int										wd_index_compare_rowids(const void *, const void *);
+static wi_boolean_t								wd_index_search_image_entry(wd_indeximage_entry_t *, void *);
+static wi_boolean_t								wd_index_search_add_hit(wd_index_search_t *, wi_integer_t, wi_string_t *, wi_string_t *, wi_boolean_t, wi_array_t *, wi_uinteger_t);
+static wi_boolean_t								wd_index_search_timed_out(wd_index_search_t *);
+static void										wd_index_search_reply(wd_index_search_t *, wi_array_t *);
+
+static wi_boolean_t								wd_index_search_filter(wd_index_search_t *, wi_p7_message_t *);
+
+static wi_string_t *							wd_index_cache_key(wd_index_search_t *, wi_string_t *, wi_string_t *);
+static wi_array_t *								wd_index_cache_entry(wi_string_t *);
+static void										wd_index_cache_add(wi_string_t *, wi_array_t *, wi_boolean_t, wi_integer_t);
+static void										wd_index_cache_clear(void);
+static void										wd_index_bump_generation(void);
 
 
 static wi_time_interval_t						wd_index_time;
 static wi_timer_t								*wd_index_timer;
 static wi_lock_t								*wd_index_lock;
-static wi_uinteger_t							wd_index_level;
+static wi_lock_t								*wd_index_pass_lock;
+static wi_uinteger_t							wd_index_threads;
+static wi_uinteger_t							wd_index_passes;
+static wi_boolean_t								wd_index_verify;
+static wi_uinteger_t							wd_index_directories_visited;
+static wi_uinteger_t							wd_index_directories_rescanned;
+static wi_lock_t								*wd_index_dictionary_lock;
 static wi_mutable_dictionary_t					*wd_index_dictionary;
 
+static wi_condition_lock_t						*wd_index_queue_lock;
+static wi_mutable_array_t						*wd_index_queue;
+static wi_uinteger_t							wd_index_running;
+static wi_condition_lock_t						*wd_index_diffs_lock;
+static wi_mutable_array_t						*wd_index_diffs;
+static wi_boolean_t								wd_index_crawled;
+static wi_boolean_t								wd_index_search_table;
+static wi_boolean_t								wd_index_verify_search;
+static wi_uinteger_t							wd_index_search_limit;
+static wi_time_interval_t						wd_index_search_time;
+static wi_sqlite3_database_t					*wd_index_database;
+static wi_boolean_t								wd_index_transaction;
+static wi_uinteger_t							wd_index_transaction_changes;
+static wi_time_interval_t						wd_index_transaction_time;
+
+static wi_lock_t								*wd_index_journal_lock;
+static wi_mutable_array_t						*wd_index_journal;
+static wi_boolean_t								wd_index_indexing;
+
+static wi_boolean_t								wd_index_image_enabled;
+static wi_lock_t								*wd_index_image_lock;
+static wd_indeximage_t							*wd_index_image;
+static wi_timer_t								*wd_index_image_timer;
+static wi_boolean_t								wd_index_image_pending;
+static wi_mutable_set_t							*wd_index_image_changes;
+
+static wi_uinteger_t							wd_index_generation;
+static wi_lock_t								*wd_index_cache_lock;
+static wi_mutable_dictionary_t					*wd_index_cache;
+static wi_mutable_array_t						*wd_index_cache_order;
+static wi_uinteger_t							wd_index_cache_capacity;
+
+static const char								*wd_index_metadata_columns[] = {
+	"type",
+	"data_size",
+	"rsrc_size",
+	"directory_count",
+	"creation_time",
+	"modification_time",
+	"volume",
+	"label",
+	"executable",
+	"link",
+	NULL
+};
+
+static wi_runtime_id_t							wd_index_directory_runtime_id = WI_RUNTIME_ID_NULL;
+static wi_runtime_class_t						wd_index_directory_runtime_class = {
+	"wd_index_directory_t",
+	wd_index_directory_dealloc,
+	NULL,
+	NULL,
+	NULL,
+	NULL
+};
+
 wi_uinteger_t									wd_index_files_count;
 wi_uinteger_t									wd_index_directories_count;
 wi_file_offset_t								wd_index_files_size;
 
+wi_uinteger_t									wd_index_search_cache_hits;
+wi_uinteger_t									wd_index_search_cache_misses;
+wi_uinteger_t									wd_index_search_cache_count;
+wi_uinteger_t									wd_index_search_cache_size;
+
 
 
 void wd_index_initialize(void) {
 	wd_index_create_tables();
 	
+	/* the index batches its writes, so it must not share transactions with the rest of the server */
+	wd_index_database = wi_retain(wd_database_open_connection());
+	
 	wi_fs_delete_path(WI_STR("index"));
 	wi_fs_delete_path(WI_STR("files.index"));
 	
-	wd_index_lock	= wi_lock_init(wi_lock_alloc());
-	wd_index_timer	= wi_timer_init_with_function(wi_timer_alloc(), wd_index_update_index, 0.0, true);
+	wd_index_lock			= wi_lock_init(wi_lock_alloc());
+	wd_index_pass_lock		= wi_lock_init(wi_lock_alloc());
+	wd_index_journal_lock	= wi_lock_init(wi_lock_alloc());
+	wd_index_journal		= wi_array_init(wi_mutable_array_alloc());
+	
+	wd_index_dictionary_lock	= wi_lock_init(wi_lock_alloc());
+	wd_index_queue_lock			= wi_condition_lock_init_with_condition(wi_condition_lock_alloc(), 0);
+	wd_index_queue				= wi_array_init(wi_mutable_array_alloc());
+	wd_index_diffs_lock			= wi_condition_lock_init_with_condition(wi_condition_lock_alloc(), 0);
+	wd_index_diffs				= wi_array_init(wi_mutable_array_alloc());
+	
+	wd_index_directory_runtime_id = wi_runtime_register_class(&wd_index_directory_runtime_class);
+	
+	wd_indeximage_initialize();
+	
+	wd_index_image_lock		= wi_lock_init(wi_lock_alloc());
+	wd_index_image_timer	= wi_timer_init_with_function(wi_timer_alloc(), wd_index_update_image, WD_INDEX_IMAGE_DELAY, false);
+	wd_index_image_changes	= wi_set_init(wi_mutable_set_alloc());
+	
+	wd_index_cache_lock		= wi_lock_init(wi_lock_alloc());
+	wd_index_cache			= wi_dictionary_init(wi_mutable_dictionary_alloc());
+	wd_index_cache_order	= wi_array_init(wi_mutable_array_alloc());
+	
+	wd_index_timer			= wi_timer_init_with_function(wi_timer_alloc(), wd_index_update_index, 0.0, true);
 }
 
 
 
 void wd_index_schedule(void) {
-	wd_index_time = wi_config_time_interval_for_name(wd_config, WI_STR("index time"));
+	wd_indeximage_t		*image;
+	
+	wd_index_time		= wi_config_time_interval_for_name(wd_config, WI_STR("index time"));
+	wd_index_threads	= wi_config_integer_for_name(wd_config, WI_STR("index threads"));
+	
+	wd_index_verify_search	= wi_config_bool_for_name(wd_config, WI_STR("verify search results"));
+	wd_index_search_limit	= wi_config_integer_for_name(wd_config, WI_STR("search limit"));
+	wd_index_search_time	= wi_config_time_interval_for_name(wd_config, WI_STR("search time"));
+	wd_index_image_enabled	= wi_config_bool_for_name(wd_config, WI_STR("index image"));
+	wd_index_cache_capacity	= wi_config_integer_for_name(wd_config, WI_STR("search cache"));
+	
+	wd_index_cache_clear();
+	
+	if(wd_index_image_enabled) {
+		image = wd_index_copy_image(NULL);
+		
+		if(!image)
+			wi_timer_reschedule(wd_index_image_timer, WD_INDEX_IMAGE_DELAY);
+		
+		wi_release(image);
+	} else {
+		wd_index_set_image(NULL);
+		
+		wi_fs_delete_path(WI_STR(WD_INDEX_IMAGE_PATH));
+	}
+	
+	if(wd_index_threads < 1)
+		wd_index_threads = 1;
+	else if(wd_index_threads > WD_INDEX_MAX_THREADS)
+		wd_index_threads = WD_INDEX_MAX_THREADS;
 	
 	if(wd_index_time > 0.0)
 		wi_timer_reschedule(wd_index_timer, wd_index_time);
@@ -86,7 +326,32 @@ void wd_index_schedule(void) {
 #pragma mark -
 
 static void wd_index_create_tables(void) {
-	wi_uinteger_t		version;
+	wi_uinteger_t		i, version;
+	
+	version = wd_database_version_for_table(WI_STR("index_directories"));
+	
+	switch(version) {
+		case 0:
+			if(!wi_sqlite3_execute_statement(wd_database, WI_STR("CREATE TABLE index_directories ( "
+																 "real_path TEXT NOT NULL PRIMARY KEY, "
+																 "virtual_path TEXT NOT NULL, "
+																 "parent TEXT, "
+																 "inode INTEGER NOT NULL, "
+																 "mtime INTEGER NOT NULL, "
+																 "files_count INTEGER NOT NULL, "
+																 "directories_count INTEGER NOT NULL, "
+																 "files_size INTEGER NOT NULL "
+																 ")"),
+											 NULL)) {
+				wi_log_fatal(WI_STR("Could not execute database statement: %m"));
+			}
+			
+			if(!wi_sqlite3_execute_statement(wd_database, WI_STR("CREATE INDEX index_directories_parent ON index_directories(parent)"), NULL))
+				wi_log_fatal(WI_STR("Could not execute database statement: %m"));
+			break;
+	}
+	
+	wd_database_set_version_for_table(1, WI_STR("index_directories"));
 	
 	version = wd_database_version_for_table(WI_STR("index"));
 	
@@ -96,7 +361,18 @@ static void wd_index_create_tables(void) {
 																 "name TEXT NOT NULL, "
 																 "virtual_path TEXT NOT NULL, "
 																 "real_path TEXT NOT NULL, "
-																 "alias INTEGER NOT NULL "
+																 "alias INTEGER NOT NULL, "
+																 "parent TEXT, "
+																 "type INTEGER NOT NULL DEFAULT 0, "
+																 "data_size INTEGER NOT NULL DEFAULT 0, "
+																 "rsrc_size INTEGER NOT NULL DEFAULT 0, "
+																 "directory_count INTEGER NOT NULL DEFAULT 0, "
+																 "creation_time INTEGER NOT NULL DEFAULT 0, "
+																 "modification_time INTEGER NOT NULL DEFAULT 0, "
+																 "volume INTEGER NOT NULL DEFAULT 0, "
+																 "label INTEGER NOT NULL DEFAULT 0, "
+																 "executable INTEGER NOT NULL DEFAULT 0, "
+																 "link INTEGER NOT NULL DEFAULT 0 "
 																 ")"),
 											 NULL)) {
 				wi_log_fatal(WI_STR("Could not execute database statement: %m"));
@@ -104,10 +380,47 @@ static void wd_index_create_tables(void) {
 
 			if(!wi_sqlite3_execute_statement(wd_database, WI_STR("CREATE INDEX index_real_path ON `index`(real_path)"), NULL))
 				wi_log_fatal(WI_STR("Could not execute database statement: %m"));
+			
+			if(!wi_sqlite3_execute_statement(wd_database, WI_STR("CREATE INDEX index_parent ON `index`(parent)"), NULL))
+				wi_log_fatal(WI_STR("Could not execute database statement: %m"));
+			break;
+			
+		case 1:
+		case 2:
+			if(!wi_sqlite3_execute_statement(wd_database, WI_STR("ALTER TABLE `index` ADD COLUMN parent TEXT"), NULL))
+				wi_log_fatal(WI_STR("Could not execute database statement: %m"));
+			
+			if(!wi_sqlite3_execute_statement(wd_database, WI_STR("CREATE INDEX index_parent ON `index`(parent)"), NULL))
+				wi_log_fatal(WI_STR("Could not execute database statement: %m"));
+			
+			/* fall through */
+			
+		case 3:
+			for(i = 0; wd_index_metadata_columns[i]; i++) {
+				if(!wi_sqlite3_execute_statement(wd_database, wi_string_with_format(WI_STR("ALTER TABLE `index` ADD COLUMN %s INTEGER NOT NULL DEFAULT 0"),
+																					 wd_index_metadata_columns[i]),
+												 NULL)) {
+					wi_log_fatal(WI_STR("Could not execute database statement: %m"));
+				}
+			}
+			
+			/* old rows lack parents or metadata, so the next pass indexes everything again */
+			if(!wi_sqlite3_execute_statement(wd_database, WI_STR("DELETE FROM `index`"), NULL))
+				wi_log_fatal(WI_STR("Could not execute database statement: %m"));
+			
+			if(!wi_sqlite3_execute_statement(wd_database, WI_STR("DELETE FROM index_directories"), NULL))
+				wi_log_fatal(WI_STR("Could not execute database statement: %m"));
+			
+			if(!wi_sqlite3_execute_statement(wd_database, WI_STR("DELETE FROM index_metadata"), NULL))
+				wi_log_fatal(WI_STR("Could not execute database statement: %m"));
 			break;
 	}
 	
-	wd_database_set_version_for_table(1, WI_STR("index"));
+	wd_database_set_version_for_table(4, WI_STR("index"));
+	
+	/* needs an SQLite with FTS5 and the trigram tokenizer, searches fall back to LIKE otherwise */
+	wd_index_search_table = wd_index_create_search_table();
+	
 
 	version = wd_database_version_for_table(WI_STR("index_metadata"));
 	
@@ -130,6 +443,69 @@ static void wd_index_create_tables(void) {
 
 
 
+static wi_boolean_t wd_index_create_search_table(void) {
+	wi_dictionary_t		*results;
+	
+	results = wi_sqlite3_execute_statement(wd_database, WI_STR("SELECT name FROM sqlite_master "
+															   "WHERE type = 'table' AND name = 'index_names'"),
+										   NULL);
+	
+	if(!results)
+		wi_log_fatal(WI_STR("Could not execute database statement: %m"));
+	
+	if(wi_dictionary_count(results) > 0)
+		return true;
+	
+	if(!wi_sqlite3_execute_statement(wd_database, WI_STR("CREATE VIRTUAL TABLE index_names USING fts5 ( "
+														 "name, "
+														 "content='index', "
+														 "tokenize='trigram' "
+														 ")"),
+									 NULL)) {
+		wi_log_warn(WI_STR("Could not create search index, searches will scan all files: %m"));
+		
+		return false;
+	}
+	
+	if(!wd_index_create_search_triggers()) {
+		wi_log_fatal(WI_STR("Could not execute database statement: %m"));
+		
+		return false;
+	}
+	
+	if(!wi_sqlite3_execute_statement(wd_database, WI_STR("INSERT INTO index_names(index_names) VALUES('rebuild')"), NULL))
+		wi_log_fatal(WI_STR("Could not execute database statement: %m"));
+	
+	return true;
+}
+
+
+
+static wi_boolean_t wd_index_create_search_triggers(void) {
+	if(!wi_sqlite3_execute_statement(wd_database, WI_STR("CREATE TRIGGER IF NOT EXISTS index_names_insert AFTER INSERT ON `index` BEGIN "
+														 "INSERT INTO index_names(rowid, name) VALUES (new.rowid, new.name); "
+														 "END"),
+									 NULL))
+		return false;
+	
+	if(!wi_sqlite3_execute_statement(wd_database, WI_STR("CREATE TRIGGER IF NOT EXISTS index_names_delete AFTER DELETE ON `index` BEGIN "
+														 "INSERT INTO index_names(index_names, rowid, name) VALUES ('delete', old.rowid, old.name); "
+														 "END"),
+									 NULL))
+		return false;
+	
+	if(!wi_sqlite3_execute_statement(wd_database, WI_STR("CREATE TRIGGER IF NOT EXISTS index_names_update AFTER UPDATE OF name ON `index` BEGIN "
+														 "INSERT INTO index_names(index_names, rowid, name) VALUES ('delete', old.rowid, old.name); "
+														 "INSERT INTO index_names(rowid, name) VALUES (new.rowid, new.name); "
+														 "END"),
+									 NULL))
+		return false;
+	
+	return true;
+}
+
+
+
 #pragma mark -
 
 static void wd_index_update_index(wi_timer_t *timer) {
@@ -141,10 +517,14 @@ static void wd_index_update_index(wi_timer_t *timer) {
 void wd_index_index_files(wi_boolean_t startup) {
 	wi_dictionary_t		*results;
 	wi_time_interval_t	interval, index_time;
-	wi_boolean_t		index = true;
+	wi_boolean_t		index = true, image = false;
+	
+	/* an image left by the last run answers searches right away, even while reindexing */
+	if(startup && wd_index_image_enabled)
+		image = wd_index_load_image();
 	
 	if(startup) {
-		results = wi_sqlite3_execute_statement(wd_database, WI_STR("SELECT date, files_count, directories_count, files_size "
+		results = wi_sqlite3_execute_statement(wd_index_database, WI_STR("SELECT date, files_count, directories_count, files_size "
 																   "FROM index_metadata"), NULL);
 		
 		if(results) {
@@ -185,38 +565,77 @@ void wd_index_index_files(wi_boolean_t startup) {
 		if(!wi_thread_create_thread_with_priority(wd_index_thread, wi_number_with_bool(startup), 0.0))
 			wi_log_fatal(WI_STR("Could not create an index thread: %m"));
 	}
+	else if(wd_index_image_enabled && !image) {
+		if(!wi_thread_create_thread_with_priority(wd_index_image_thread, NULL, 0.0))
+			wi_log_error(WI_STR("Could not create an index image thread: %m"));
+	}
 }
 
 
 
 static void wd_index_thread(wi_runtime_instance_t *argument) {
 	wi_pool_t					*pool;
+	wi_enumerator_t				*enumerator;
+	wi_dictionary_t				*results;
+	wi_array_t					*change;
 	wi_time_interval_t			interval;
 	wi_boolean_t				startup = wi_number_bool(argument);
+	wi_boolean_t				verify;
 	
 	pool = wi_pool_init(wi_pool_alloc());
 	
-	if(wi_lock_trylock(wd_index_lock)) {
+	/* only one pass at a time, but one that finds an image being written waits for it instead of skipping */
+	if(wi_lock_trylock(wd_index_pass_lock)) {
+		wi_lock_lock(wd_index_lock);
+		
+		/* every so often reread all directories in case a change slipped past their mtimes */
+		verify = (startup || ++wd_index_passes % WD_INDEX_VERIFY_PASSES == 0);
+		
 		wi_log_info(WI_STR("Indexing files..."));
 		
-		interval					= wi_time_interval();
-		wd_index_files_count		= 0;
-		wd_index_directories_count	= 0;
-		wd_index_files_size			= 0;
-		wd_index_level				= 0;
+		/* the index stays searchable during the pass, changes made meanwhile wait in the journal */
+		wi_lock_lock(wd_index_journal_lock);
+		wd_index_indexing = true;
+		wi_lock_unlock(wd_index_journal_lock);
+		
+		interval						= wi_time_interval();
+		wd_index_verify					= verify;
+		wd_index_directories_visited	= 0;
+		wd_index_directories_rescanned	= 0;
 		
 		wd_index_dictionary = wi_dictionary_init_with_capacity_and_callbacks(wi_mutable_dictionary_alloc(), 0,
 			wi_dictionary_null_key_callbacks, wi_dictionary_default_value_callbacks);
 		
-		if(!wi_sqlite3_execute_statement(wd_database, WI_STR("DELETE FROM `index`"), NULL))
-			wi_log_error(WI_STR("Could not execute database statement: %m"));
+		wd_index_crawl(wi_string_by_resolving_aliases_in_path(wd_files));
+		
+		wi_lock_lock(wd_index_journal_lock);
 		
-		// if(!wi_sqlite3_execute_statement(wd_database, WI_STR("PRAGMA synchronous=OFF"), NULL))
-		// 	wi_log_error(WI_STR("Could not execute database statement: %m"));
+		enumerator = wi_array_data_enumerator(wd_index_journal);
 		
-		wd_index_index_path(wi_string_by_resolving_aliases_in_path(wd_files), NULL);
+		while((change = wi_enumerator_next_data(enumerator))) {
+			wd_index_apply_change(wi_number_int32(WI_ARRAY(change, 0)),
+								  WI_ARRAY(change, 1),
+								  wi_array_count(change) > 2 ? WI_ARRAY(change, 2) : NULL);
+		}
+		
+		wi_mutable_array_remove_all_data(wd_index_journal);
+		
+		/* the totals are summed afresh, changes made after this adjust them in place */
+		results = wi_sqlite3_execute_statement(wd_index_database, WI_STR("SELECT IFNULL(SUM(files_count), 0) AS files_count, "
+																   "IFNULL(SUM(directories_count), 0) AS directories_count, "
+																   "IFNULL(SUM(files_size), 0) AS files_size "
+																   "FROM index_directories"),
+											   NULL);
+		
+		if(results && wi_dictionary_count(results) > 0) {
+			wd_index_files_count		= wi_number_integer(wi_dictionary_data_for_key(results, WI_STR("files_count")));
+			wd_index_directories_count	= wi_number_integer(wi_dictionary_data_for_key(results, WI_STR("directories_count")));
+			wd_index_files_size			= wi_number_int64(wi_dictionary_data_for_key(results, WI_STR("files_size")));
+		} else {
+			wi_log_error(WI_STR("Could not execute database statement: %m"));
+		}
 		
-		wi_log_info(WI_STR("Indexed %u %s and %u %s for a total of %@ (%llu bytes) in %.2f seconds"),
+		wi_log_info(WI_STR("Indexed %u %s and %u %s for a total of %@ (%llu bytes) in %.2f seconds, rescanned %u of %u %s with %u %s"),
 			wd_index_files_count,
 			wd_index_files_count == 1
 				? "file"
@@ -227,15 +646,21 @@ static void wd_index_thread(wi_runtime_instance_t *argument) {
 				: "directories",
 			wd_files_string_for_bytes(wd_index_files_size),
 			wd_index_files_size,
-			wi_time_interval() - interval);
-		
-		// if(!wi_sqlite3_execute_statement(wd_database, WI_STR("PRAGMA synchronous=ON"), NULL))
-		// 	wi_log_error(WI_STR("Could not execute database statement: %m"));
+			wi_time_interval() - interval,
+			wd_index_directories_rescanned,
+			wd_index_directories_visited,
+			wd_index_directories_visited == 1
+				? "directory"
+				: "directories",
+			wd_index_threads,
+			wd_index_threads == 1
+				? "thread"
+				: "threads");
 		
-		if(!wi_sqlite3_execute_statement(wd_database, WI_STR("DELETE FROM index_metadata"), NULL))
+		if(!wi_sqlite3_execute_statement(wd_index_database, WI_STR("DELETE FROM index_metadata"), NULL))
 			wi_log_error(WI_STR("Could not execute database statement: %m"));
 		
-		if(!wi_sqlite3_execute_statement(wd_database, WI_STR("INSERT INTO index_metadata "
+		if(!wi_sqlite3_execute_statement(wd_index_database, WI_STR("INSERT INTO index_metadata "
 															 "(date, files_count, directories_count, files_size) "
 															 "VALUES "
 															 "(?, ?, ?, ?)"),
@@ -246,15 +671,23 @@ static void wd_index_thread(wi_runtime_instance_t *argument) {
 										 NULL)) {
 			wi_log_error(WI_STR("Could not execute database statement: %m"));
 		}
-		   
+		
+		wd_index_indexing = false;
+		
+		wi_lock_unlock(wd_index_journal_lock);
+		
+		if(wd_index_image_enabled)
+			wd_index_write_image();
+		
 		wi_release(wd_index_dictionary);
-			
+		
 		wd_broadcast_message(wd_server_info_message());
-			
+		
 		if(startup)
 			wd_trackers_register();
 		
 		wi_lock_unlock(wd_index_lock);
+		wi_lock_unlock(wd_index_pass_lock);
 	}
 	
 	wi_release(pool);
@@ -262,333 +695,2051 @@ static void wd_index_thread(wi_runtime_instance_t *argument) {
 
 
 
-static void wd_index_index_path(wi_string_t *path, wi_string_t *pathprefix) {
+/*
+	A pass is crawled by wd_index_threads workers that take directories off a
+	shared queue, stat and read them, and queue their subdirectories in turn.
+	They never write to the database; each directory that needs changes is
+	handed to the index thread, which applies them in batched transactions.
+*/
+
+static void wd_index_crawl(wi_string_t *path) {
 	wi_pool_t					*pool;
-	wi_fsenumerator_t			*fsenumerator;
-	wi_string_t					*filepath, *virtualpath, *resolvedpath, *newpathprefix;
-	wi_mutable_set_t			*set;
-	wi_number_t					*number;
-	wi_fs_stat_t				sb, lsb;
-	wi_fsenumerator_status_t	status;
-	wi_uinteger_t				i = 0, pathlength;
-	wi_boolean_t				alias, recurse;
+	wi_enumerator_t				*enumerator;
+	wi_array_t					*diffs;
+	wd_index_directory_t		*directory;
+	wi_uinteger_t				i, workers;
+	wi_boolean_t				crawled;
 	
-	if(wd_index_level >= WD_INDEX_MAX_LEVEL) {
-		wi_log_warn(WI_STR("Skipping index of \"%@\": %s"),
-			path, "Directory too deep");
-		
-		return;
-	}
-
-	fsenumerator = wi_fs_enumerator_at_path(path);
-
-	if(!fsenumerator) {
-		wi_log_error(WI_STR("Could not open \"%@\": %m"), path);
-		
-		return;
+	wi_condition_lock_lock(wd_index_queue_lock);
+	wi_mutable_array_add_data(wd_index_queue, wd_index_directory_with_path(path, WI_STR(""), NULL, 0));
+	wd_index_running = 0;
+	wi_condition_lock_unlock_with_condition(wd_index_queue_lock, 1);
+	
+	wi_condition_lock_lock(wd_index_diffs_lock);
+	wd_index_crawled = false;
+	wi_condition_lock_unlock_with_condition(wd_index_diffs_lock, 0);
+	
+	for(i = workers = 0; i < wd_index_threads; i++) {
+		if(wi_thread_create_thread_with_priority(wd_index_crawl_thread, NULL, 0.0))
+			workers++;
+		else
+			wi_log_error(WI_STR("Could not create an index thread: %m"));
 	}
 	
+	if(workers == 0)
+		wd_index_crawl_thread(NULL);
+	
 	pool = wi_pool_init_with_debug(wi_pool_alloc(), false);
 	
-	pathlength = wi_string_length(path);
+	do {
+		wi_condition_lock_lock_when_condition(wd_index_diffs_lock, 1, 0.0);
+		
+		diffs			= wi_autorelease(wd_index_diffs);
+		wd_index_diffs	= wi_array_init(wi_mutable_array_alloc());
+		crawled			= wd_index_crawled;
+		
+		wi_condition_lock_unlock_with_condition(wd_index_diffs_lock, crawled ? 1 : 0);
+		
+		enumerator = wi_array_data_enumerator(diffs);
+		
+		while((directory = wi_enumerator_next_data(enumerator)))
+			wd_index_write_directory(directory);
+		
+		wi_pool_drain(pool);
+	} while(!crawled);
 	
-	if(pathlength == 1)
-		pathlength--;
+	wd_index_commit_transaction(true);
 	
-	wd_index_level++;
+	wi_release(pool);
+}
+
 
-	while((status = wi_fsenumerator_get_next_path(fsenumerator, &filepath)) != WI_FSENUMERATOR_EOF) {
-		if(status == WI_FSENUMERATOR_ERROR) {
-			wi_log_warn(WI_STR("Skipping index of \"%@\": %m"), filepath);
+
+static void wd_index_crawl_thread(wi_runtime_instance_t *argument) {
+	wi_pool_t					*pool;
+	wi_mutable_array_t			*directories;
+	wd_index_directory_t		*directory;
+	wi_uinteger_t				count;
+	wi_boolean_t				write, done;
+	
+	pool = wi_pool_init(wi_pool_alloc());
+	
+	while(true) {
+		wi_condition_lock_lock_when_condition(wd_index_queue_lock, 1, 0.0);
+		
+		count = wi_array_count(wd_index_queue);
+		
+		if(count == 0) {
+			/* the crawl is over, leave the condition set for the other workers */
+			wi_condition_lock_unlock_with_condition(wd_index_queue_lock, 1);
 			
-			continue;
+			break;
 		}
 		
-		if(wi_fs_path_is_invisible(filepath)) {
-			wi_fsenumerator_skip_descendents(fsenumerator);
-			
-			continue;
+		/* taking the newest directory keeps the walk depth first and the queue short */
+		directory = wi_autorelease(wi_retain(WI_ARRAY(wd_index_queue, count - 1)));
+		wi_mutable_array_remove_data_at_index(wd_index_queue, count - 1);
+		wd_index_running++;
+		
+		wi_condition_lock_unlock_with_condition(wd_index_queue_lock, (count > 1) ? 1 : 0);
+		
+		directories	= wi_mutable_array();
+		write		= wd_index_crawl_directory(directory, directories);
+		
+		if(write) {
+			wi_condition_lock_lock(wd_index_diffs_lock);
+			wi_mutable_array_add_data(wd_index_diffs, directory);
+			wi_condition_lock_unlock_with_condition(wd_index_diffs_lock, 1);
 		}
-
-		alias = wi_fs_path_is_alias(filepath);
 		
-		if(alias)
-			resolvedpath = wi_string_by_resolving_aliases_in_path(filepath);
-		else
-			resolvedpath = filepath;
+		wi_condition_lock_lock(wd_index_queue_lock);
 		
-		if(!wi_fs_lstat_path(resolvedpath, &lsb)) {
-			wi_log_warn(WI_STR("Skipping index of \"%@\": %m"), resolvedpath);
-			wi_fsenumerator_skip_descendents(fsenumerator);
-		} else {
-			if(!wi_fs_stat_path(resolvedpath, &sb))
-				sb = lsb;
-			
-			set = wi_dictionary_data_for_key(wd_index_dictionary, (void *) (intptr_t) lsb.dev);
-			
-			if(!set) {
-				set = wi_set_init_with_capacity(wi_mutable_set_alloc(), 1000, false);
-				wi_mutable_dictionary_set_data_for_key(wd_index_dictionary, set, (void *) (intptr_t) lsb.dev);
-				wi_release(set);
-			}
-			
-			number = wi_number_init_with_value(wi_number_alloc(), WI_NUMBER_INT64, &lsb.ino);
-			
-			if(!wi_set_contains_data(set, number)) {
-				wi_mutable_set_add_data(set, number);
-				
-				recurse = (alias && S_ISDIR(sb.mode));
-				
-				virtualpath	= wi_string_substring_from_index(filepath, pathlength);
-				
-				if(pathprefix)
-					virtualpath = wi_string_by_inserting_string_at_index(virtualpath, pathprefix, 0);
-				
-				if(!wi_sqlite3_execute_statement(wd_database, WI_STR("INSERT INTO `index` "
-																	 "(name, virtual_path, real_path, alias) "
-																	 "VALUES "
-																	 "(?, ?, ?, ?)"),
-												 wi_string_last_path_component(virtualpath),
-												 virtualpath,
-												 resolvedpath,
-												 wi_number_with_bool(alias),
-												 NULL)) {
-					wi_log_error(WI_STR("Could not execute database statement: %m"));
-				}
-				
-				if(S_ISDIR(sb.mode)) {
-					wd_index_directories_count++;
-				} else {
-					wd_index_files_count++;
-					wd_index_files_size += sb.size + wi_fs_resource_fork_size_for_path(resolvedpath);
-				}
-				
-				if(wd_files_type_with_stat(resolvedpath, &sb) == WD_FILE_TYPE_DROPBOX) {
-					wi_fsenumerator_skip_descendents(fsenumerator);
-				}
-				else if(recurse) {
-					if(pathprefix) {
-						newpathprefix = wi_string_by_appending_path_component(pathprefix,
-							wi_string_substring_from_index(filepath, pathlength + 1));
-					} else {
-						newpathprefix = wi_string_substring_from_index(filepath, pathlength);
-					}
-					
-					wd_index_index_path(resolvedpath, newpathprefix);
-				}
-			}
+		wi_mutable_array_add_data_from_array(wd_index_queue, directories);
+		wd_index_running--;
 		
-			wi_release(number);
+		done = (wd_index_running == 0 && wi_array_count(wd_index_queue) == 0);
+		
+		wi_condition_lock_unlock_with_condition(wd_index_queue_lock, (done || wi_array_count(wd_index_queue) > 0) ? 1 : 0);
+		
+		if(done) {
+			wi_condition_lock_lock(wd_index_diffs_lock);
+			wd_index_crawled = true;
+			wi_condition_lock_unlock_with_condition(wd_index_diffs_lock, 1);
 		}
-
-		if(++i % 100 == 0)
-			wi_pool_drain(pool);
+		
+		wi_pool_drain(pool);
 	}
 	
-	wd_index_level--;
-	
 	wi_release(pool);
 }
 
 
 
-#pragma mark -
-
-void wd_index_add_file(wi_string_t *path) {
-	wi_string_t			*virtualpath;
-	wi_uinteger_t		pathlength;
+static wi_boolean_t wd_index_crawl_directory(wd_index_directory_t *directory, wi_mutable_array_t *directories) {
+	wi_dictionary_t				*results;
+	wi_mutable_set_t			*set;
+	wi_number_t					*number;
+	wi_fs_stat_t				sb;
+	wi_boolean_t				visited, changed;
 	
-	if(wi_lock_trylock(wd_index_lock)) {
-		pathlength = wi_string_length(wd_files);
+	if(directory->level >= WD_INDEX_MAX_LEVEL) {
+		wi_log_warn(WI_STR("Skipping index of \"%@\": %s"),
+			directory->path, "Directory too deep");
 		
-		if(pathlength == 1)
-			pathlength--;
+		return false;
+	}
+	
+	if(!wi_fs_stat_path(directory->path, &sb)) {
+		wi_log_warn(WI_STR("Skipping index of \"%@\": %m"), directory->path);
 		
-		virtualpath	= wi_string_substring_from_index(path, pathlength);
-
-		if(!wi_sqlite3_execute_statement(wd_database, WI_STR("INSERT INTO `index` "
-															 "(name, virtual_path, real_path, alias) "
-															 "VALUES "
-															 "(?, ?, ?, ?)"),
-										 wi_string_last_path_component(virtualpath),
-										 virtualpath,
-										 path,
-										 wi_number_with_bool(false),
-										 NULL)) {
-			wi_log_error(WI_STR("Could not execute database statement: %m"));
-		}
+		return false;
+	}
+	
+	wi_lock_lock(wd_index_dictionary_lock);
+	
+	set = wi_dictionary_data_for_key(wd_index_dictionary, (void *) (intptr_t) sb.dev);
+	
+	if(!set) {
+		set = wi_set_init_with_capacity(wi_mutable_set_alloc(), 1000, false);
+		wi_mutable_dictionary_set_data_for_key(wd_index_dictionary, set, (void *) (intptr_t) sb.dev);
+		wi_release(set);
+	}
+	
+	number	= wi_number_init_with_value(wi_number_alloc(), WI_NUMBER_INT64, &sb.ino);
+	visited	= wi_set_contains_data(set, number);
+	
+	if(!visited) {
+		wi_mutable_set_add_data(set, number);
 		
-		wi_lock_unlock(wd_index_lock);
+		wd_index_directories_visited++;
 	}
-}
-
-
-
-void wd_index_delete_file(wi_string_t *path) {
-	if(wi_lock_trylock(wd_index_lock)) {
-		wi_log_info(WI_STR("DELETE FROM index WHERE real_path = %@"), path);
+	
+	wi_lock_unlock(wd_index_dictionary_lock);
+	
+	wi_release(number);
+	
+	if(visited)
+		return false;
+	
+	if(directory->parentpath && wd_files_type_with_stat(directory->path, &sb) == WD_FILE_TYPE_DROPBOX) {
+		/* keep the drop box listed so that it is rescanned once it stops being one */
+		directory->dropbox = true;
+		
+		return true;
+	}
+	
+	changed = wd_index_verify;
+	
+	if(!changed) {
+		results = wi_sqlite3_execute_statement(wd_index_database, WI_STR("SELECT inode, mtime FROM index_directories WHERE real_path = ?"),
+											   directory->path,
+											   NULL);
 		
-		if(!wi_sqlite3_execute_statement(wd_database, WI_STR("DELETE FROM `index` WHERE real_path = ?"), path, NULL))
+		if(!results) {
 			wi_log_error(WI_STR("Could not execute database statement: %m"));
+			
+			changed = true;
+		}
+		else if(wi_dictionary_count(results) == 0) {
+			changed = true;
+		}
+		else {
+			changed = ((uint64_t) wi_number_int64(wi_dictionary_data_for_key(results, WI_STR("inode"))) != (uint64_t) sb.ino ||
+					   (int64_t) wi_number_int64(wi_dictionary_data_for_key(results, WI_STR("mtime"))) != (int64_t) sb.mtime);
+		}
+	}
+	
+	/* an unchanged directory has the same entries, but its subdirectories still need a look */
+	if(!changed) {
+		wd_index_indexed_directories(directory, directories);
 		
-		wi_lock_unlock(wd_index_lock);
+		return false;
+	}
+	
+	if(!wd_index_read_directory(directory, &sb, directories)) {
+		wd_index_indexed_directories(directory, directories);
+		
+		return false;
 	}
+	
+	return true;
 }
 
 
 
-#pragma mark -
-
-wi_boolean_t wd_index_search(wi_string_t *query, wd_user_t *user, wi_p7_message_t *message) {
+static wi_boolean_t wd_index_read_directory(wd_index_directory_t *directory, wi_fs_stat_t *dsbp, wi_mutable_array_t *directories) {
+	wi_pool_t					*pool;
 	wi_sqlite3_statement_t		*statement;
 	wi_dictionary_t				*results;
-	wi_mutable_string_t			*string;
-	wi_p7_message_t				*reply;
-	wi_string_t					*accountpath, *virtualpath, *realpath;
-	wd_account_t				*account;
-	wd_files_privileges_t		*privileges;
+	wi_mutable_dictionary_t		*rows;
+	wi_enumerator_t				*enumerator;
+	wi_array_t					*row, *metadata;
+	wd_fswalker_t				*walker;
+	wd_fswalker_entry_t			*entry;
+	wi_string_t					*name, *filepath, *filevirtualpath, *resolvedpath;
 	wi_fs_stat_t				sb, lsb;
-	wi_file_offset_t			datasize, rsrcsize;
-	wi_uinteger_t				accountpathlength, directorycount, device;
-	wi_boolean_t				alias, readable, writable;
-	wd_file_type_t				type;
-	wd_file_label_t				label;
+	wd_fswalker_status_t		status;
+	wi_uinteger_t				i = 0;
+	wi_boolean_t				alias, statted;
 	
-	if(wi_lock_trylock(wd_index_lock)) {
-		account				= wd_user_account(user);
-		accountpath			= wd_account_files(account);
-		accountpathlength	= accountpath ? wi_string_length(accountpath) : 0;
-		string 				= wi_mutable_string();
-
-		wi_mutable_string_set_string(string, query);
-
-		if(accountpathlength == 1)
-			accountpathlength--;
-
-		// Seems using more than two times the wi_mutable_string_replace_string_with_string function causes memory troubles
-		// '%' character escaping is disabled for the moment, waiting for a fix
-		// wi_mutable_string_replace_string_with_string(string, WI_STR("\\"), WI_STR("\\\\"), 0);
-		// wi_mutable_string_replace_string_with_string(string, WI_STR("_"), WI_STR("\\_"), 0);
-		// wi_mutable_string_replace_string_with_string(string, WI_STR("%"), WI_STR("\\%"), 0);
-
-		if(accountpath) {
-			statement = wi_sqlite3_prepare_statement(wd_database,
-													 wi_string_with_format(WI_STR("SELECT name, virtual_path, real_path, alias "
-																				  "FROM `index` "
-																				  "WHERE name LIKE '%%%q%%' ESCAPE '\\' "
-																				  "AND virtual_path LIKE '%q%%' ESCAPE '\\'"),
-																		   query,
-																		   accountpath),
-													 NULL);
-		} else {
-			statement = wi_sqlite3_prepare_statement(wd_database,
-													 wi_string_with_format(WI_STR("SELECT name, virtual_path, real_path, alias "
-																				  "FROM `index` "
-																				  "WHERE name LIKE '%%%q%%' ESCAPE '\\'"),
-																		   query),
-													 NULL);
-		}
+	statement = wi_sqlite3_prepare_statement(wd_index_database, WI_STR("SELECT rowid, name, real_path, alias FROM `index` WHERE parent = ?"),
+											 directory->path,
+											 NULL);
+	
+	if(!statement) {
+		wi_log_error(WI_STR("Could not execute database statement: %m"));
 		
-		if(!statement) {
-			wi_log_error(WI_STR("Could not execute database statement: %m"));
-			wd_user_reply_internal_error(user, wi_error_string(), message);
-
-			wi_lock_unlock(wd_index_lock);
+		return false;
+	}
+	
+	rows = wi_mutable_dictionary();
+	
+	while((results = wi_sqlite3_fetch_statement_results(wd_index_database, statement)) && wi_dictionary_count(results) > 0) {
+		wi_mutable_dictionary_set_data_for_key(rows,
+			wi_array_with_data(wi_dictionary_data_for_key(results, WI_STR("rowid")),
+							   wi_dictionary_data_for_key(results, WI_STR("real_path")),
+							   wi_dictionary_data_for_key(results, WI_STR("alias")),
+							   NULL),
+			wi_dictionary_data_for_key(results, WI_STR("name")));
+	}
+	
+	if(!results) {
+		wi_log_error(WI_STR("Could not execute database statement: %m"));
+		
+		return false;
+	}
+	
+	walker = wd_fswalker_open(directory->path);
+	
+	if(!walker) {
+		wi_log_error(WI_STR("Could not open \"%@\": %m"), directory->path);
+		
+		return false;
+	}
+	
+	directory->deletions	= wi_array_init(wi_mutable_array_alloc());
+	directory->additions	= wi_array_init(wi_mutable_array_alloc());
+	directory->updates		= wi_array_init(wi_mutable_array_alloc());
+	
+	/* a directory modified within the last second may change again without its mtime moving */
+	if(dsbp->mtime < time(NULL) - 1) {
+		directory->inode = dsbp->ino;
+		directory->mtime = dsbp->mtime;
+	}
+	
+	pool = wi_pool_init_with_debug(wi_pool_alloc(), false);
+	
+	while((status = wd_fswalker_next(walker, &entry)) != WD_FSWALKER_EOF) {
+		if(status == WD_FSWALKER_ERROR) {
+			wi_log_warn(WI_STR("Skipping index of \"%s\": %m"), entry->path);
 			
-			return false;
+			continue;
 		}
 		
-		while((results = wi_sqlite3_fetch_statement_results(wd_database, statement)) && wi_dictionary_count(results) > 0) {
-			virtualpath		= wi_dictionary_data_for_key(results, WI_STR("virtual_path"));
-			realpath		= wi_dictionary_data_for_key(results, WI_STR("real_path"));
-			alias			= wi_number_bool(wi_dictionary_data_for_key(results, WI_STR("alias")));
-			
-			if(!wi_fs_lstat_path(realpath, &lsb))
-				continue;
+		/* subdirectories are queued on their own, so that unchanged ones are not read */
+		wd_fswalker_skip_descendents(walker);
+		
+		if(entry->name[0] == '.')
+			continue;
+		
+		filepath = wd_fswalker_entry_path(entry);
+		
+		if(wi_fs_path_is_invisible(filepath))
+			continue;
+		
+		alias = wi_fs_path_is_alias(filepath);
+		
+		if(alias) {
+			resolvedpath	= wi_string_by_resolving_aliases_in_path(filepath);
+			statted			= wi_fs_lstat_path(resolvedpath, &lsb);
 			
-			if(!wi_fs_stat_path(realpath, &sb))
+			if(statted && !wi_fs_stat_path(resolvedpath, &sb))
 				sb = lsb;
+		} else {
+			resolvedpath	= filepath;
+			statted			= wd_fswalker_stat_entry(walker, entry);
 			
-			type = wd_files_type_with_stat(realpath, &sb);
-			
-			switch(type) {
-				case WD_FILE_TYPE_DROPBOX:
-					privileges				= wd_files_drop_box_privileges(realpath);
-					readable				= wd_files_privileges_is_readable_by_account(privileges, account);
-					writable				= wd_files_privileges_is_writable_by_account(privileges, account);
-					datasize                = 0;
-					rsrcsize                = 0;
-					directorycount			= readable ? wd_files_count_path(realpath, NULL, NULL) : 0;
-					break;
-					
-				case WD_FILE_TYPE_DIR:
-				case WD_FILE_TYPE_UPLOADS:
-					readable				= true;
-					writable				= true;
-					datasize                = 0;
-					rsrcsize                = 0;
-					directorycount			= wd_files_count_path(realpath, NULL, NULL);
-					break;
-					
-				case WD_FILE_TYPE_FILE:
-				default:
-					readable				= true;
-					writable				= true;
-					datasize                = sb.size;
-					rsrcsize                = wi_fs_resource_fork_size_for_path(realpath);
-					directorycount			= 0;
-					break;
+			if(statted) {
+				lsb	= entry->lsb;
+				sb	= entry->sb;
 			}
+		}
+		
+		if(!statted) {
+			wi_log_warn(WI_STR("Skipping index of \"%@\": %m"), resolvedpath);
+			
+			continue;
+		}
+		
+		name			= wi_string_with_cstring(entry->name);
+		filevirtualpath	= wi_string_with_format(WI_STR("%@/%@"), directory->virtualpath, name);
+		metadata		= wd_index_metadata(resolvedpath, &sb, &lsb, alias);
+		row				= wi_dictionary_data_for_key(rows, name);
+		
+		if(row && wi_is_equal(WI_ARRAY(row, 1), resolvedpath)) {
+			/* the entry is still there, but its size, dates or metadata may not be */
+			wi_mutable_array_add_data(directory->updates, wi_array_with_data(WI_ARRAY(row, 0), metadata, NULL));
+			wi_mutable_dictionary_remove_data_for_key(rows, name);
+		} else {
+			wi_mutable_array_add_data(directory->additions,
+				wi_array_with_data(name, filevirtualpath, resolvedpath, wi_number_with_bool(alias), metadata, NULL));
+		}
+		
+		if(S_ISDIR(sb.mode)) {
+			directory->directoriescount++;
 			
-			if(sb.dev == wd_files_root_volume)
-				device = 0;
-			else
-				device = sb.dev;
-			
-			label = wd_files_label(realpath);
-			
-			if(accountpathlength > 0)
-				virtualpath = wi_string_substring_from_index(virtualpath, accountpathlength);
-			
-			reply = wi_p7_message_with_name(WI_STR("wired.file.search_list"), wd_p7_spec);
-			wi_p7_message_set_string_for_name(reply, virtualpath, WI_STR("wired.file.path"));
-			wi_p7_message_set_enum_for_name(reply, type, WI_STR("wired.file.type"));
-			wi_p7_message_set_date_for_name(reply, wi_date_with_time(sb.birthtime), WI_STR("wired.file.creation_time"));
-			wi_p7_message_set_date_for_name(reply, wi_date_with_time(sb.mtime), WI_STR("wired.file.modification_time"));
-			wi_p7_message_set_bool_for_name(reply, (alias || S_ISLNK(sb.mode)), WI_STR("wired.file.link"));
-			wi_p7_message_set_bool_for_name(reply, (type == WD_FILE_TYPE_FILE && sb.mode & 0111), WI_STR("wired.file.executable"));
-			wi_p7_message_set_enum_for_name(reply, label, WI_STR("wired.file.label"));
-			wi_p7_message_set_uint32_for_name(reply, device, WI_STR("wired.file.volume"));
-			
-			if(type == WD_FILE_TYPE_FILE) {
-				wi_p7_message_set_uint64_for_name(reply, datasize, WI_STR("wired.file.data_size"));
-				wi_p7_message_set_uint64_for_name(reply, rsrcsize, WI_STR("wired.file.rsrc_size"));
-			} else {
-				wi_p7_message_set_uint32_for_name(reply, directorycount, WI_STR("wired.file.directory_count"));
+			if(alias || S_ISDIR(lsb.mode)) {
+				wi_mutable_array_add_data(directories,
+					wd_index_directory_with_path(resolvedpath, filevirtualpath, directory->path, directory->level + 1));
 			}
+		} else {
+			directory->filescount++;
+			directory->filessize += wi_number_int64(WI_ARRAY(metadata, 1)) + wi_number_int64(WI_ARRAY(metadata, 2));
+		}
+		
+		if(++i % 100 == 0)
+			wi_pool_drain(pool);
+	}
+	
+	wd_fswalker_close(walker);
+	
+	/* whatever is left in rows has gone away since the last pass */
+	enumerator = wi_dictionary_data_enumerator(rows);
+	
+	while((row = wi_enumerator_next_data(enumerator)))
+		wi_mutable_array_add_data(directory->deletions, row);
+	
+	wi_release(pool);
+	
+	return true;
+}
+
+
+
+static void wd_index_indexed_directories(wd_index_directory_t *directory, wi_mutable_array_t *directories) {
+	wi_sqlite3_statement_t		*statement;
+	wi_dictionary_t				*results;
+	
+	statement = wi_sqlite3_prepare_statement(wd_index_database, WI_STR("SELECT real_path, virtual_path FROM index_directories WHERE parent = ?"),
+											 directory->path,
+											 NULL);
+	
+	if(!statement) {
+		wi_log_error(WI_STR("Could not execute database statement: %m"));
+		
+		return;
+	}
+	
+	while((results = wi_sqlite3_fetch_statement_results(wd_index_database, statement)) && wi_dictionary_count(results) > 0) {
+		wi_mutable_array_add_data(directories,
+			wd_index_directory_with_path(wi_dictionary_data_for_key(results, WI_STR("real_path")),
+										 wi_dictionary_data_for_key(results, WI_STR("virtual_path")),
+										 directory->path,
+										 directory->level + 1));
+	}
+	
+	if(!results)
+		wi_log_error(WI_STR("Could not execute database statement: %m"));
+}
+
+
+
+static void wd_index_write_directory(wd_index_directory_t *directory) {
+	wi_enumerator_t		*enumerator;
+	wi_array_t			*row, *metadata;
+	wi_string_t			*root;
+	
+	wd_index_begin_transaction();
+	
+	if(directory->dropbox) {
+		wd_index_delete_below_path(directory->path);
+	} else {
+		wd_index_directories_rescanned++;
+		
+		root = wi_string_by_appending_string(wi_string_by_resolving_aliases_in_path(wd_files), WI_STR("/"));
+		
+		enumerator = wi_array_data_enumerator(directory->deletions);
+		
+		while((row = wi_enumerator_next_data(enumerator))) {
+			if(!wi_sqlite3_execute_statement(wd_index_database, WI_STR("DELETE FROM `index` WHERE rowid = ?"), WI_ARRAY(row, 0), NULL))
+				wi_log_error(WI_STR("Could not execute database statement: %m"));
+			
+			/* an alias resolves to its target, which is only the alias's to prune when the share does not reach it on its own */
+			if(!wi_number_bool(WI_ARRAY(row, 2)) || !wi_string_has_prefix(WI_ARRAY(row, 1), root))
+				wd_index_delete_below_path(WI_ARRAY(row, 1));
+		}
+		
+		enumerator = wi_array_data_enumerator(directory->additions);
+		
+		while((row = wi_enumerator_next_data(enumerator))) {
+			metadata = WI_ARRAY(row, 4);
 			
-			if(type == WD_FILE_TYPE_DROPBOX) {
-				wi_p7_message_set_bool_for_name(reply, readable, WI_STR("wired.file.readable"));
-				wi_p7_message_set_bool_for_name(reply, writable, WI_STR("wired.file.writable"));
+			/* a subdirectory that already has state knows its count, otherwise it will be rescanned */
+			if(!wi_sqlite3_execute_statement(wd_index_database, WI_STR("INSERT INTO `index` "
+																 "(name, virtual_path, real_path, alias, parent, "
+																 "type, data_size, rsrc_size, directory_count, creation_time, "
+																 "modification_time, volume, label, executable, link) "
+																 "VALUES "
+																 "(?, ?, ?, ?, ?, ?, ?, ?, "
+																 "IFNULL((SELECT files_count + directories_count FROM index_directories WHERE real_path = ?), 0), "
+																 "?, ?, ?, ?, ?, ?)"),
+											 WI_ARRAY(row, 0),
+											 WI_ARRAY(row, 1),
+											 WI_ARRAY(row, 2),
+											 WI_ARRAY(row, 3),
+											 directory->path,
+											 WI_ARRAY(metadata, 0),
+											 WI_ARRAY(metadata, 1),
+											 WI_ARRAY(metadata, 2),
+											 WI_ARRAY(row, 2),
+											 WI_ARRAY(metadata, 3),
+											 WI_ARRAY(metadata, 4),
+											 WI_ARRAY(metadata, 5),
+											 WI_ARRAY(metadata, 6),
+											 WI_ARRAY(metadata, 7),
+											 WI_ARRAY(metadata, 8),
+											 NULL)) {
+				wi_log_error(WI_STR("Could not execute database statement: %m"));
 			}
+		}
+		
+		enumerator = wi_array_data_enumerator(directory->updates);
+		
+		while((row = wi_enumerator_next_data(enumerator))) {
+			metadata = WI_ARRAY(row, 1);
 			
-			wd_user_reply_message(user, reply, message);
+			if(!wi_sqlite3_execute_statement(wd_index_database, WI_STR("UPDATE `index` SET "
+																 "type = ?, data_size = ?, rsrc_size = ?, creation_time = ?, "
+																 "modification_time = ?, volume = ?, label = ?, executable = ?, link = ? "
+																 "WHERE rowid = ?"),
+											 WI_ARRAY(metadata, 0),
+											 WI_ARRAY(metadata, 1),
+											 WI_ARRAY(metadata, 2),
+											 WI_ARRAY(metadata, 3),
+											 WI_ARRAY(metadata, 4),
+											 WI_ARRAY(metadata, 5),
+											 WI_ARRAY(metadata, 6),
+											 WI_ARRAY(metadata, 7),
+											 WI_ARRAY(metadata, 8),
+											 WI_ARRAY(row, 0),
+											 NULL)) {
+				wi_log_error(WI_STR("Could not execute database statement: %m"));
+			}
 		}
 		
-		if(!results) {
-			wi_log_error(WI_STR("Could not execute database statement: %m"));
-			wd_user_reply_internal_error(user, wi_error_string(), message);
+		/* the directory's own row lives with its parent and carries its entry count */
+		if(directory->parentpath) {
+			if(!wi_sqlite3_execute_statement(wd_index_database, WI_STR("UPDATE `index` SET directory_count = ? "
+																 "WHERE real_path = ? AND parent = ?"),
+											 wi_number_with_integer(directory->filescount + directory->directoriescount),
+											 directory->path,
+											 directory->parentpath,
+											 NULL)) {
+				wi_log_error(WI_STR("Could not execute database statement: %m"));
+			}
+		}
+		
+		wd_index_transaction_changes += wi_array_count(directory->deletions) +
+										wi_array_count(directory->additions) +
+										wi_array_count(directory->updates);
+	}
+	
+	wd_index_bump_generation();
+	
+	if(!wi_sqlite3_execute_statement(wd_index_database, WI_STR("INSERT OR REPLACE INTO index_directories "
+														 "(real_path, virtual_path, parent, inode, mtime, files_count, directories_count, files_size) "
+														 "VALUES "
+														 "(?, ?, ?, ?, ?, ?, ?, ?)"),
+									 directory->path,
+									 directory->virtualpath,
+									 directory->parentpath ? directory->parentpath : wi_null(),
+									 wi_number_with_int64(directory->inode),
+									 wi_number_with_int64(directory->mtime),
+									 wi_number_with_integer(directory->filescount),
+									 wi_number_with_integer(directory->directoriescount),
+									 wi_number_with_int64(directory->filessize),
+									 NULL)) {
+		wi_log_error(WI_STR("Could not execute database statement: %m"));
+	}
+	
+	wd_index_commit_transaction(false);
+}
+
+
+
+static void wd_index_delete_below_path(wi_string_t *path) {
+	wi_string_t		*lowerpath, *upperpath;
+	
+	/* "/" sorts just before "0", so this range covers everything below path */
+	lowerpath = wi_string_by_appending_string(path, WI_STR("/"));
+	upperpath = wi_string_by_appending_string(path, WI_STR("0"));
+	
+	if(!wi_sqlite3_execute_statement(wd_index_database, WI_STR("DELETE FROM `index` WHERE real_path > ? AND real_path < ?"),
+									 lowerpath,
+									 upperpath,
+									 NULL)) {
+		wi_log_error(WI_STR("Could not execute database statement: %m"));
+	}
+	
+	if(!wi_sqlite3_execute_statement(wd_index_database, WI_STR("DELETE FROM index_directories "
+														 "WHERE real_path = ? OR (real_path > ? AND real_path < ?)"),
+									 path,
+									 lowerpath,
+									 upperpath,
+									 NULL)) {
+		wi_log_error(WI_STR("Could not execute database statement: %m"));
+	}
+}
+
+
+
+static wi_array_t * wd_index_metadata(wi_string_t *path, wi_fs_stat_t *sbp, wi_fs_stat_t *lsbp, wi_boolean_t alias) {
+	wi_file_offset_t	datasize, rsrcsize;
+	wd_file_type_t		type;
+	
+	type = wd_files_type_with_stat(path, sbp);
+	
+	if(type == WD_FILE_TYPE_FILE) {
+		datasize	= sbp->size;
+		rsrcsize	= wi_fs_resource_fork_size_for_path(path);
+	} else {
+		datasize	= 0;
+		rsrcsize	= 0;
+	}
+	
+	/* in the order of the metadata columns, less directory_count */
+	return wi_array_with_data(
+		WI_INT32(type),
+		wi_number_with_int64(datasize),
+		wi_number_with_int64(rsrcsize),
+		wi_number_with_int64(sbp->birthtime),
+		wi_number_with_int64(sbp->mtime),
+		wi_number_with_integer((sbp->dev == wd_files_root_volume) ? 0 : sbp->dev),
+		WI_INT32(wd_files_label(path)),
+		wi_number_with_bool(type == WD_FILE_TYPE_FILE && (sbp->mode & 0111)),
+		wi_number_with_bool(alias || S_ISLNK(lsbp->mode)),
+		NULL);
+}
+
 
-			wi_lock_unlock(wd_index_lock);
+
+static void wd_index_begin_transaction(void) {
+	if(!wd_index_transaction) {
+		/* without a transaction, every statement simply commits on its own */
+		if(!wi_sqlite3_begin_immediate_transaction(wd_index_database)) {
+			wi_log_error(WI_STR("Could not begin database transaction: %m"));
 			
-			return false;
+			return;
 		}
 		
+		wd_index_transaction			= true;
+		wd_index_transaction_changes	= 0;
+		wd_index_transaction_time		= wi_time_interval();
+	}
+}
+
+
+
+static void wd_index_commit_transaction(wi_boolean_t force) {
+	if(!wd_index_transaction)
+		return;
+	
+	/* small directories are many, so their changes are committed together, but other writers wait on the batch */
+	if(!force &&
+	   ++wd_index_transaction_changes < WD_INDEX_TRANSACTION_SIZE &&
+	   wi_time_interval() - wd_index_transaction_time < WD_INDEX_TRANSACTION_TIME)
+		return;
+	
+	/* a rolled back batch also loses its directory mtimes, so the next pass rescans those directories */
+	if(!wi_sqlite3_commit_transaction(wd_index_database)) {
+		wi_log_error(WI_STR("Could not commit database transaction: %m"));
+		
+		wi_sqlite3_rollback_transaction(wd_index_database);
+	}
+	
+	wd_index_transaction = false;
+}
+
+
+
+#pragma mark -
+
+static void wd_index_update_image(wi_timer_t *timer) {
+	if(!wi_thread_create_thread_with_priority(wd_index_image_thread, NULL, 0.0))
+		wi_log_error(WI_STR("Could not create an index image thread: %m"));
+}
+
+
+
+static void wd_index_image_thread(wi_runtime_instance_t *argument) {
+	wi_pool_t			*pool;
+	wi_array_t			*changes;
+	wd_indeximage_t		*image;
+	
+	pool = wi_pool_init(wi_pool_alloc());
+	
+	/* changes made from here on are not in the image, so they schedule another rebuild */
+	wi_lock_lock(wd_index_image_lock);
+	wd_index_image_pending = false;
+	wi_lock_unlock(wd_index_image_lock);
+	
+	/* a pass in progress writes a new image when it is done */
+	if(wi_lock_trylock(wd_index_lock)) {
+		image = wd_index_copy_image(&changes);
+		
+		if((!image || changes) && wd_index_image_enabled)
+			wd_index_write_image();
+		
+		wi_release(image);
+		
 		wi_lock_unlock(wd_index_lock);
 	}
 	
-	reply = wi_p7_message_with_name(WI_STR("wired.file.search_list.done"), wd_p7_spec);
-	wd_user_reply_message(user, reply, message);
+	wi_release(pool);
+}
+
+
+
+static wi_boolean_t wd_index_load_image(void) {
+	wd_indeximage_t		*image;
+	
+	image = wd_indeximage_init_with_path(wd_indeximage_alloc(),
+										 WI_STR(WD_INDEX_IMAGE_PATH),
+										 wi_string_by_resolving_aliases_in_path(wd_files));
+	
+	if(!image) {
+		if(wi_error_code() != ENOENT)
+			wi_log_warn(WI_STR("Could not open index image \"%s\": %m"), WD_INDEX_IMAGE_PATH);
+		
+		return false;
+	}
+	
+	wd_index_set_image(image);
+	
+	wi_log_info(WI_STR("Loaded index image of %u %s"),
+		wd_indeximage_count(image),
+		wd_indeximage_count(image) == 1
+			? "entry"
+			: "entries");
+	
+	wi_release(image);
 	
 	return true;
-}
\ No newline at end of file
+}
+
+
+
+static void wd_index_write_image(void) {
+	wi_pool_t					*pool;
+	wi_sqlite3_statement_t		*statement;
+	wi_dictionary_t				*results;
+	wi_string_t					*root;
+	wd_indeximage_builder_t		*builder;
+	wd_indeximage_entry_t		entry;
+	wd_indeximage_t				*image;
+	wi_time_interval_t			interval;
+	wi_uinteger_t				generation, count = 0;
+	
+	wi_lock_lock(wd_index_journal_lock);
+	generation = wd_index_generation;
+	wi_lock_unlock(wd_index_journal_lock);
+	
+	interval	= wi_time_interval();
+	root		= wi_string_by_resolving_aliases_in_path(wd_files);
+	statement	= wi_sqlite3_prepare_statement(wd_index_database, WI_STR("SELECT rowid, name, virtual_path, real_path, alias, "
+																   "type, data_size, rsrc_size, directory_count, creation_time, "
+																   "modification_time, volume, label, executable, link "
+																   "FROM `index` "
+																   "ORDER BY virtual_path"),
+											   NULL);
+	
+	if(!statement) {
+		wi_log_error(WI_STR("Could not execute database statement: %m"));
+		
+		return;
+	}
+	
+	builder	= wd_indeximage_builder_open();
+	pool	= wi_pool_init_with_debug(wi_pool_alloc(), false);
+	
+	while((results = wi_sqlite3_fetch_statement_results(wd_index_database, statement)) && wi_dictionary_count(results) > 0) {
+		entry.rowid				= wi_number_integer(wi_dictionary_data_for_key(results, WI_STR("rowid")));
+		entry.name				= wi_string_cstring(wi_dictionary_data_for_key(results, WI_STR("name")));
+		entry.path				= wi_string_cstring(wi_dictionary_data_for_key(results, WI_STR("virtual_path")));
+		entry.realpath			= wi_string_cstring(wi_dictionary_data_for_key(results, WI_STR("real_path")));
+		entry.alias				= wi_number_bool(wi_dictionary_data_for_key(results, WI_STR("alias")));
+		entry.type				= wi_number_int32(wi_dictionary_data_for_key(results, WI_STR("type")));
+		entry.datasize			= wi_number_int64(wi_dictionary_data_for_key(results, WI_STR("data_size")));
+		entry.rsrcsize			= wi_number_int64(wi_dictionary_data_for_key(results, WI_STR("rsrc_size")));
+		entry.directorycount	= wi_number_integer(wi_dictionary_data_for_key(results, WI_STR("directory_count")));
+		entry.creationtime		= wi_number_int64(wi_dictionary_data_for_key(results, WI_STR("creation_time")));
+		entry.modificationtime	= wi_number_int64(wi_dictionary_data_for_key(results, WI_STR("modification_time")));
+		entry.volume			= wi_number_integer(wi_dictionary_data_for_key(results, WI_STR("volume")));
+		entry.label				= wi_number_int32(wi_dictionary_data_for_key(results, WI_STR("label")));
+		entry.executable		= wi_number_bool(wi_dictionary_data_for_key(results, WI_STR("executable")));
+		entry.link				= wi_number_bool(wi_dictionary_data_for_key(results, WI_STR("link")));
+		
+		wd_indeximage_builder_add(builder, &entry);
+		
+		if(++count % 100 == 0)
+			wi_pool_drain(pool);
+	}
+	
+	wi_release(pool);
+	
+	if(!results) {
+		wi_log_error(WI_STR("Could not execute database statement: %m"));
+		wd_indeximage_builder_close(builder);
+		
+		return;
+	}
+	
+	if(!wd_indeximage_builder_write(builder, WI_STR(WD_INDEX_IMAGE_PATH), root)) {
+		wi_log_error(WI_STR("Could not write index image \"%s\": %m"), WD_INDEX_IMAGE_PATH);
+		wd_indeximage_builder_close(builder);
+		
+		return;
+	}
+	
+	wd_indeximage_builder_close(builder);
+	
+	image = wd_indeximage_init_with_path(wd_indeximage_alloc(), WI_STR(WD_INDEX_IMAGE_PATH), root);
+	
+	if(!image) {
+		wi_log_error(WI_STR("Could not open index image \"%s\": %m"), WD_INDEX_IMAGE_PATH);
+		
+		return;
+	}
+	
+	/* a change that went straight to the database while this image was built is not in it */
+	wi_lock_lock(wd_index_journal_lock);
+	
+	if(generation == wd_index_generation) {
+		wd_index_set_image(image);
+		
+		wi_log_info(WI_STR("Wrote index image of %u %s in %.2f seconds"),
+			count,
+			count == 1
+				? "entry"
+				: "entries",
+			wi_time_interval() - interval);
+	} else {
+		wi_fs_delete_path(WI_STR(WD_INDEX_IMAGE_PATH));
+	}
+	
+	wi_lock_unlock(wd_index_journal_lock);
+	
+	wi_release(image);
+}
+
+
+
+static void wd_index_invalidate_image(void) {
+	wi_boolean_t		pending;
+	
+	/* the mapping stays in use with its changed rows taken from the database, but the file must not be loaded on restart */
+	if(wd_index_image_enabled) {
+		wi_fs_delete_path(WI_STR(WD_INDEX_IMAGE_PATH));
+		
+		/* a steady trickle of changes must not keep pushing the rebuild out, nor rewrite the image every few seconds */
+		wi_lock_lock(wd_index_image_lock);
+		pending = wd_index_image_pending;
+		wd_index_image_pending = true;
+		wi_lock_unlock(wd_index_image_lock);
+		
+		if(!pending)
+			wi_timer_reschedule(wd_index_image_timer, WD_INDEX_IMAGE_REBUILD_DELAY);
+	}
+}
+
+
+
+static void wd_index_note_image_changes(wi_string_t *path) {
+	wi_sqlite3_statement_t		*statement;
+	wi_enumerator_t				*enumerator;
+	wi_dictionary_t				*results;
+	wi_mutable_array_t			*rowids;
+	wi_number_t					*rowid;
+	wd_indeximage_t				*image;
+	wi_boolean_t				overflow;
+	
+	image = wd_index_copy_image(NULL);
+	
+	if(!image)
+		return;
+	
+	wi_release(image);
+	
+	/* the rows at and below path, their rowids survive a move so the image copies are skipped by rowid */
+	rowids		= wi_mutable_array();
+	statement	= wi_sqlite3_prepare_statement(wd_index_database, WI_STR("SELECT rowid FROM `index` "
+																   "WHERE real_path = ? OR (real_path > ? AND real_path < ?) "
+																   "LIMIT ?"),
+											   path,
+											   wi_string_by_appending_string(path, WI_STR("/")),
+											   wi_string_by_appending_string(path, WI_STR("0")),
+											   wi_number_with_integer(WD_INDEX_IMAGE_MAX_CHANGES + 1),
+											   NULL);
+	
+	if(statement) {
+		while((results = wi_sqlite3_fetch_statement_results(wd_index_database, statement)) && wi_dictionary_count(results) > 0)
+			wi_mutable_array_add_data(rowids, wi_dictionary_data_for_key(results, WI_STR("rowid")));
+	}
+	
+	if(!statement || !results) {
+		wi_log_error(WI_STR("Could not execute database statement: %m"));
+		
+		overflow = true;
+	} else {
+		wi_lock_lock(wd_index_image_lock);
+		
+		enumerator = wi_array_data_enumerator(rowids);
+		
+		while((rowid = wi_enumerator_next_data(enumerator)))
+			wi_mutable_set_add_data(wd_index_image_changes, rowid);
+		
+		overflow = (wi_set_count(wd_index_image_changes) > WD_INDEX_IMAGE_MAX_CHANGES);
+		wi_lock_unlock(wd_index_image_lock);
+	}
+	
+	/* past a few thousand rows the database answers searches until the scheduled rebuild */
+	if(overflow)
+		wd_index_set_image(NULL);
+}
+
+
+
+static wd_indeximage_t * wd_index_copy_image(wi_array_t **changes) {
+	wd_indeximage_t		*image;
+	
+	wi_lock_lock(wd_index_image_lock);
+	image = wi_retain(wd_index_image);
+	
+	if(changes)
+		*changes = (image && wi_set_count(wd_index_image_changes) > 0) ? wi_set_all_data(wd_index_image_changes) : NULL;
+	
+	wi_lock_unlock(wd_index_image_lock);
+	
+	return image;
+}
+
+
+
+static void wd_index_set_image(wd_indeximage_t *image) {
+	wd_indeximage_t		*previous;
+	
+	/* a new image holds every change so far, and without one there is nothing to correct */
+	wi_lock_lock(wd_index_image_lock);
+	previous = wd_index_image;
+	wd_index_image = wi_retain(image);
+	wi_mutable_set_remove_all_data(wd_index_image_changes);
+	wi_lock_unlock(wd_index_image_lock);
+	
+	/* searches still running hold their own reference to the old mapping */
+	wi_release(previous);
+}
+
+
+
+#pragma mark -
+
+void wd_index_add_file(wi_string_t *path) {
+	wd_index_change(WD_INDEX_ADD_FILE, path, NULL);
+}
+
+
+
+void wd_index_delete_file(wi_string_t *path) {
+	wd_index_change(WD_INDEX_DELETE_FILE, path, NULL);
+}
+
+
+
+void wd_index_delete_files(wi_string_t *path) {
+	wd_index_change(WD_INDEX_DELETE_FILES, path, NULL);
+}
+
+
+
+void wd_index_move_files(wi_string_t *frompath, wi_string_t *topath) {
+	wd_index_change(WD_INDEX_MOVE_FILES, frompath, topath);
+}
+
+
+
+void wd_index_invalidate_directory(wi_string_t *path) {
+	/* a hint only, the next pass rereads the directory whatever its mtime says */
+	if(!wi_sqlite3_execute_statement(wd_index_database, WI_STR("UPDATE index_directories SET mtime = 0 WHERE real_path = ?"), path, NULL))
+		wi_log_error(WI_STR("Could not execute database statement: %m"));
+}
+
+
+
+#pragma mark -
+
+static void wd_index_change(wd_index_change_t change, wi_string_t *path, wi_string_t *topath) {
+	wi_lock_lock(wd_index_journal_lock);
+	
+	if(wd_index_indexing) {
+		wi_mutable_array_add_data(wd_index_journal, wi_array_with_data(WI_INT32(change), path, topath, NULL));
+	} else {
+		/* removed and moved rows are noted before they go, added ones once they exist */
+		if(change != WD_INDEX_ADD_FILE)
+			wd_index_note_image_changes(path);
+		
+		wd_index_apply_change(change, path, topath);
+		
+		if(change == WD_INDEX_ADD_FILE)
+			wd_index_note_image_changes(path);
+		
+		wd_index_invalidate_image();
+	}
+	
+	wi_lock_unlock(wd_index_journal_lock);
+}
+
+
+
+static void wd_index_apply_change(wd_index_change_t change, wi_string_t *path, wi_string_t *topath) {
+	wd_index_bump_generation();
+	
+	/* the rows and the totals they add up to change together */
+	wd_index_begin_transaction();
+	
+	switch(change) {
+		case WD_INDEX_ADD_FILE:
+			wd_index_apply_add_file(path);
+			break;
+			
+		case WD_INDEX_DELETE_FILE:
+			wd_index_apply_delete_file(path);
+			break;
+			
+		case WD_INDEX_DELETE_FILES:
+			wd_index_apply_delete_files(path);
+			break;
+			
+		case WD_INDEX_MOVE_FILES:
+			wd_index_apply_move_files(path, topath);
+			break;
+	}
+	
+	wd_index_write_counts();
+	wd_index_commit_transaction(true);
+}
+
+
+
+static void wd_index_apply_add_file(wi_string_t *path) {
+	wi_string_t			*virtualpath, *parentpath;
+	wi_array_t			*metadata;
+	wi_fs_stat_t		sb, lsb;
+	wi_uinteger_t		pathlength;
+	wi_integer_t		files, directories;
+	int64_t				size;
+	
+	if(!wi_fs_lstat_path(path, &lsb))
+		return;
+	
+	if(!wi_fs_stat_path(path, &sb))
+		sb = lsb;
+	
+	pathlength = wi_string_length(wd_files);
+	
+	if(pathlength == 1)
+		pathlength--;
+	
+	/* a replayed addition may already have been picked up by the pass */
+	if(wd_index_entry_counts(path, &files, &directories, &size))
+		return;
+	
+	virtualpath	= wi_string_substring_from_index(path, pathlength);
+	parentpath	= wi_string_by_deleting_last_path_component(path);
+	metadata	= wd_index_metadata(path, &sb, &lsb, false);
+	
+	if(!wi_sqlite3_execute_statement(wd_index_database, WI_STR("INSERT INTO `index` "
+														 "(name, virtual_path, real_path, alias, parent, "
+														 "type, data_size, rsrc_size, creation_time, "
+														 "modification_time, volume, label, executable, link) "
+														 "VALUES "
+														 "(?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)"),
+									 wi_string_last_path_component(virtualpath),
+									 virtualpath,
+									 path,
+									 wi_number_with_bool(false),
+									 parentpath,
+									 WI_ARRAY(metadata, 0),
+									 WI_ARRAY(metadata, 1),
+									 WI_ARRAY(metadata, 2),
+									 WI_ARRAY(metadata, 3),
+									 WI_ARRAY(metadata, 4),
+									 WI_ARRAY(metadata, 5),
+									 WI_ARRAY(metadata, 6),
+									 WI_ARRAY(metadata, 7),
+									 WI_ARRAY(metadata, 8),
+									 NULL)) {
+		wi_log_error(WI_STR("Could not execute database statement: %m"));
+		
+		return;
+	}
+	
+	if(wi_number_int32(WI_ARRAY(metadata, 0)) == WD_FILE_TYPE_FILE) {
+		wd_index_adjust_counts(parentpath, 1, 0,
+			wi_number_int64(WI_ARRAY(metadata, 1)) + wi_number_int64(WI_ARRAY(metadata, 2)));
+	} else {
+		/* give the new directory counts of its own so that additions below it are counted, a zero mtime still has the pass read it */
+		if(S_ISDIR(lsb.mode)) {
+			if(!wi_sqlite3_execute_statement(wd_index_database, WI_STR("INSERT OR IGNORE INTO index_directories "
+																 "(real_path, virtual_path, parent, inode, mtime, files_count, directories_count, files_size) "
+																 "VALUES "
+																 "(?, ?, ?, ?, 0, 0, 0, 0)"),
+											 path,
+											 virtualpath,
+											 parentpath,
+											 wi_number_with_int64(sb.ino),
+											 NULL)) {
+				wi_log_error(WI_STR("Could not execute database statement: %m"));
+			}
+		}
+		
+		wd_index_adjust_counts(parentpath, 0, 1, 0);
+	}
+}
+
+
+
+static void wd_index_apply_delete_file(wi_string_t *path) {
+	wi_integer_t		files, directories;
+	int64_t				size;
+	
+	if(!wd_index_entry_counts(path, &files, &directories, &size))
+		return;
+	
+	if(!wi_sqlite3_execute_statement(wd_index_database, WI_STR("DELETE FROM `index` WHERE real_path = ?"), path, NULL)) {
+		wi_log_error(WI_STR("Could not execute database statement: %m"));
+		
+		return;
+	}
+	
+	wd_index_adjust_counts(wi_string_by_deleting_last_path_component(path), -files, -directories, -size);
+}
+
+
+
+static void wd_index_apply_delete_files(wi_string_t *path) {
+	wi_dictionary_t		*results;
+	wi_integer_t		files, directories;
+	int64_t				size;
+	
+	if(wd_index_entry_counts(path, &files, &directories, &size))
+		wd_index_adjust_counts(wi_string_by_deleting_last_path_component(path), -files, -directories, -size);
+	
+	/* "/" sorts just before "0", so this range covers everything below path */
+	results = wi_sqlite3_execute_statement(wd_index_database, WI_STR("SELECT IFNULL(SUM(files_count), 0) AS files_count, "
+															   "IFNULL(SUM(directories_count), 0) AS directories_count, "
+															   "IFNULL(SUM(files_size), 0) AS files_size "
+															   "FROM index_directories "
+															   "WHERE real_path = ? OR (real_path > ? AND real_path < ?)"),
+										   path,
+										   wi_string_by_appending_string(path, WI_STR("/")),
+										   wi_string_by_appending_string(path, WI_STR("0")),
+										   NULL);
+	
+	if(!results)
+		wi_log_error(WI_STR("Could not execute database statement: %m"));
+	
+	if(!wi_sqlite3_execute_statement(wd_index_database, WI_STR("DELETE FROM `index` "
+														 "WHERE real_path = ? OR (real_path > ? AND real_path < ?)"),
+									 path,
+									 wi_string_by_appending_string(path, WI_STR("/")),
+									 wi_string_by_appending_string(path, WI_STR("0")),
+									 NULL)) {
+		wi_log_error(WI_STR("Could not execute database statement: %m"));
+	}
+	
+	if(!wi_sqlite3_execute_statement(wd_index_database, WI_STR("DELETE FROM index_directories "
+														 "WHERE real_path = ? OR (real_path > ? AND real_path < ?)"),
+									 path,
+									 wi_string_by_appending_string(path, WI_STR("/")),
+									 wi_string_by_appending_string(path, WI_STR("0")),
+									 NULL)) {
+		wi_log_error(WI_STR("Could not execute database statement: %m"));
+		
+		return;
+	}
+	
+	/* the directory rows that went away took their share of the totals with them */
+	if(results && wi_dictionary_count(results) > 0) {
+		wd_index_adjust_counts(NULL,
+			-wi_number_integer(wi_dictionary_data_for_key(results, WI_STR("files_count"))),
+			-wi_number_integer(wi_dictionary_data_for_key(results, WI_STR("directories_count"))),
+			-wi_number_int64(wi_dictionary_data_for_key(results, WI_STR("files_size"))));
+	}
+}
+
+
+
+static void wd_index_apply_move_files(wi_string_t *frompath, wi_string_t *topath) {
+	wi_string_t			*fromvirtualpath, *tovirtualpath;
+	wi_uinteger_t		pathlength;
+	wi_integer_t		files, directories;
+	int64_t				size;
+	wi_boolean_t		counted;
+	
+	pathlength = wi_string_length(wd_files);
+	
+	if(pathlength == 1)
+		pathlength--;
+	
+	fromvirtualpath		= wi_string_substring_from_index(frompath, pathlength);
+	tovirtualpath		= wi_string_substring_from_index(topath, pathlength);
+	counted				= wd_index_entry_counts(frompath, &files, &directories, &size);
+	
+	/* rewrite the moved entry and everything below it in one statement */
+	if(!wi_sqlite3_execute_statement(wd_index_database, WI_STR("UPDATE `index` SET "
+														 "name = CASE WHEN real_path = ? THEN ? ELSE name END, "
+														 "virtual_path = ? || substr(virtual_path, length(?) + 1), "
+														 "real_path = ? || substr(real_path, length(?) + 1), "
+														 "parent = CASE WHEN real_path = ? THEN ? ELSE ? || substr(parent, length(?) + 1) END "
+														 "WHERE real_path = ? OR (real_path > ? AND real_path < ?)"),
+									 frompath,
+									 wi_string_last_path_component(topath),
+									 tovirtualpath,
+									 fromvirtualpath,
+									 topath,
+									 frompath,
+									 frompath,
+									 wi_string_by_deleting_last_path_component(topath),
+									 topath,
+									 frompath,
+									 frompath,
+									 wi_string_by_appending_string(frompath, WI_STR("/")),
+									 wi_string_by_appending_string(frompath, WI_STR("0")),
+									 NULL)) {
+		wi_log_error(WI_STR("Could not execute database statement: %m"));
+	}
+	
+	/* moved directories keep their state, so the next pass need not reread them */
+	if(!wi_sqlite3_execute_statement(wd_index_database, WI_STR("UPDATE index_directories SET "
+														 "virtual_path = ? || substr(virtual_path, length(?) + 1), "
+														 "real_path = ? || substr(real_path, length(?) + 1), "
+														 "parent = CASE WHEN real_path = ? THEN ? ELSE ? || substr(parent, length(?) + 1) END "
+														 "WHERE real_path = ? OR (real_path > ? AND real_path < ?)"),
+									 tovirtualpath,
+									 fromvirtualpath,
+									 topath,
+									 frompath,
+									 frompath,
+									 wi_string_by_deleting_last_path_component(topath),
+									 topath,
+									 frompath,
+									 frompath,
+									 wi_string_by_appending_string(frompath, WI_STR("/")),
+									 wi_string_by_appending_string(frompath, WI_STR("0")),
+									 NULL)) {
+		wi_log_error(WI_STR("Could not execute database statement: %m"));
+	}
+	
+	/* the subtree keeps its directory rows, only the entry itself changes parents */
+	if(counted) {
+		wd_index_adjust_counts(wi_string_by_deleting_last_path_component(frompath), -files, -directories, -size);
+		wd_index_adjust_counts(wi_string_by_deleting_last_path_component(topath), files, directories, size);
+	}
+}
+
+
+
+#pragma mark -
+
+static wi_boolean_t wd_index_entry_counts(wi_string_t *path, wi_integer_t *files, wi_integer_t *directories, int64_t *size) {
+	wi_dictionary_t		*results;
+	
+	results = wi_sqlite3_execute_statement(wd_index_database, WI_STR("SELECT type, data_size + rsrc_size AS size FROM `index` WHERE real_path = ?"),
+										   path,
+										   NULL);
+	
+	if(!results) {
+		wi_log_error(WI_STR("Could not execute database statement: %m"));
+		
+		return false;
+	}
+	
+	if(wi_dictionary_count(results) == 0)
+		return false;
+	
+	/* counted the way a pass counts its directories */
+	if(wi_number_int32(wi_dictionary_data_for_key(results, WI_STR("type"))) == WD_FILE_TYPE_FILE) {
+		*files			= 1;
+		*directories	= 0;
+		*size			= wi_number_int64(wi_dictionary_data_for_key(results, WI_STR("size")));
+	} else {
+		*files			= 0;
+		*directories	= 1;
+		*size			= 0;
+	}
+	
+	return true;
+}
+
+
+
+static void wd_index_adjust_counts(wi_string_t *parentpath, wi_integer_t files, wi_integer_t directories, int64_t size) {
+	wi_dictionary_t		*results;
+	
+	if(files == 0 && directories == 0 && size == 0)
+		return;
+	
+	/* the totals are the sum of the directory rows, an entry whose parent has none counts once the pass gets there */
+	if(parentpath) {
+		results = wi_sqlite3_execute_statement(wd_index_database, WI_STR("SELECT 1 FROM index_directories WHERE real_path = ?"),
+											   parentpath,
+											   NULL);
+		
+		if(!results) {
+			wi_log_error(WI_STR("Could not execute database statement: %m"));
+			
+			return;
+		}
+		
+		if(wi_dictionary_count(results) == 0)
+			return;
+		
+		if(!wi_sqlite3_execute_statement(wd_index_database, WI_STR("UPDATE index_directories SET "
+															 "files_count = files_count + ?, "
+															 "directories_count = directories_count + ?, "
+															 "files_size = files_size + ? "
+															 "WHERE real_path = ?"),
+										 wi_number_with_integer(files),
+										 wi_number_with_integer(directories),
+										 wi_number_with_int64(size),
+										 parentpath,
+										 NULL)) {
+			wi_log_error(WI_STR("Could not execute database statement: %m"));
+			
+			return;
+		}
+	}
+	
+	wd_index_files_count		+= files;
+	wd_index_directories_count	+= directories;
+	wd_index_files_size			+= size;
+}
+
+
+
+static void wd_index_write_counts(void) {
+	/* the date stays that of the last pass, it decides when the next one is due */
+	if(!wi_sqlite3_execute_statement(wd_index_database, WI_STR("UPDATE index_metadata SET "
+														 "files_count = ?, directories_count = ?, files_size = ?"),
+									 wi_number_with_integer(wd_index_files_count),
+									 wi_number_with_integer(wd_index_directories_count),
+									 wi_number_with_int64(wd_index_files_size),
+									 NULL)) {
+		wi_log_error(WI_STR("Could not execute database statement: %m"));
+	}
+}
+
+
+
+#pragma mark -
+
+static wd_index_directory_t * wd_index_directory_with_path(wi_string_t *path, wi_string_t *virtualpath, wi_string_t *parentpath, wi_uinteger_t level) {
+	wd_index_directory_t		*directory;
+	
+	directory				= wi_runtime_create_instance(wd_index_directory_runtime_id, sizeof(wd_index_directory_t));
+	directory->path			= wi_retain(path);
+	directory->virtualpath	= wi_retain(virtualpath);
+	directory->parentpath	= wi_retain(parentpath);
+	directory->level		= level;
+	
+	return wi_autorelease(directory);
+}
+
+
+
+static void wd_index_directory_dealloc(wi_runtime_instance_t *instance) {
+	wd_index_directory_t		*directory = instance;
+	
+	wi_release(directory->path);
+	wi_release(directory->virtualpath);
+	wi_release(directory->parentpath);
+	wi_release(directory->deletions);
+	wi_release(directory->additions);
+	wi_release(directory->updates);
+}
+
+
+
+#pragma mark -
+
+static wi_string_t * wd_index_like_pattern(wi_string_t *string, wi_boolean_t suffix) {
+	wi_string_t		*pattern;
+	const char		*cstring;
+	char			*buffer;
+	wi_uinteger_t	i, length;
+	
+	cstring		= wi_string_cstring(string);
+	buffer		= wi_malloc((strlen(cstring) * 2) + 3);
+	length		= 0;
+	
+	buffer[length++] = '%';
+	
+	for(i = 0; cstring[i]; i++) {
+		if(cstring[i] == '\\' || cstring[i] == '%' || cstring[i] == '_')
+			buffer[length++] = '\\';
+		
+		buffer[length++] = cstring[i];
+	}
+	
+	if(!suffix)
+		buffer[length++] = '%';
+	
+	buffer[length] = '\0';
+	
+	pattern = wi_string_with_cstring(buffer);
+	
+	wi_free(buffer);
+	
+	return pattern;
+}
+
+
+
+static wi_uinteger_t wd_index_character_count(wi_string_t *string) {
+	const char		*cstring;
+	wi_uinteger_t	i, count;
+	
+	cstring	= wi_string_cstring(string);
+	count	= 0;
+	
+	/* continuation bytes of UTF-8 sequences don't start a character */
+	for(i = 0; cstring[i]; i++) {
+		if((cstring[i] & 0xC0) != 0x80)
+			count++;
+	}
+	
+	return count;
+}
+
+
+
+wi_boolean_t wd_index_search(wi_string_t *query, wd_user_t *user, wi_p7_message_t *message) {
+	wi_p7_message_t				*reply;
+	wi_string_t					*accountpath, *cursor, *key;
+	wi_enumerator_t				*enumerator;
+	wi_array_t					*entry, *hits, *hit, *changes;
+	wd_indeximage_t				*image;
+	wd_index_search_t			search;
+	wi_integer_t				rowid, start;
+	wi_uinteger_t				i;
+	uint32_t					clientlimit;
+	wi_boolean_t				result = true;
+	
+	memset(&search, 0, sizeof(search));
+	
+	search.user					= user;
+	search.account				= wd_user_account(user);
+	accountpath					= wd_account_files(search.account);
+	search.accountpathlength	= accountpath ? wi_string_length(accountpath) : 0;
+
+	if(search.accountpathlength == 1)
+		search.accountpathlength--;
+	
+	search.limit = wd_index_search_limit;
+	
+	if(wi_p7_message_get_uint32_for_name(message, &clientlimit, WI_STR("wired.file.search_limit")) && clientlimit > 0) {
+		if(search.limit == 0 || clientlimit < search.limit)
+			search.limit = clientlimit;
+	}
+	
+	/* the cursor is the rowid of the last result replied, results come in rowid order */
+	cursor				= wi_p7_message_string_for_name(message, WI_STR("wired.file.search_cursor"));
+	search.lastrowid	= cursor ? wi_string_integer(cursor) : 0;
+	
+	/* an empty query lists everything that passes the filters, so there must be some */
+	if(!wd_index_search_filter(&search, message) && wi_string_length(query) == 0) {
+		wd_user_reply_error(user, WI_STR("wired.error.invalid_message"), message);
+		
+		return false;
+	}
+	
+	/* hits checked against the file system are never reused */
+	key		= wd_index_verify_search ? NULL : wd_index_cache_key(&search, query, search.accountpathlength > 0 ? accountpath : NULL);
+	entry	= key ? wd_index_cache_entry(key) : NULL;
+	
+	if(entry) {
+		hits				= WI_ARRAY(entry, 0);
+		search.truncated	= wi_number_bool(WI_ARRAY(entry, 1));
+		search.lastrowid	= wi_number_integer(WI_ARRAY(entry, 2));
+	} else {
+		search.hits			= wi_mutable_array();
+		search.interval		= wi_time_interval();
+		
+		image = wd_index_copy_image(&changes);
+		
+		if(image) {
+			start = search.lastrowid;
+			
+			/* rows changed since the image was written are skipped in it and read from the database instead */
+			if(changes) {
+				changes					= wi_array_by_sorting(changes, wi_number_compare);
+				search.changescount		= wi_array_count(changes);
+				search.changes			= wi_malloc(search.changescount * sizeof(wi_integer_t));
+				
+				for(i = 0; i < search.changescount; i++)
+					search.changes[i] = wi_number_integer(WI_ARRAY(changes, i));
+			}
+			
+			if(!wd_indeximage_search(image,
+									 wi_string_cstring(query),
+									 search.accountpathlength > 0 ? wi_string_cstring(accountpath) : NULL,
+									 &search.filter,
+									 search.lastrowid,
+									 wd_index_search_time > 0.0 ? search.interval + wd_index_search_time : 0.0,
+									 &rowid,
+									 wd_index_search_image_entry,
+									 &search)) {
+				search.truncated	= true;
+				search.timedout		= true;
+				search.lastrowid	= rowid;
+			}
+			
+			if(changes) {
+				result = wd_index_search_changes(&search, query, accountpath, changes, start);
+				
+				wi_free(search.changes);
+			}
+			
+			wi_release(image);
+		} else {
+			result = wd_index_search_database(&search, query, accountpath, NULL);
+		}
+		
+		if(!result) {
+			wi_log_error(WI_STR("Could not execute database statement: %m"));
+			wd_user_reply_internal_error(user, wi_error_string(), message);
+			
+			return false;
+		}
+		
+		hits = search.hits;
+		
+		/* a search cut short by the clock may complete next time, only the result limit is stable */
+		if(key && !search.timedout)
+			wd_index_cache_add(key, hits, search.truncated, search.lastrowid);
+	}
+	
+	wd_user_begin_batch(&search.batch, user, message);
+	
+	enumerator = wi_array_data_enumerator(hits);
+	
+	while((hit = wi_enumerator_next_data(enumerator)))
+		wd_index_search_reply(&search, hit);
+	
+	wd_user_end_batch(&search.batch);
+	
+	reply = wi_p7_message_with_name(WI_STR("wired.file.search_list.done"), wd_p7_spec);
+	
+	if(search.truncated) {
+		wi_p7_message_set_bool_for_name(reply, true, WI_STR("wired.file.search_truncated"));
+		wi_p7_message_set_string_for_name(reply, wi_string_with_format(WI_STR("%lld"), (long long) search.lastrowid), WI_STR("wired.file.search_cursor"));
+	}
+	
+	wd_user_reply_message(user, reply, message);
+	
+	wd_write_status(false);
+	
+	return true;
+}
+
+
+
+static wi_boolean_t wd_index_search_database(wd_index_search_t *search, wi_string_t *query, wi_string_t *accountpath, wi_array_t *rowids) {
+	wi_sqlite3_statement_t		*statement;
+	wi_dictionary_t				*results;
+	wi_string_t					*sql, *pattern;
+	wi_mutable_string_t			*restriction;
+	wi_array_t					*metadata;
+	wi_integer_t				start, end, last;
+	wi_uinteger_t				i;
+	wi_boolean_t				match;
+	
+	/* trigram matching needs at least three characters, not bytes, shorter queries scan */
+	match = (wd_index_search_table && wd_index_character_count(query) >= 3);
+	
+	if(match) {
+		sql			= WI_STR("SELECT `index`.rowid AS rowid, `index`.name, virtual_path, real_path, alias, "
+							 "type, data_size, rsrc_size, directory_count, creation_time, "
+							 "modification_time, volume, label, executable, link "
+							 "FROM index_names, `index` "
+							 "WHERE index_names MATCH ? AND `index`.rowid = index_names.rowid "
+							 "AND index_names.rowid > ? AND index_names.rowid <= ? ");
+		pattern		= wi_string_with_format(WI_STR("\"%@\""),
+			wi_string_by_replacing_string_with_string(query, WI_STR("\""), WI_STR("\"\""), 0));
+	} else {
+		sql			= WI_STR("SELECT rowid, name, virtual_path, real_path, alias, "
+							 "type, data_size, rsrc_size, directory_count, creation_time, "
+							 "modification_time, volume, label, executable, link "
+							 "FROM `index` "
+							 "WHERE name LIKE ? ESCAPE '\\' "
+							 "AND rowid > ? AND rowid <= ? ");
+		pattern		= wd_index_like_pattern(query, false);
+	}
+	
+	if(rowids) {
+		/* a short list of sorted rowids, looked up directly in a single window */
+		restriction = wi_mutable_string();
+		
+		for(i = 0; i < wi_array_count(rowids); i++)
+			wi_mutable_string_append_format(restriction, WI_STR("%s%lld"), i > 0 ? "," : "", (long long) wi_number_integer(WI_ARRAY(rowids, i)));
+		
+		sql		= wi_string_by_appending_string(sql, wi_string_with_format(WI_STR("AND `index`.rowid IN (%@) "), restriction));
+		last	= wi_number_integer(WI_ARRAY(rowids, wi_array_count(rowids) - 1));
+	} else {
+		/* filters may reject everything for a long time, so the table is walked in windows with the clock checked between them */
+		results = wi_sqlite3_execute_statement(wd_index_database, WI_STR("SELECT IFNULL(MAX(rowid), 0) AS rowid FROM `index`"), NULL);
+		
+		if(!results)
+			return false;
+		
+		last = wi_number_integer(wi_dictionary_data_for_key(results, WI_STR("rowid")));
+	}
+	
+	/* filters that are not set are bound to values that let everything through */
+	sql = wi_string_by_appending_string(sql, WI_STR("AND ((1 << type) & ?) != 0 "
+													"AND data_size + rsrc_size BETWEEN ? AND ? "
+													"AND modification_time >= ? AND modification_time < ? "
+													"AND (? = '' OR `index`.name LIKE ? ESCAPE '\\')"));
+	
+	for(start = search->lastrowid; start < last; start = end) {
+		end = (rowids || last - start <= WD_INDEX_SEARCH_WINDOW) ? last : start + WD_INDEX_SEARCH_WINDOW;
+		
+		if(search->accountpathlength > 0) {
+			statement = wi_sqlite3_prepare_statement(wd_index_database,
+				wi_string_by_appending_string(sql, WI_STR(" AND (virtual_path = ? OR (virtual_path > ? AND virtual_path < ?)) "
+														  "ORDER BY `index`.rowid LIMIT ?")),
+				pattern,
+				wi_number_with_integer(start),
+				wi_number_with_integer(end),
+				wi_number_with_int64(search->filter.types),
+				wi_number_with_int64(search->filter.minsize),
+				wi_number_with_int64(search->filter.maxsize),
+				wi_number_with_int64(search->filter.after),
+				wi_number_with_int64(search->filter.before),
+				search->extension,
+				wd_index_like_pattern(wi_string_by_appending_string(WI_STR("."), search->extension), true),
+				accountpath,
+				wi_string_by_appending_string(accountpath, WI_STR("/")),
+				wi_string_by_appending_string(accountpath, WI_STR("0")),
+				wi_number_with_integer(search->limit > 0 ? (wi_integer_t) search->limit + 1 : -1),
+				NULL);
+		} else {
+			statement = wi_sqlite3_prepare_statement(wd_index_database,
+				wi_string_by_appending_string(sql, WI_STR(" ORDER BY `index`.rowid LIMIT ?")),
+				pattern,
+				wi_number_with_integer(start),
+				wi_number_with_integer(end),
+				wi_number_with_int64(search->filter.types),
+				wi_number_with_int64(search->filter.minsize),
+				wi_number_with_int64(search->filter.maxsize),
+				wi_number_with_int64(search->filter.after),
+				wi_number_with_int64(search->filter.before),
+				search->extension,
+				wd_index_like_pattern(wi_string_by_appending_string(WI_STR("."), search->extension), true),
+				wi_number_with_integer(search->limit > 0 ? (wi_integer_t) search->limit + 1 : -1),
+				NULL);
+		}
+		
+		if(!statement)
+			return false;
+		
+		while((results = wi_sqlite3_fetch_statement_results(wd_index_database, statement)) && wi_dictionary_count(results) > 0) {
+			/* the trigram table folds case beyond ASCII, LIKE and the image don't, so names are held to their rule */
+			if(match && !wd_indeximage_match(wi_string_cstring(wi_dictionary_data_for_key(results, WI_STR("name"))),
+											 wi_string_cstring(query), wi_string_length(query)))
+				continue;
+			
+			metadata = wi_array_with_data(
+				wi_dictionary_data_for_key(results, WI_STR("type")),
+				wi_dictionary_data_for_key(results, WI_STR("data_size")),
+				wi_dictionary_data_for_key(results, WI_STR("rsrc_size")),
+				wi_dictionary_data_for_key(results, WI_STR("creation_time")),
+				wi_dictionary_data_for_key(results, WI_STR("modification_time")),
+				wi_dictionary_data_for_key(results, WI_STR("volume")),
+				wi_dictionary_data_for_key(results, WI_STR("label")),
+				wi_dictionary_data_for_key(results, WI_STR("executable")),
+				wi_dictionary_data_for_key(results, WI_STR("link")),
+				NULL);
+			
+			if(!wd_index_search_add_hit(search,
+									  wi_number_integer(wi_dictionary_data_for_key(results, WI_STR("rowid"))),
+									  wi_dictionary_data_for_key(results, WI_STR("virtual_path")),
+									  wi_dictionary_data_for_key(results, WI_STR("real_path")),
+									  wi_number_bool(wi_dictionary_data_for_key(results, WI_STR("alias"))),
+									  metadata,
+									  wi_number_integer(wi_dictionary_data_for_key(results, WI_STR("directory_count")))))
+				return true;
+		}
+		
+		if(!results)
+			return false;
+		
+		/* the next search resumes after the window, which held nothing more */
+		if(end < last && wd_index_search_timed_out(search)) {
+			search->truncated	= true;
+			search->timedout	= true;
+			search->lastrowid	= end;
+			
+			return true;
+		}
+	}
+	
+	return true;
+}
+
+
+
+static wi_boolean_t wd_index_search_changes(wd_index_search_t *search, wi_string_t *query, wi_string_t *accountpath, wi_array_t *rowids, wi_integer_t rowid) {
+	wd_index_search_t		changes;
+	wi_mutable_array_t		*hits;
+	wi_array_t				*hit;
+	wi_integer_t			hitrowid, bound;
+	wi_uinteger_t			i, j, imagecount, changescount;
+	wi_boolean_t			bounded, limited;
+	
+	/* the changed rows are searched on their own from where the image search started */
+	changes				= *search;
+	changes.hits		= wi_mutable_array();
+	changes.count		= 0;
+	changes.lastrowid	= rowid;
+	changes.truncated	= false;
+	changes.timedout	= false;
+	
+	if(!wd_index_search_database(&changes, query, accountpath, rowids))
+		return false;
+	
+	/* neither list says anything past where a truncated one stopped */
+	bounded	= (search->truncated || changes.truncated);
+	bound	= 0;
+	
+	if(search->truncated && changes.truncated)
+		bound = WI_MIN(search->lastrowid, changes.lastrowid);
+	else if(search->truncated)
+		bound = search->lastrowid;
+	else if(changes.truncated)
+		bound = changes.lastrowid;
+	
+	/* both lists are in rowid order and share no rows, so they merge like sorted runs */
+	hits			= wi_mutable_array();
+	imagecount		= wi_array_count(search->hits);
+	changescount	= wi_array_count(changes.hits);
+	limited			= false;
+	i				= 0;
+	j				= 0;
+	
+	search->count		= 0;
+	search->timedout	= (search->timedout || changes.timedout);
+	
+	while(i < imagecount || j < changescount) {
+		if(j == changescount || (i < imagecount &&
+		   wi_number_integer(WI_ARRAY(WI_ARRAY(search->hits, i), 5)) < wi_number_integer(WI_ARRAY(WI_ARRAY(changes.hits, j), 5))))
+			hit = WI_ARRAY(search->hits, i++);
+		else
+			hit = WI_ARRAY(changes.hits, j++);
+		
+		hitrowid = wi_number_integer(WI_ARRAY(hit, 5));
+		
+		if(bounded && hitrowid > bound)
+			break;
+		
+		if(search->limit > 0 && search->count == search->limit) {
+			limited = true;
+			
+			break;
+		}
+		
+		wi_mutable_array_add_data(hits, hit);
+		
+		search->lastrowid = hitrowid;
+		search->count++;
+	}
+	
+	search->hits		= hits;
+	search->truncated	= (limited || bounded);
+	
+	if(!limited && bounded)
+		search->lastrowid = bound;
+	
+	return true;
+}
+
+
+
+static int wd_index_compare_rowids(const void *p1, const void *p2) {
+	wi_integer_t		rowid1 = *(const wi_integer_t *) p1, rowid2 = *(const wi_integer_t *) p2;
+	
+	return (rowid1 < rowid2) ? -1 : (rowid1 > rowid2) ? 1 : 0;
+}
+
+
+
+static wi_boolean_t wd_index_search_filter(wd_index_search_t *search, wi_p7_message_t *message) {
+	wi_date_t			*date;
+	wi_p7_uint32_t		types;
+	wi_p7_uint64_t		size;
+	
+	search->filter.types	= WD_INDEX_ALL_TYPES;
+	search->filter.minsize	= 0;
+	search->filter.maxsize	= INT64_MAX;
+	search->filter.after	= 0;
+	search->filter.before	= INT64_MAX;
+	search->extension		= WI_STR("");
+	
+	if(wi_p7_message_get_uint32_for_name(message, &types, WI_STR("wired.file.search_types")) && types != 0)
+		search->filter.types = types;
+	
+	if(wi_p7_message_get_uint64_for_name(message, &size, WI_STR("wired.file.search_min_size")))
+		search->filter.minsize = WI_MIN(size, (wi_p7_uint64_t) INT64_MAX);
+	
+	if(wi_p7_message_get_uint64_for_name(message, &size, WI_STR("wired.file.search_max_size")))
+		search->filter.maxsize = WI_MIN(size, (wi_p7_uint64_t) INT64_MAX);
+	
+	date = wi_p7_message_date_for_name(message, WI_STR("wired.file.search_modified_after"));
+	
+	if(date)
+		search->filter.after = wi_date_time_interval(date);
+	
+	date = wi_p7_message_date_for_name(message, WI_STR("wired.file.search_modified_before"));
+	
+	if(date)
+		search->filter.before = wi_date_time_interval(date);
+	
+	search->extension = wi_p7_message_string_for_name(message, WI_STR("wired.file.search_extension"));
+	
+	if(search->extension && wi_string_has_prefix(search->extension, WI_STR(".")))
+		search->extension = wi_string_substring_from_index(search->extension, 1);
+	
+	if(!search->extension)
+		search->extension = WI_STR("");
+	
+	search->filter.extension = wi_string_cstring(search->extension);
+	
+	return (search->filter.types != WD_INDEX_ALL_TYPES ||
+			search->filter.minsize > 0 || search->filter.maxsize < INT64_MAX ||
+			search->filter.after > 0 || search->filter.before < INT64_MAX ||
+			wi_string_length(search->extension) > 0);
+}
+
+
+
+static wi_boolean_t wd_index_search_image_entry(wd_indeximage_entry_t *entry, void *context) {
+	wd_index_search_t	*search = context;
+	wi_array_t			*metadata;
+	
+	/* the database has the current version of a changed row, or knows it is gone */
+	if(search->changescount > 0 && bsearch(&entry->rowid, search->changes, search->changescount, sizeof(wi_integer_t), wd_index_compare_rowids))
+		return true;
+	
+	metadata = wi_array_with_data(
+		wi_number_with_int32(entry->type),
+		wi_number_with_int64(entry->datasize),
+		wi_number_with_int64(entry->rsrcsize),
+		wi_number_with_int64(entry->creationtime),
+		wi_number_with_int64(entry->modificationtime),
+		wi_number_with_integer(entry->volume),
+		wi_number_with_int32(entry->label),
+		wi_number_with_bool(entry->executable),
+		wi_number_with_bool(entry->link),
+		NULL);
+	
+	return wd_index_search_add_hit(search,
+								 entry->rowid,
+								 wi_string_with_cstring(entry->path),
+								 wi_string_with_cstring(entry->realpath),
+								 entry->alias,
+								 metadata,
+								 entry->directorycount);
+}
+
+
+
+static wi_boolean_t wd_index_search_add_hit(wd_index_search_t *search, wi_integer_t rowid, wi_string_t *virtualpath, wi_string_t *realpath, wi_boolean_t alias, wi_array_t *metadata, wi_uinteger_t directorycount) {
+	/* one hit past the limit tells there is more to come */
+	if(search->limit > 0 && search->count == search->limit) {
+		search->truncated = true;
+		
+		return false;
+	}
+	
+	if(wd_index_search_timed_out(search)) {
+		search->truncated = true;
+		search->timedout = true;
+		
+		return false;
+	}
+	
+	wi_mutable_array_add_data(search->hits,
+		wi_array_with_data(virtualpath, realpath, wi_number_with_bool(alias), metadata, wi_number_with_integer(directorycount), wi_number_with_integer(rowid), NULL));
+	
+	search->lastrowid = rowid;
+	search->count++;
+	
+	return true;
+}
+
+
+
+static wi_boolean_t wd_index_search_timed_out(wd_index_search_t *search) {
+	return (wd_index_search_time > 0.0 && wi_time_interval() - search->interval > wd_index_search_time);
+}
+
+
+
+static void wd_index_search_reply(wd_index_search_t *search, wi_array_t *hit) {
+	wi_p7_message_t				*reply;
+	wi_string_t					*virtualpath, *realpath;
+	wi_array_t					*metadata;
+	wd_files_privileges_t		*privileges;
+	wi_fs_stat_t				sb, lsb;
+	wi_uinteger_t				directorycount;
+	wi_boolean_t				alias, readable, writable;
+	wd_file_type_t				type;
+	
+	virtualpath		= WI_ARRAY(hit, 0);
+	realpath		= WI_ARRAY(hit, 1);
+	alias			= wi_number_bool(WI_ARRAY(hit, 2));
+	metadata		= WI_ARRAY(hit, 3);
+	directorycount	= wi_number_integer(WI_ARRAY(hit, 4));
+	
+	if(wd_index_verify_search) {
+		/* take everything from the file system and drop hits that have gone away */
+		if(!wi_fs_lstat_path(realpath, &lsb))
+			return;
+		
+		if(!wi_fs_stat_path(realpath, &sb))
+			sb = lsb;
+		
+		metadata		= wd_index_metadata(realpath, &sb, &lsb, alias);
+		directorycount	= S_ISDIR(sb.mode) ? wd_files_count_path(realpath, NULL, NULL) : 0;
+	}
+	
+	type = wi_number_int32(WI_ARRAY(metadata, 0));
+	
+	if(type == WD_FILE_TYPE_DROPBOX) {
+		/* drop boxes are not crawled, so their privileges and counts are always looked up */
+		privileges		= wd_files_drop_box_privileges(realpath);
+		readable		= wd_files_privileges_is_readable_by_account(privileges, search->account);
+		writable		= wd_files_privileges_is_writable_by_account(privileges, search->account);
+		directorycount	= readable ? wd_files_count_path(realpath, NULL, NULL) : 0;
+	} else {
+		readable		= true;
+		writable		= true;
+	}
+	
+	if(search->accountpathlength > 0)
+		virtualpath = wi_string_substring_from_index(virtualpath, search->accountpathlength);
+	
+	reply = wi_p7_message_with_name(WI_STR("wired.file.search_list"), wd_p7_spec);
+	wi_p7_message_set_string_for_name(reply, virtualpath, WI_STR("wired.file.path"));
+	wi_p7_message_set_enum_for_name(reply, type, WI_STR("wired.file.type"));
+	wi_p7_message_set_date_for_name(reply, wi_date_with_time(wi_number_int64(WI_ARRAY(metadata, 3))), WI_STR("wired.file.creation_time"));
+	wi_p7_message_set_date_for_name(reply, wi_date_with_time(wi_number_int64(WI_ARRAY(metadata, 4))), WI_STR("wired.file.modification_time"));
+	wi_p7_message_set_bool_for_name(reply, wi_number_bool(WI_ARRAY(metadata, 8)), WI_STR("wired.file.link"));
+	wi_p7_message_set_bool_for_name(reply, wi_number_bool(WI_ARRAY(metadata, 7)), WI_STR("wired.file.executable"));
+	wi_p7_message_set_enum_for_name(reply, wi_number_int32(WI_ARRAY(metadata, 6)), WI_STR("wired.file.label"));
+	wi_p7_message_set_uint32_for_name(reply, wi_number_integer(WI_ARRAY(metadata, 5)), WI_STR("wired.file.volume"));
+	
+	if(type == WD_FILE_TYPE_FILE) {
+		wi_p7_message_set_uint64_for_name(reply, wi_number_int64(WI_ARRAY(metadata, 1)), WI_STR("wired.file.data_size"));
+		wi_p7_message_set_uint64_for_name(reply, wi_number_int64(WI_ARRAY(metadata, 2)), WI_STR("wired.file.rsrc_size"));
+	} else {
+		wi_p7_message_set_uint32_for_name(reply, directorycount, WI_STR("wired.file.directory_count"));
+	}
+	
+	if(type == WD_FILE_TYPE_DROPBOX) {
+		wi_p7_message_set_bool_for_name(reply, readable, WI_STR("wired.file.readable"));
+		wi_p7_message_set_bool_for_name(reply, writable, WI_STR("wired.file.writable"));
+	}
+	
+	wd_user_batch_reply_message(&search->batch, reply);
+}
+
+
+
+#pragma mark -
+
+static wi_string_t * wd_index_cache_key(wd_index_search_t *search, wi_string_t *query, wi_string_t *accountpath) {
+	wi_string_t		*key;
+	const char		*cstring;
+	char			*buffer;
+	wi_uinteger_t	i, generation;
+	
+	wi_lock_lock(wd_index_cache_lock);
+	generation = wd_index_generation;
+	wi_lock_unlock(wd_index_cache_lock);
+	
+	/* names match without regard to ASCII case, so neither do keys */
+	cstring	= wi_string_cstring(query);
+	buffer	= wi_malloc(strlen(cstring) + 1);
+	
+	for(i = 0; cstring[i]; i++)
+		buffer[i] = (cstring[i] >= 'A' && cstring[i] <= 'Z') ? cstring[i] + ('a' - 'A') : cstring[i];
+	
+	buffer[i] = '\0';
+	
+	key = wi_string_with_format(WI_STR("%lu:%lld:%lu:%lu:%lld:%lld:%lld:%lld:%@:%@:%s"),
+		(unsigned long) generation,
+		(long long) search->lastrowid,
+		(unsigned long) search->limit,
+		(unsigned long) search->filter.types,
+		(long long) search->filter.minsize,
+		(long long) search->filter.maxsize,
+		(long long) search->filter.after,
+		(long long) search->filter.before,
+		search->extension,
+		accountpath ? accountpath : WI_STR(""),
+		buffer);
+	
+	wi_free(buffer);
+	
+	return key;
+}
+
+
+
+static wi_array_t * wd_index_cache_entry(wi_string_t *key) {
+	wi_array_t		*entry;
+	
+	if(wd_index_cache_capacity == 0)
+		return NULL;
+	
+	wi_lock_lock(wd_index_cache_lock);
+	
+	entry = wi_dictionary_data_for_key(wd_index_cache, key);
+	
+	if(entry) {
+		wd_index_search_cache_hits++;
+		
+		/* most recently used keys live at the end */
+		wi_mutable_array_remove_data(wd_index_cache_order, key);
+		wi_mutable_array_add_data(wd_index_cache_order, key);
+		
+		wi_autorelease(wi_retain(entry));
+	} else {
+		wd_index_search_cache_misses++;
+	}
+	
+	wi_lock_unlock(wd_index_cache_lock);
+	
+	return entry;
+}
+
+
+
+static void wd_index_cache_add(wi_string_t *key, wi_array_t *hits, wi_boolean_t truncated, wi_integer_t rowid) {
+	wi_enumerator_t		*enumerator;
+	wi_array_t			*hit, *entry;
+	wi_string_t			*oldest;
+	wi_uinteger_t		size;
+	
+	if(wd_index_cache_capacity == 0)
+		return;
+	
+	size		= WD_INDEX_CACHE_ENTRY_SIZE + wi_string_length(key);
+	enumerator	= wi_array_data_enumerator(hits);
+	
+	while((hit = wi_enumerator_next_data(enumerator)))
+		size += WD_INDEX_CACHE_HIT_SIZE + wi_string_length(WI_ARRAY(hit, 0)) + wi_string_length(WI_ARRAY(hit, 1));
+	
+	/* one huge result set should not push out everything else */
+	if(size > WD_INDEX_CACHE_MAX_SIZE / 4)
+		return;
+	
+	entry = wi_array_with_data(hits, wi_number_with_bool(truncated), wi_number_with_integer(rowid), wi_number_with_integer(size), NULL);
+	
+	wi_lock_lock(wd_index_cache_lock);
+	
+	if(!wi_dictionary_data_for_key(wd_index_cache, key)) {
+		while(wi_array_count(wd_index_cache_order) > 0 &&
+			  (wi_array_count(wd_index_cache_order) >= wd_index_cache_capacity ||
+			   wd_index_search_cache_size + size > WD_INDEX_CACHE_MAX_SIZE)) {
+			oldest = WI_ARRAY(wd_index_cache_order, 0);
+			
+			wd_index_search_cache_size -= wi_number_integer(WI_ARRAY(wi_dictionary_data_for_key(wd_index_cache, oldest), 3));
+			
+			wi_mutable_dictionary_remove_data_for_key(wd_index_cache, oldest);
+			wi_mutable_array_remove_data_at_index(wd_index_cache_order, 0);
+		}
+		
+		wi_mutable_dictionary_set_data_for_key(wd_index_cache, entry, key);
+		wi_mutable_array_add_data(wd_index_cache_order, key);
+		
+		wd_index_search_cache_size += size;
+		wd_index_search_cache_count = wi_array_count(wd_index_cache_order);
+	}
+	
+	wi_lock_unlock(wd_index_cache_lock);
+}
+
+
+
+static void wd_index_cache_clear(void) {
+	wi_lock_lock(wd_index_cache_lock);
+	
+	wi_mutable_dictionary_remove_all_data(wd_index_cache);
+	wi_mutable_array_remove_all_data(wd_index_cache_order);
+	
+	wd_index_search_cache_size	= 0;
+	wd_index_search_cache_count	= 0;
+	
+	wi_lock_unlock(wd_index_cache_lock);
+}
+
+
+
+static void wd_index_bump_generation(void) {
+	/* cached searches are keyed by generation, so older ones just age out */
+	wi_lock_lock(wd_index_cache_lock);
+	wd_index_generation++;
+	wi_lock_unlock(wd_index_cache_lock);
+}
@@ -33,9 +33,17 @@ void								wd_index_index_files(wi_boolean_t);
 
 void								wd_index_add_file(wi_string_t *);
 void								wd_index_delete_file(wi_string_t *);
+void								wd_index_delete_files(wi_string_t *);
+void								wd_index_move_files(wi_string_t *, wi_string_t *);
+void								wd_index_invalidate_directory(wi_string_t *);
 
 wi_boolean_t						wd_index_search(wi_string_t *, wd_user_t *, wi_p7_message_t *);
 
 extern wi_uinteger_t				wd_index_files_count;
 extern wi_uinteger_t				wd_index_directories_count;
 extern wi_file_offset_t				wd_index_files_size;
+
+extern wi_uinteger_t				wd_index_search_cache_hits;
+extern wi_uinteger_t				wd_index_search_cache_misses;
+extern wi_uinteger_t				wd_index_search_cache_count;
+extern wi_uinteger_t				wd_index_search_cache_size;
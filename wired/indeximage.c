@@ -0,0 +1,925 @@
+/* $Id$ */
+
+/*
+ *  Copyright (c) 2003-2009 Axel Andersson
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <wired/wired.h>
+
+#include "indeximage.h"
+
+#ifndef O_CLOEXEC
+#define O_CLOEXEC						0
+#endif
+
+#define WD_INDEXIMAGE_DEADLINE_INTERVAL	1024
+
+#define WD_INDEXIMAGE_MAGIC				"WDXI"
+#define WD_INDEXIMAGE_VERSION			1
+#define WD_INDEXIMAGE_BYTE_ORDER		0x01020304
+#define WD_INDEXIMAGE_BLOCK_SIZE		16
+#define WD_INDEXIMAGE_ALIGN(n)			(((n) + 7) & ~((uint64_t) 7))
+
+
+struct _wd_indeximage_header {
+	char								magic[4];
+	uint32_t							version;
+	uint32_t							byteorder;
+	uint32_t							entries;
+	uint32_t							trigrams;
+	uint32_t							rootlength;
+	uint64_t							size;
+	uint64_t							postings;
+	uint64_t							root_offset;
+	uint64_t							blocks_offset;
+	uint64_t							paths_offset;
+	uint64_t							records_offset;
+	uint64_t							order_offset;
+	uint64_t							trigrams_offset;
+	uint64_t							postings_offset;
+};
+typedef struct _wd_indeximage_header	wd_indeximage_header_t;
+
+struct _wd_indeximage_record {
+	int64_t								rowid;
+	uint64_t							datasize;
+	uint64_t							rsrcsize;
+	int64_t								creationtime;
+	int64_t								modificationtime;
+	uint32_t							type;
+	uint32_t							directorycount;
+	uint32_t							volume;
+	uint32_t							label;
+	uint8_t								alias;
+	uint8_t								executable;
+	uint8_t								link;
+	uint8_t								reserved[5];
+};
+typedef struct _wd_indeximage_record	wd_indeximage_record_t;
+
+struct _wd_indeximage_trigram {
+	uint32_t							trigram;
+	uint32_t							count;
+	uint64_t							offset;
+};
+typedef struct _wd_indeximage_trigram	wd_indeximage_trigram_t;
+
+struct _wd_indeximage_rowid {
+	int64_t								rowid;
+	uint32_t							index;
+};
+typedef struct _wd_indeximage_rowid		wd_indeximage_rowid_t;
+
+struct _wd_indeximage_buffer {
+	unsigned char						*bytes;
+	wi_uinteger_t						length;
+	wi_uinteger_t						capacity;
+};
+typedef struct _wd_indeximage_buffer	wd_indeximage_buffer_t;
+
+struct _wd_indeximage {
+	wi_runtime_base_t					base;
+	
+	void								*map;
+	wi_uinteger_t						size;
+	
+	const wd_indeximage_header_t		*header;
+	const uint64_t						*blocks;
+	const unsigned char					*paths;
+	wi_uinteger_t						pathssize;
+	const wd_indeximage_record_t		*records;
+	const uint32_t						*order;
+	const wd_indeximage_trigram_t		*trigrams;
+	const uint32_t						*postings;
+};
+
+struct _wd_indeximage_builder {
+	wd_indeximage_buffer_t				paths;
+	wd_indeximage_buffer_t				blocks;
+	wd_indeximage_buffer_t				records;
+	wd_indeximage_buffer_t				pairs;
+	wd_indeximage_buffer_t				path;
+	wd_indeximage_buffer_t				realpath;
+	uint32_t							entries;
+};
+
+
+static void								wd_indeximage_dealloc(wi_runtime_instance_t *);
+
+static wi_boolean_t						wd_indeximage_decode(wd_indeximage_t *, uint32_t, wd_indeximage_buffer_t *, wd_indeximage_buffer_t *, const unsigned char **, uint32_t *);
+static wi_boolean_t						wd_indeximage_decode_string(const unsigned char **, const unsigned char *, wd_indeximage_buffer_t *);
+static const wd_indeximage_trigram_t *	wd_indeximage_trigram(wd_indeximage_t *, uint32_t);
+static wi_boolean_t						wd_indeximage_filter_record(const wd_indeximage_filter_t *, const wd_indeximage_record_t *);
+static wi_boolean_t						wd_indeximage_filter_name(const wd_indeximage_filter_t *, const char *);
+
+static void								wd_indeximage_builder_add_string(wd_indeximage_builder_t *, wd_indeximage_buffer_t *, const char *, wi_boolean_t);
+static int								wd_indeximage_builder_compare_rowids(const void *, const void *);
+static int								wd_indeximage_builder_compare_pairs(const void *, const void *);
+
+static void								wd_indeximage_buffer_reserve(wd_indeximage_buffer_t *, wi_uinteger_t);
+static void								wd_indeximage_buffer_append(wd_indeximage_buffer_t *, const void *, wi_uinteger_t);
+static void								wd_indeximage_buffer_append_varint(wd_indeximage_buffer_t *, uint64_t);
+static void								wd_indeximage_buffer_free(wd_indeximage_buffer_t *);
+static wi_boolean_t						wd_indeximage_read_varint(const unsigned char **, const unsigned char *, uint64_t *);
+static wi_boolean_t						wd_indeximage_write_bytes(int, const void *, uint64_t, uint64_t);
+static uint32_t							wd_indeximage_trigram_key(const char *);
+
+
+static wi_runtime_id_t					wd_indeximage_runtime_id = WI_RUNTIME_ID_NULL;
+static wi_runtime_class_t				wd_indeximage_runtime_class = {
+	"wd_indeximage_t",
+	wd_indeximage_dealloc,
+	NULL,
+	NULL,
+	NULL,
+	NULL
+};
+
+
+
+/*
+	An index image is a read-only copy of the index table laid out for
+	searching straight from a memory mapping. Paths are sorted and front
+	coded in blocks of 16, each entry storing only what differs from the
+	one before it, so that a block decodes like a walk down a path trie.
+	Fixed size records carry the metadata, and every trigram of every
+	lowercased name maps to a posting list of entries. Posting lists and
+	the scan order both follow the index rowids, so results and cursors
+	match those of the database search.
+*/
+
+void wd_indeximage_initialize(void) {
+	wd_indeximage_runtime_id = wi_runtime_register_class(&wd_indeximage_runtime_class);
+}
+
+
+
+#pragma mark -
+
+wd_indeximage_t * wd_indeximage_alloc(void) {
+	return wi_runtime_create_instance(wd_indeximage_runtime_id, sizeof(wd_indeximage_t));
+}
+
+
+
+wd_indeximage_t * wd_indeximage_init_with_path(wd_indeximage_t *image, wi_string_t *path, wi_string_t *root) {
+	const wd_indeximage_header_t	*header;
+	const unsigned char				*bytes;
+	struct stat						sb;
+	uint64_t						blocks;
+	int								fd;
+	
+	fd = open(wi_string_cstring(path), O_RDONLY | O_CLOEXEC);
+	
+	if(fd < 0) {
+		wi_error_set_errno(errno);
+		wi_release(image);
+		
+		return NULL;
+	}
+	
+	if(fstat(fd, &sb) < 0 || (uint64_t) sb.st_size < sizeof(wd_indeximage_header_t)) {
+		wi_error_set_errno(errno ? errno : EINVAL);
+		close(fd);
+		wi_release(image);
+		
+		return NULL;
+	}
+	
+	image->size	= sb.st_size;
+	image->map	= mmap(NULL, image->size, PROT_READ, MAP_SHARED, fd, 0);
+	
+	close(fd);
+	
+	if(image->map == MAP_FAILED) {
+		image->map = NULL;
+		
+		wi_error_set_errno(errno);
+		wi_release(image);
+		
+		return NULL;
+	}
+	
+	bytes	= image->map;
+	header	= image->map;
+	blocks	= (header->entries + WD_INDEXIMAGE_BLOCK_SIZE - 1) / WD_INDEXIMAGE_BLOCK_SIZE;
+	
+	/* anything that does not add up is treated as a stale image and rebuilt */
+	if(memcmp(header->magic, WD_INDEXIMAGE_MAGIC, sizeof(header->magic)) != 0 ||
+	   header->version != WD_INDEXIMAGE_VERSION ||
+	   header->byteorder != WD_INDEXIMAGE_BYTE_ORDER ||
+	   header->size != image->size ||
+	   header->root_offset + header->rootlength >= header->blocks_offset ||
+	   header->blocks_offset + (blocks * sizeof(uint64_t)) > header->paths_offset ||
+	   header->paths_offset > header->records_offset ||
+	   header->records_offset + ((uint64_t) header->entries * sizeof(wd_indeximage_record_t)) > header->order_offset ||
+	   header->order_offset + ((uint64_t) header->entries * sizeof(uint32_t)) > header->trigrams_offset ||
+	   header->trigrams_offset + ((uint64_t) header->trigrams * sizeof(wd_indeximage_trigram_t)) > header->postings_offset ||
+	   header->postings_offset + (header->postings * sizeof(uint32_t)) > header->size ||
+	   header->rootlength != wi_string_length(root) ||
+	   memcmp(bytes + header->root_offset, wi_string_cstring(root), header->rootlength) != 0) {
+		wi_error_set_errno(EINVAL);
+		wi_release(image);
+		
+		return NULL;
+	}
+	
+	image->header		= header;
+	image->blocks		= (const uint64_t *) (bytes + header->blocks_offset);
+	image->paths		= bytes + header->paths_offset;
+	image->pathssize	= header->records_offset - header->paths_offset;
+	image->records		= (const wd_indeximage_record_t *) (bytes + header->records_offset);
+	image->order		= (const uint32_t *) (bytes + header->order_offset);
+	image->trigrams		= (const wd_indeximage_trigram_t *) (bytes + header->trigrams_offset);
+	image->postings		= (const uint32_t *) (bytes + header->postings_offset);
+	
+	return image;
+}
+
+
+
+static void wd_indeximage_dealloc(wi_runtime_instance_t *instance) {
+	wd_indeximage_t		*image = instance;
+	
+	if(image->map)
+		munmap(image->map, image->size);
+}
+
+
+
+#pragma mark -
+
+wi_uinteger_t wd_indeximage_count(wd_indeximage_t *image) {
+	return image->header->entries;
+}
+
+
+
+wi_boolean_t wd_indeximage_search(wd_indeximage_t *image, const char *query, const char *prefix, const wd_indeximage_filter_t *filter, wi_integer_t rowid, wi_time_interval_t deadline, wi_integer_t *cursor, wd_indeximage_search_func_t *function, void *context) {
+	const wd_indeximage_trigram_t	*trigram, *rarest;
+	const wd_indeximage_record_t	*record;
+	const uint32_t					*ranks;
+	const unsigned char				*position;
+	wd_indeximage_buffer_t			path, realpath;
+	wd_indeximage_entry_t			entry;
+	const char						*name;
+	wi_uinteger_t					querylength, prefixlength, count, i, low, high, middle;
+	uint32_t						index, decoded;
+	wi_boolean_t					result;
+	
+	querylength		= strlen(query);
+	prefixlength	= prefix ? strlen(prefix) : 0;
+	rarest			= NULL;
+	
+	/* every trigram of the query must occur, walk the shortest list and match the rest by hand */
+	if(querylength >= 3) {
+		for(i = 0; i + 3 <= querylength; i++) {
+			trigram = wd_indeximage_trigram(image, wd_indeximage_trigram_key(query + i));
+			
+			if(!trigram)
+				return true;
+			
+			if(!rarest || trigram->count < rarest->count)
+				rarest = trigram;
+		}
+		
+		if(rarest->offset + rarest->count > image->header->postings)
+			return true;
+		
+		ranks = image->postings + rarest->offset;
+		count = rarest->count;
+	} else {
+		ranks = NULL;
+		count = image->header->entries;
+	}
+	
+	/* resume after the cursor, ranks are in rowid order */
+	low		= 0;
+	high	= count;
+	
+	while(low < high) {
+		middle	= low + ((high - low) / 2);
+		index	= ranks ? ranks[middle] : middle;
+		
+		if(index < image->header->entries && image->records[image->order[index]].rowid <= rowid)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	
+	memset(&path, 0, sizeof(path));
+	memset(&realpath, 0, sizeof(realpath));
+	
+	position	= NULL;
+	decoded		= UINT32_MAX;
+	result		= true;
+	
+	for(i = low; i < count; i++) {
+		index = ranks ? ranks[i] : i;
+		
+		if(index >= image->header->entries)
+			break;
+		
+		index = image->order[index];
+		
+		if(index >= image->header->entries)
+			break;
+		
+		/* a scan that matches little never reaches the callback, so it watches the clock itself */
+		if(deadline > 0.0 && (i - low) % WD_INDEXIMAGE_DEADLINE_INTERVAL == WD_INDEXIMAGE_DEADLINE_INTERVAL - 1 && wi_time_interval() > deadline) {
+			*cursor	= image->records[index].rowid - 1;
+			result	= false;
+			
+			break;
+		}
+		
+		/* the metadata filters need no path, so check them before decoding one */
+		record = &image->records[index];
+		
+		if(filter && !wd_indeximage_filter_record(filter, record))
+			continue;
+		
+		if(!wd_indeximage_decode(image, index, &path, &realpath, &position, &decoded))
+			break;
+		
+		name = strrchr((const char *) path.bytes, '/');
+		name = name ? name + 1 : (const char *) path.bytes;
+		
+		if(!wd_indeximage_match(name, query, querylength))
+			continue;
+		
+		if(filter && !wd_indeximage_filter_name(filter, name))
+			continue;
+		
+		if(prefixlength > 0) {
+			if(strncmp((const char *) path.bytes, prefix, prefixlength) != 0 ||
+			   (path.bytes[prefixlength] != '\0' && path.bytes[prefixlength] != '/'))
+				continue;
+		}
+		
+		entry.rowid				= record->rowid;
+		entry.path				= (const char *) path.bytes;
+		entry.name				= name;
+		entry.realpath			= (const char *) realpath.bytes;
+		entry.alias				= record->alias;
+		entry.type				= record->type;
+		entry.datasize			= record->datasize;
+		entry.rsrcsize			= record->rsrcsize;
+		entry.directorycount	= record->directorycount;
+		entry.creationtime		= record->creationtime;
+		entry.modificationtime	= record->modificationtime;
+		entry.volume			= record->volume;
+		entry.label				= record->label;
+		entry.executable		= record->executable;
+		entry.link				= record->link;
+		
+		if(!(*function)(&entry, context))
+			break;
+	}
+	
+	wd_indeximage_buffer_free(&path);
+	wd_indeximage_buffer_free(&realpath);
+	
+	return result;
+}
+
+
+
+wi_boolean_t wd_indeximage_match(const char *name, const char *query, wi_uinteger_t querylength) {
+	wi_uinteger_t		i, namelength;
+	
+	if(querylength == 0)
+		return true;
+	
+	namelength = strlen(name);
+	
+	if(querylength > namelength)
+		return false;
+	
+	/* case insensitive for ASCII only, like the LIKE search in the database */
+	for(i = 0; i + querylength <= namelength; i++) {
+		if(strncasecmp(name + i, query, querylength) == 0)
+			return true;
+	}
+	
+	return false;
+}
+
+
+
+#pragma mark -
+
+static wi_boolean_t wd_indeximage_decode(wd_indeximage_t *image, uint32_t index, wd_indeximage_buffer_t *path, wd_indeximage_buffer_t *realpath, const unsigned char **position, uint32_t *decoded) {
+	const unsigned char		*end;
+	uint64_t				offset;
+	uint32_t				i;
+	
+	end = image->paths + image->pathssize;
+	
+	/* rowids mostly follow crawl order, so a scan often lands on the entry after the last one it decoded */
+	if(*decoded != UINT32_MAX && index > *decoded && index / WD_INDEXIMAGE_BLOCK_SIZE == *decoded / WD_INDEXIMAGE_BLOCK_SIZE) {
+		i = *decoded + 1;
+	} else {
+		offset = image->blocks[index / WD_INDEXIMAGE_BLOCK_SIZE];
+		
+		if(offset >= image->pathssize)
+			return false;
+		
+		/* entries only store what differs from the one before them, so start at the head of the block */
+		*position			= image->paths + offset;
+		path->length		= 0;
+		realpath->length	= 0;
+		i					= index - (index % WD_INDEXIMAGE_BLOCK_SIZE);
+	}
+	
+	*decoded = UINT32_MAX;
+	
+	for(; i <= index; i++) {
+		if(!wd_indeximage_decode_string(position, end, path))
+			return false;
+		
+		if(!wd_indeximage_decode_string(position, end, realpath))
+			return false;
+	}
+	
+	*decoded = index;
+	
+	return true;
+}
+
+
+
+static wi_boolean_t wd_indeximage_decode_string(const unsigned char **position, const unsigned char *end, wd_indeximage_buffer_t *buffer) {
+	uint64_t		shared, length;
+	
+	if(!wd_indeximage_read_varint(position, end, &shared) || !wd_indeximage_read_varint(position, end, &length))
+		return false;
+	
+	if(shared > buffer->length || length > (uint64_t) (end - *position))
+		return false;
+	
+	wd_indeximage_buffer_reserve(buffer, shared + length + 1);
+	
+	memcpy(buffer->bytes + shared, *position, length);
+	
+	buffer->length					= shared + length;
+	buffer->bytes[buffer->length]	= '\0';
+	*position						+= length;
+	
+	return true;
+}
+
+
+
+static const wd_indeximage_trigram_t * wd_indeximage_trigram(wd_indeximage_t *image, uint32_t key) {
+	wi_uinteger_t		low, high, middle;
+	
+	low		= 0;
+	high	= image->header->trigrams;
+	
+	while(low < high) {
+		middle = low + ((high - low) / 2);
+		
+		if(image->trigrams[middle].trigram < key)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	
+	if(low < image->header->trigrams && image->trigrams[low].trigram == key)
+		return &image->trigrams[low];
+	
+	return NULL;
+}
+
+
+
+static wi_boolean_t wd_indeximage_filter_record(const wd_indeximage_filter_t *filter, const wd_indeximage_record_t *record) {
+	wi_file_offset_t	size;
+	
+	if(record->type >= sizeof(filter->types) * 8 || (filter->types & ((wi_uinteger_t) 1 << record->type)) == 0)
+		return false;
+	
+	size = record->datasize + record->rsrcsize;
+	
+	if(size < filter->minsize || size > filter->maxsize)
+		return false;
+	
+	if(record->modificationtime < filter->after || record->modificationtime >= filter->before)
+		return false;
+	
+	return true;
+}
+
+
+
+static wi_boolean_t wd_indeximage_filter_name(const wd_indeximage_filter_t *filter, const char *name) {
+	wi_uinteger_t		namelength, extensionlength;
+	
+	if(!filter->extension || !filter->extension[0])
+		return true;
+	
+	namelength		= strlen(name);
+	extensionlength	= strlen(filter->extension);
+	
+	if(namelength < extensionlength + 1 || name[namelength - extensionlength - 1] != '.')
+		return false;
+	
+	return (strcasecmp(name + namelength - extensionlength, filter->extension) == 0);
+}
+
+
+
+#pragma mark -
+
+wd_indeximage_builder_t * wd_indeximage_builder_open(void) {
+	wd_indeximage_builder_t		*builder;
+	
+	builder = wi_malloc(sizeof(wd_indeximage_builder_t));
+	memset(builder, 0, sizeof(wd_indeximage_builder_t));
+	
+	return builder;
+}
+
+
+
+void wd_indeximage_builder_close(wd_indeximage_builder_t *builder) {
+	wd_indeximage_buffer_free(&builder->paths);
+	wd_indeximage_buffer_free(&builder->blocks);
+	wd_indeximage_buffer_free(&builder->records);
+	wd_indeximage_buffer_free(&builder->pairs);
+	wd_indeximage_buffer_free(&builder->path);
+	wd_indeximage_buffer_free(&builder->realpath);
+	
+	wi_free(builder);
+}
+
+
+
+void wd_indeximage_builder_add(wd_indeximage_builder_t *builder, wd_indeximage_entry_t *entry) {
+	wd_indeximage_record_t		record;
+	uint64_t					offset, pair;
+	wi_uinteger_t				i, namelength;
+	wi_boolean_t				head;
+	
+	head = (builder->entries % WD_INDEXIMAGE_BLOCK_SIZE == 0);
+	
+	if(head) {
+		offset = builder->paths.length;
+		
+		wd_indeximage_buffer_append(&builder->blocks, &offset, sizeof(offset));
+	}
+	
+	wd_indeximage_builder_add_string(builder, &builder->path, entry->path, head);
+	wd_indeximage_builder_add_string(builder, &builder->realpath, entry->realpath, head);
+	
+	memset(&record, 0, sizeof(record));
+	
+	record.rowid				= entry->rowid;
+	record.datasize				= entry->datasize;
+	record.rsrcsize				= entry->rsrcsize;
+	record.creationtime			= entry->creationtime;
+	record.modificationtime		= entry->modificationtime;
+	record.type					= entry->type;
+	record.directorycount		= entry->directorycount;
+	record.volume				= entry->volume;
+	record.label				= entry->label;
+	record.alias				= entry->alias ? 1 : 0;
+	record.executable			= entry->executable ? 1 : 0;
+	record.link					= entry->link ? 1 : 0;
+	
+	wd_indeximage_buffer_append(&builder->records, &record, sizeof(record));
+	
+	namelength = strlen(entry->name);
+	
+	for(i = 0; i + 3 <= namelength; i++) {
+		pair = ((uint64_t) wd_indeximage_trigram_key(entry->name + i) << 32) | builder->entries;
+		
+		wd_indeximage_buffer_append(&builder->pairs, &pair, sizeof(pair));
+	}
+	
+	builder->entries++;
+}
+
+
+
+wi_boolean_t wd_indeximage_builder_write(wd_indeximage_builder_t *builder, wi_string_t *path, wi_string_t *root) {
+	wd_indeximage_header_t		header;
+	wd_indeximage_rowid_t		*rowids;
+	wd_indeximage_record_t		*records;
+	wd_indeximage_trigram_t		*trigrams;
+	wi_string_t					*temporarypath;
+	uint64_t					*pairs;
+	uint32_t					*order, *ranks, *postings;
+	wi_uinteger_t				i, count, trigramscount, postingscount;
+	wi_boolean_t				result;
+	int							fd;
+	
+	records	= (wd_indeximage_record_t *) builder->records.bytes;
+	pairs	= (uint64_t *) builder->pairs.bytes;
+	count	= builder->pairs.length / sizeof(uint64_t);
+	
+	/* entries are stored in path order, but searched in rowid order */
+	rowids	= wi_malloc((builder->entries + 1) * sizeof(wd_indeximage_rowid_t));
+	order	= wi_malloc((builder->entries + 1) * sizeof(uint32_t));
+	ranks	= wi_malloc((builder->entries + 1) * sizeof(uint32_t));
+	
+	for(i = 0; i < builder->entries; i++) {
+		rowids[i].rowid	= records[i].rowid;
+		rowids[i].index	= i;
+	}
+	
+	qsort(rowids, builder->entries, sizeof(wd_indeximage_rowid_t), wd_indeximage_builder_compare_rowids);
+	
+	for(i = 0; i < builder->entries; i++) {
+		order[i]				= rowids[i].index;
+		ranks[rowids[i].index]	= i;
+	}
+	
+	for(i = 0; i < count; i++)
+		pairs[i] = (pairs[i] & 0xFFFFFFFF00000000ULL) | ranks[pairs[i] & 0xFFFFFFFF];
+	
+	qsort(pairs, count, sizeof(uint64_t), wd_indeximage_builder_compare_pairs);
+	
+	trigrams		= wi_malloc((count + 1) * sizeof(wd_indeximage_trigram_t));
+	postings		= wi_malloc((count + 1) * sizeof(uint32_t));
+	trigramscount	= 0;
+	postingscount	= 0;
+	
+	for(i = 0; i < count; i++) {
+		/* a name that repeats a trigram is listed once */
+		if(i > 0 && pairs[i] == pairs[i - 1])
+			continue;
+		
+		if(trigramscount == 0 || trigrams[trigramscount - 1].trigram != (uint32_t) (pairs[i] >> 32)) {
+			trigrams[trigramscount].trigram	= pairs[i] >> 32;
+			trigrams[trigramscount].count	= 0;
+			trigrams[trigramscount].offset	= postingscount;
+			trigramscount++;
+		}
+		
+		trigrams[trigramscount - 1].count++;
+		postings[postingscount++] = pairs[i] & 0xFFFFFFFF;
+	}
+	
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, WD_INDEXIMAGE_MAGIC, sizeof(header.magic));
+	
+	header.version			= WD_INDEXIMAGE_VERSION;
+	header.byteorder		= WD_INDEXIMAGE_BYTE_ORDER;
+	header.entries			= builder->entries;
+	header.trigrams			= trigramscount;
+	header.rootlength		= wi_string_length(root);
+	header.postings			= postingscount;
+	header.root_offset		= sizeof(header);
+	header.blocks_offset	= WD_INDEXIMAGE_ALIGN(header.root_offset + header.rootlength + 1);
+	header.paths_offset		= header.blocks_offset + builder->blocks.length;
+	header.records_offset	= WD_INDEXIMAGE_ALIGN(header.paths_offset + builder->paths.length);
+	header.order_offset		= header.records_offset + builder->records.length;
+	header.trigrams_offset	= WD_INDEXIMAGE_ALIGN(header.order_offset + (builder->entries * sizeof(uint32_t)));
+	header.postings_offset	= header.trigrams_offset + (trigramscount * sizeof(wd_indeximage_trigram_t));
+	header.size				= header.postings_offset + (postingscount * sizeof(uint32_t));
+	
+	/* written beside the old image and renamed over it, so a mapping never sees a partial file */
+	temporarypath	= wi_string_by_appending_string(path, WI_STR(".tmp"));
+	fd				= open(wi_string_cstring(temporarypath), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	result			= false;
+	
+	if(fd >= 0) {
+		result = (wd_indeximage_write_bytes(fd, &header, sizeof(header), 0) &&
+				  wd_indeximage_write_bytes(fd, wi_string_cstring(root), header.rootlength, header.blocks_offset - header.root_offset - header.rootlength) &&
+				  wd_indeximage_write_bytes(fd, builder->blocks.bytes, builder->blocks.length, 0) &&
+				  wd_indeximage_write_bytes(fd, builder->paths.bytes, builder->paths.length, header.records_offset - header.paths_offset - builder->paths.length) &&
+				  wd_indeximage_write_bytes(fd, builder->records.bytes, builder->records.length, 0) &&
+				  wd_indeximage_write_bytes(fd, order, builder->entries * sizeof(uint32_t), header.trigrams_offset - header.order_offset - (builder->entries * sizeof(uint32_t))) &&
+				  wd_indeximage_write_bytes(fd, trigrams, trigramscount * sizeof(wd_indeximage_trigram_t), 0) &&
+				  wd_indeximage_write_bytes(fd, postings, postingscount * sizeof(uint32_t), 0) &&
+				  fsync(fd) == 0);
+		
+		if(!result)
+			wi_error_set_errno(errno);
+		
+		close(fd);
+		
+		if(result && rename(wi_string_cstring(temporarypath), wi_string_cstring(path)) < 0) {
+			wi_error_set_errno(errno);
+			
+			result = false;
+		}
+		
+		if(!result)
+			unlink(wi_string_cstring(temporarypath));
+	} else {
+		wi_error_set_errno(errno);
+	}
+	
+	wi_free(rowids);
+	wi_free(order);
+	wi_free(ranks);
+	wi_free(trigrams);
+	wi_free(postings);
+	
+	return result;
+}
+
+
+
+#pragma mark -
+
+static void wd_indeximage_builder_add_string(wd_indeximage_builder_t *builder, wd_indeximage_buffer_t *previous, const char *string, wi_boolean_t head) {
+	wi_uinteger_t		length, shared;
+	
+	length	= strlen(string);
+	shared	= 0;
+	
+	if(!head) {
+		while(shared < length && shared < previous->length && string[shared] == (char) previous->bytes[shared])
+			shared++;
+	}
+	
+	wd_indeximage_buffer_append_varint(&builder->paths, shared);
+	wd_indeximage_buffer_append_varint(&builder->paths, length - shared);
+	wd_indeximage_buffer_append(&builder->paths, string + shared, length - shared);
+	
+	previous->length = 0;
+	
+	wd_indeximage_buffer_append(previous, string, length);
+}
+
+
+
+static int wd_indeximage_builder_compare_rowids(const void *p1, const void *p2) {
+	const wd_indeximage_rowid_t		*rowid1 = p1, *rowid2 = p2;
+	
+	if(rowid1->rowid < rowid2->rowid)
+		return -1;
+	else if(rowid1->rowid > rowid2->rowid)
+		return 1;
+	
+	return 0;
+}
+
+
+
+static int wd_indeximage_builder_compare_pairs(const void *p1, const void *p2) {
+	uint64_t		pair1 = *(const uint64_t *) p1, pair2 = *(const uint64_t *) p2;
+	
+	if(pair1 < pair2)
+		return -1;
+	else if(pair1 > pair2)
+		return 1;
+	
+	return 0;
+}
+
+
+
+#pragma mark -
+
+static void wd_indeximage_buffer_reserve(wd_indeximage_buffer_t *buffer, wi_uinteger_t capacity) {
+	if(capacity <= buffer->capacity)
+		return;
+	
+	if(buffer->capacity == 0)
+		buffer->capacity = 256;
+	
+	while(buffer->capacity < capacity)
+		buffer->capacity *= 2;
+	
+	buffer->bytes = wi_realloc(buffer->bytes, buffer->capacity);
+}
+
+
+
+static void wd_indeximage_buffer_append(wd_indeximage_buffer_t *buffer, const void *bytes, wi_uinteger_t length) {
+	wd_indeximage_buffer_reserve(buffer, buffer->length + length);
+	
+	memcpy(buffer->bytes + buffer->length, bytes, length);
+	
+	buffer->length += length;
+}
+
+
+
+static void wd_indeximage_buffer_append_varint(wd_indeximage_buffer_t *buffer, uint64_t value) {
+	unsigned char		bytes[10];
+	wi_uinteger_t		length = 0;
+	
+	do {
+		bytes[length] = value & 0x7F;
+		value >>= 7;
+		
+		if(value > 0)
+			bytes[length] |= 0x80;
+		
+		length++;
+	} while(value > 0);
+	
+	wd_indeximage_buffer_append(buffer, bytes, length);
+}
+
+
+
+static void wd_indeximage_buffer_free(wd_indeximage_buffer_t *buffer) {
+	if(buffer->bytes)
+		wi_free(buffer->bytes);
+	
+	memset(buffer, 0, sizeof(*buffer));
+}
+
+
+
+static wi_boolean_t wd_indeximage_read_varint(const unsigned char **position, const unsigned char *end, uint64_t *value) {
+	wi_uinteger_t		shift = 0;
+	
+	*value = 0;
+	
+	while(*position < end && shift < 64) {
+		*value |= (uint64_t) (**position & 0x7F) << shift;
+		
+		if((*(*position)++ & 0x80) == 0)
+			return true;
+		
+		shift += 7;
+	}
+	
+	return false;
+}
+
+
+
+static wi_boolean_t wd_indeximage_write_bytes(int fd, const void *bytes, uint64_t length, uint64_t padding) {
+	static const char	zeroes[8];
+	const char			*position = bytes;
+	ssize_t				bytes_written;
+	
+	while(length > 0) {
+		bytes_written = write(fd, position, length);
+		
+		if(bytes_written < 0) {
+			if(errno == EINTR)
+				continue;
+			
+			return false;
+		}
+		
+		position	+= bytes_written;
+		length		-= bytes_written;
+	}
+	
+	return (padding == 0 || wd_indeximage_write_bytes(fd, zeroes, padding, 0));
+}
+
+
+
+static uint32_t wd_indeximage_trigram_key(const char *string) {
+	unsigned char		c0, c1, c2;
+	
+	c0 = string[0];
+	c1 = string[1];
+	c2 = string[2];
+	
+	if(c0 >= 'A' && c0 <= 'Z')
+		c0 += 'a' - 'A';
+	
+	if(c1 >= 'A' && c1 <= 'Z')
+		c1 += 'a' - 'A';
+	
+	if(c2 >= 'A' && c2 <= 'Z')
+		c2 += 'a' - 'A';
+	
+	return ((uint32_t) c0 << 16) | ((uint32_t) c1 << 8) | c2;
+}
@@ -0,0 +1,86 @@
+/* $Id$ */
+
+/*
+ *  Copyright (c) 2003-2009 Axel Andersson
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef WD_INDEXIMAGE_H
+#define WD_INDEXIMAGE_H 1
+
+#include <wired/wired.h>
+
+
+struct _wd_indeximage_entry {
+	wi_integer_t						rowid;
+	const char							*path;
+	const char							*name;
+	const char							*realpath;
+	wi_boolean_t						alias;
+	
+	wi_uinteger_t						type;
+	wi_file_offset_t					datasize;
+	wi_file_offset_t					rsrcsize;
+	wi_uinteger_t						directorycount;
+	int64_t								creationtime;
+	int64_t								modificationtime;
+	wi_uinteger_t						volume;
+	wi_uinteger_t						label;
+	wi_boolean_t						executable;
+	wi_boolean_t						link;
+};
+typedef struct _wd_indeximage_entry		wd_indeximage_entry_t;
+
+struct _wd_indeximage_filter {
+	wi_uinteger_t						types;
+	wi_file_offset_t					minsize;
+	wi_file_offset_t					maxsize;
+	int64_t								after;
+	int64_t								before;
+	const char							*extension;
+};
+typedef struct _wd_indeximage_filter	wd_indeximage_filter_t;
+
+typedef wi_boolean_t					wd_indeximage_search_func_t(wd_indeximage_entry_t *, void *);
+
+typedef struct _wd_indeximage			wd_indeximage_t;
+typedef struct _wd_indeximage_builder	wd_indeximage_builder_t;
+
+
+void									wd_indeximage_initialize(void);
+
+wd_indeximage_t *						wd_indeximage_alloc(void);
+wd_indeximage_t *						wd_indeximage_init_with_path(wd_indeximage_t *, wi_string_t *, wi_string_t *);
+
+wi_uinteger_t							wd_indeximage_count(wd_indeximage_t *);
+wi_boolean_t							wd_indeximage_match(const char *, const char *, wi_uinteger_t);
+wi_boolean_t							wd_indeximage_search(wd_indeximage_t *, const char *, const char *, const wd_indeximage_filter_t *, wi_integer_t, wi_time_interval_t, wi_integer_t *, wd_indeximage_search_func_t *, void *);
+
+wd_indeximage_builder_t *				wd_indeximage_builder_open(void);
+void									wd_indeximage_builder_close(wd_indeximage_builder_t *);
+
+void									wd_indeximage_builder_add(wd_indeximage_builder_t *, wd_indeximage_entry_t *);
+wi_boolean_t							wd_indeximage_builder_write(wd_indeximage_builder_t *, wi_string_t *, wi_string_t *);
+
+#endif /* WD_INDEXIMAGE_H */
@@ -53,6 +53,8 @@
 #include "trackers.h"
 #include "transfers.h"
 
+#define WD_DATABASE_BUSY_TIMEOUT		30000
+
 static void						wd_cleanup(void);
 static void						wd_usage(void);
 static void						wd_version(void);
@@ -100,7 +102,7 @@ int main(int argc, const char **argv) {
 	wi_string_t				*string, *root_path, *user, *group;
 	uint32_t				uid, gid;
 	int						ch, facility;
-	wi_boolean_t			test_config, daemonize, change_directory, switch_user;
+	wi_boolean_t			test_config, import_metadata, daemonize, change_directory, switch_user;
 
 	wi_initialize();
 	wi_load(argc, argv);
@@ -114,6 +116,7 @@ int main(int argc, const char **argv) {
 	wd_status_lock			= wi_lock_init(wi_lock_alloc());
 	wd_start_date			= wi_date_init(wi_date_alloc());
 	test_config				= false;
+	import_metadata			= false;
 	daemonize				= true;
 	change_directory		= true;
 	switch_user				= true;
@@ -122,7 +125,7 @@ int main(int argc, const char **argv) {
 	arguments				= wi_array_init(wi_mutable_array_alloc());
 	root_path				= WI_STR(WD_ROOT);
 
-	while((ch = getopt(argc, (char * const *) argv, "46Dd:f:hi:L:ls:tuVvXx")) != -1) {
+	while((ch = getopt(argc, (char * const *) argv, "46Dd:f:hi:L:lms:tuVvXx")) != -1) {
 		switch(ch) {
 			case '4':
 				wd_address_family = WI_ADDRESS_IPV4;
@@ -165,6 +168,12 @@ int main(int argc, const char **argv) {
 				wi_log_level++;
 				break;
 
+			case 'm':
+				import_metadata = true;
+				daemonize = false;
+				wi_log_stderr = true;
+				break;
+
 			case 's':
 				string = wi_string_with_cstring(optarg);
 				facility = wi_log_syslog_facility_with_name(string);
@@ -266,6 +275,9 @@ int main(int argc, const char **argv) {
 		exit(0);
 	}
 	
+	if(import_metadata)
+		exit(wd_files_import_metadata() ? 0 : 1);
+	
 	wi_log_info(WI_STR("Started as %@ %@"),
 		wi_process_path(wi_process()),
 		wi_array_components_joined_by_string(wi_process_arguments(wi_process()), WI_STR(" ")));
@@ -328,7 +340,7 @@ static void wd_cleanup(void) {
 
 static void wd_usage(void) {
 	fprintf(stderr,
-"Usage: wired [-Dllhtuv] [-d path] [-f file] [-i lines] [-L file] [-s facility]\n\
+"Usage: wired [-Dllhmtuv] [-d path] [-f file] [-i lines] [-L file] [-s facility]\n\
 \n\
 Options:\n\
     -4             listen on IPv4 addresses only\n\
@@ -340,6 +352,7 @@ Options:\n\
     -i lines       set limit on number of lines for -L\n\
     -L file        set alternate file for log output\n\
     -l             increase log level (can be used twice)\n\
+    -m             import .wired metadata into the database and exit\n\
     -s facility    set the syslog(3) facility\n\
     -t             run syntax test on config\n\
     -u             do not chroot(2) to root path\n\
@@ -404,7 +417,7 @@ void wd_write_status(wi_boolean_t force) {
 			: WI_STR("users")));
 
 	path = WI_STR("wired.status");
-	string = wi_string_with_format(WI_STR("%.0f %u %u %u %u %u %u %llu %llu %u %u %llu %llu\n"),
+	string = wi_string_with_format(WI_STR("%.0f %u %u %u %u %u %u %llu %llu %u %u %llu %llu %u %u %u %u\n"),
 								   wi_date_time_interval(wd_start_date),
 								   wd_current_users,
 								   wd_total_users,
@@ -417,7 +430,11 @@ void wd_write_status(wi_boolean_t force) {
 								   wd_tracker_current_servers,
 								   wd_tracker_current_users,
 								   wd_tracker_current_files,
-								   wd_tracker_current_size);
+								   wd_tracker_current_size,
+								   wd_index_search_cache_hits,
+								   wd_index_search_cache_misses,
+								   wd_index_search_cache_count,
+								   wd_index_search_cache_size);
 	
 	if(!wi_string_write_to_file(string, path))
 		wi_log_error(WI_STR("Could not write to \"%@\": %m"), path);
@@ -439,10 +456,7 @@ static void wd_delete_status(void) {
 #pragma mark -
 
 static void wd_database_open(void) {
-	wd_database = wi_retain(wi_sqlite3_open_database_with_path(WI_STR("database.sqlite3")));
-	
-	if(!wd_database)
-		wi_log_fatal(WI_STR("Could not open \"database.sqlite3\": %m"));
+	wd_database = wi_retain(wd_database_open_connection());
 	
 	if(!wi_sqlite3_execute_statement(wd_database, WI_STR("CREATE TABLE IF NOT EXISTS versions ( "
 														 "name TEXT PRIMARY KEY NOT NULL, "
@@ -461,6 +475,23 @@ static void wd_database_close(void) {
 
 
 
+wi_sqlite3_database_t * wd_database_open_connection(void) {
+	wi_sqlite3_database_t		*database;
+	
+	database = wi_sqlite3_open_database_with_path(WI_STR("database.sqlite3"));
+	
+	if(!database)
+		wi_log_fatal(WI_STR("Could not open \"database.sqlite3\": %m"));
+	
+	/* connections wait for each other's write transactions instead of failing */
+	if(!wi_sqlite3_execute_statement(database, wi_string_with_format(WI_STR("PRAGMA busy_timeout = %u"), WD_DATABASE_BUSY_TIMEOUT), NULL))
+		wi_log_error(WI_STR("Could not execute database statement: %m"));
+	
+	return database;
+}
+
+
+
 void wd_database_set_version_for_table(wi_uinteger_t version, wi_string_t *table) {
 	if(!wi_sqlite3_execute_statement(wd_database, WI_STR("DELETE FROM versions WHERE name = ?"),
 									 table,
@@ -37,6 +37,7 @@ typedef struct _wd_chat				wd_chat_t;
 
 void								wd_write_status(wi_boolean_t);
 
+wi_sqlite3_database_t *				wd_database_open_connection(void);
 void								wd_database_set_version_for_table(wi_uinteger_t, wi_string_t *);
 wi_uinteger_t						wd_database_version_for_table(wi_string_t *);
 
@@ -2712,7 +2712,7 @@ static void wd_message_transfer_download_file(wd_user_t *user, wi_p7_message_t *
 
 
 static void wd_message_transfer_upload_file(wd_user_t *user, wi_p7_message_t *message) {
-	wi_string_t				*path, *realpath, *realparentpath;
+	wi_string_t				*path, *realpath, *realparentpath, *digest;
 	wd_account_t			*account;
 	wd_files_privileges_t	*privileges;
 	wd_transfer_t			*transfer;
@@ -2766,6 +2766,21 @@ static void wd_message_transfer_upload_file(wd_user_t *user, wi_p7_message_t *me
 	
 	if(!wi_p7_message_get_bool_for_name(message, &executable, WI_STR("wired.file.executable")))
 		executable = false;
+	
+	digest = wi_p7_message_string_for_name(message, WI_STR("wired.transfer.data_digest"));
+	
+	if(digest && rsrcsize == 0 && wd_account_transfer_download_files(account)) {
+		if(wd_transfers_link_upload_with_digest(path, digest, datasize, executable, user)) {
+			wd_events_add_event(WI_STR("wired.event.transfer.completed_file_upload"), user,
+				wd_files_virtual_path(path, user),
+				WI_STR("0"),
+				NULL);
+			
+			wd_user_reply_okay(user, message);
+			
+			return;
+		}
+	}
 
 	transfer = wd_transfer_upload_transfer(path, datasize, rsrcsize, executable, user, message);
 	
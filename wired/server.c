@@ -38,6 +38,7 @@
 
 #include <sys/types.h>
 #include <netinet/in.h>
+#include <arpa/inet.h>
 #include <stdarg.h>
 #include <wired/wired.h>
 
@@ -1001,6 +1002,66 @@ void wd_user_reply_internal_error(wd_user_t *user, wi_string_t *string, wi_p7_me
 
 
 
+void wd_user_begin_batch(wd_batch_t *batch, wd_user_t *user, wi_p7_message_t *message) {
+	wi_p7_uint32_t		count;
+	
+	batch->user		= user;
+	batch->message	= message;
+	batch->data		= NULL;
+	batch->count	= 0;
+	
+	if(wi_p7_message_get_uint32_for_name(message, &count, WI_STR("wired.batch.count")) && count > 1)
+		batch->limit = WI_MIN(count, WD_BATCH_MAX_COUNT);
+	else
+		batch->limit = 0;
+}
+
+
+
+void wd_user_batch_reply_message(wd_batch_t *batch, wi_p7_message_t *reply) {
+	wi_data_t		*data;
+	uint32_t		length;
+	
+	if(batch->limit == 0) {
+		wd_user_reply_message(batch->user, reply, batch->message);
+		
+		return;
+	}
+	
+	data	= wi_p7_message_data_with_serialization(reply, WI_P7_BINARY);
+	length	= htonl(wi_data_length(data));
+	
+	if(!batch->data)
+		batch->data = wi_data_init_with_capacity(wi_mutable_data_alloc(), WD_BATCH_MAX_SIZE);
+	
+	wi_mutable_data_append_bytes(batch->data, &length, sizeof(length));
+	wi_mutable_data_append_data(batch->data, data);
+	
+	if(++batch->count >= batch->limit || wi_data_length(batch->data) >= WD_BATCH_MAX_SIZE)
+		wd_user_end_batch(batch);
+}
+
+
+
+void wd_user_end_batch(wd_batch_t *batch) {
+	wi_p7_message_t		*reply;
+	
+	if(batch->count == 0)
+		return;
+	
+	reply = wi_p7_message_with_name(WI_STR("wired.batch"), wd_p7_spec);
+	wi_p7_message_set_uint32_for_name(reply, batch->count, WI_STR("wired.batch.count"));
+	wi_p7_message_set_data_for_name(reply, batch->data, WI_STR("wired.batch.messages"));
+	wd_user_reply_message(batch->user, reply, batch->message);
+	
+	wi_release(batch->data);
+	
+	batch->data		= NULL;
+	batch->count	= 0;
+}
+
+
+
 void wd_broadcast_message(wi_p7_message_t *message) {
 	wi_enumerator_t		*enumerator;
 	wd_user_t			*user;
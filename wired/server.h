@@ -36,6 +36,19 @@
 #define WD_DNSSD_NAME				"_wired._tcp"
 #define WD_SERVER_PORT				4871
 
+#define WD_BATCH_MAX_COUNT			1000
+#define WD_BATCH_MAX_SIZE			(64 * 1024)
+
+
+struct _wd_batch {
+	wd_user_t						*user;
+	wi_p7_message_t					*message;
+	wi_mutable_data_t				*data;
+	wi_uinteger_t					limit;
+	wi_uinteger_t					count;
+};
+typedef struct _wd_batch			wd_batch_t;
+
 
 void								wd_server_initialize(void);
 void								wd_server_schedule(void);
@@ -57,6 +70,9 @@ void								wd_user_reply_okay(wd_user_t *, wi_p7_message_t *);
 void								wd_user_reply_error(wd_user_t *, wi_string_t *, wi_p7_message_t *);
 void								wd_user_reply_file_errno(wd_user_t *, wi_p7_message_t *);
 void								wd_user_reply_internal_error(wd_user_t *, wi_string_t *, wi_p7_message_t *);
+void								wd_user_begin_batch(wd_batch_t *, wd_user_t *, wi_p7_message_t *);
+void								wd_user_batch_reply_message(wd_batch_t *, wi_p7_message_t *);
+void								wd_user_end_batch(wd_batch_t *);
 void								wd_broadcast_message(wi_p7_message_t *);
 void								wd_chat_broadcast_message(wd_chat_t *, wi_p7_message_t *);
 
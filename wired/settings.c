@@ -49,6 +49,9 @@ void wd_settings_initialize(void) {
 		WI_INT32(WI_CONFIG_PATH),				WI_STR("banner"),
 		WI_INT32(WI_CONFIG_STRINGLIST),			WI_STR("category"),
 		WI_INT32(WI_CONFIG_STRING),				WI_STR("description"),
+		WI_INT32(WI_CONFIG_BOOL),				WI_STR("compress transfers"),
+		WI_INT32(WI_CONFIG_INTEGER),			WI_STR("compression cache"),
+		WI_INT32(WI_CONFIG_BOOL),				WI_STR("deduplicate uploads"),
 		WI_INT32(WI_CONFIG_BOOL),				WI_STR("enable tracker"),
 		WI_INT32(WI_CONFIG_PATH),				WI_STR("files"),
 		WI_INT32(WI_CONFIG_BOOL),				WI_STR("force encryption"),
@@ -57,18 +60,25 @@ void wd_settings_initialize(void) {
 		WI_INT32(WI_CONFIG_BOOL),				WI_STR("snapshots"),
         WI_INT32(WI_CONFIG_TIME_INTERVAL),		WI_STR("snapshot time"),
         WI_INT32(WI_CONFIG_STRING),				WI_STR("events time"),
+		WI_INT32(WI_CONFIG_BOOL),				WI_STR("index image"),
+		WI_INT32(WI_CONFIG_INTEGER),			WI_STR("index threads"),
 		WI_INT32(WI_CONFIG_TIME_INTERVAL),		WI_STR("index time"),
 		WI_INT32(WI_CONFIG_STRING),				WI_STR("ip"),
 		WI_INT32(WI_CONFIG_BOOL),				WI_STR("map port"),
+		WI_INT32(WI_CONFIG_BOOL),				WI_STR("metadata database"),
 		WI_INT32(WI_CONFIG_STRING),				WI_STR("name"),
 		WI_INT32(WI_CONFIG_PORT),				WI_STR("port"),
 		WI_INT32(WI_CONFIG_BOOL),				WI_STR("register"),
+		WI_INT32(WI_CONFIG_INTEGER),			WI_STR("search cache"),
+		WI_INT32(WI_CONFIG_INTEGER),			WI_STR("search limit"),
+		WI_INT32(WI_CONFIG_TIME_INTERVAL),		WI_STR("search time"),
 		WI_INT32(WI_CONFIG_INTEGER),			WI_STR("total download speed"),
 		WI_INT32(WI_CONFIG_INTEGER),			WI_STR("total downloads"),
 		WI_INT32(WI_CONFIG_INTEGER),			WI_STR("total upload speed"),
 		WI_INT32(WI_CONFIG_INTEGER),			WI_STR("total uploads"),
 		WI_INT32(WI_CONFIG_STRINGLIST),			WI_STR("tracker"),
 		WI_INT32(WI_CONFIG_USER),				WI_STR("user"),
+		WI_INT32(WI_CONFIG_BOOL),				WI_STR("verify search results"),
 		NULL);
 	
 	defaults = wi_dictionary_with_data_and_keys(
@@ -76,6 +86,9 @@ void wd_settings_initialize(void) {
 		WI_STR("banner.png"),					WI_STR("banner"),
 		wi_array(),								WI_STR("category"),
 		WI_STR("Wired Server"),					WI_STR("description"),
+		wi_number_with_bool(false),				WI_STR("compress transfers"),
+		WI_INT32(1024),							WI_STR("compression cache"),
+		wi_number_with_bool(false),				WI_STR("deduplicate uploads"),
 		wi_number_with_bool(false),				WI_STR("enable tracker"),
 		WI_STR("files"),						WI_STR("files"),
 		wi_number_with_bool(true),				WI_STR("force encryption"),
@@ -84,17 +97,24 @@ void wd_settings_initialize(void) {
 		wi_number_with_bool(true),				WI_STR("snapshots"),
         WI_INT32(86400),						WI_STR("snapshot time"),
         WI_STR("none"),							WI_STR("events time"),
+		wi_number_with_bool(false),				WI_STR("index image"),
+		WI_INT32(4),							WI_STR("index threads"),
 		WI_INT32(3600),							WI_STR("index time"),
 		wi_number_with_bool(false),				WI_STR("map port"),
+		wi_number_with_bool(false),				WI_STR("metadata database"),
 		WI_STR("Wired Server"),					WI_STR("name"),
 		WI_INT32(4871),							WI_STR("port"),
 		wi_number_with_bool(false),				WI_STR("register"),
+		WI_INT32(100),							WI_STR("search cache"),
+		WI_INT32(1000),							WI_STR("search limit"),
+		WI_INT32(10),							WI_STR("search time"),
 		WI_INT32(0),							WI_STR("total download speed"),
 		WI_INT32(10),							WI_STR("total downloads"),
 		WI_INT32(0),							WI_STR("total upload speed"),
 		WI_INT32(10),							WI_STR("total uploads"),
 		wi_array(),								WI_STR("tracker"),
 		WI_STR("wired"),						WI_STR("user"),
+		wi_number_with_bool(false),				WI_STR("verify search results"),
 		NULL);
 	
 	wd_config = wi_config_init_with_path(wi_config_alloc(), wd_config_path, types, defaults);
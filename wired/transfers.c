@@ -28,6 +28,8 @@
 
 #include "config.h"
 
+#include <sys/ioctl.h>
+#include <sys/time.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
@@ -36,6 +38,14 @@
 #include <openssl/err.h>
 #include <wired/wired.h>
 
+#ifdef HAVE_ZLIB_H
+#include <zlib.h>
+#endif
+
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+
 #include "files.h"
 #include "index.h"
 #include "main.h"
@@ -50,6 +60,16 @@
 
 #define WD_TRANSFERS_TIMEOUT				30.0
 
+#define WD_TRANSFERS_DEDUPLICATE_MIN_SIZE	65536
+
+#define WD_TRANSFERS_COMPRESSION_PATH		"compressed"
+#define WD_TRANSFERS_COMPRESSION_MIN_SIZE	16384
+#define WD_TRANSFERS_COMPRESSION_SAMPLE_SIZE	65536
+#define WD_TRANSFERS_COMPRESSION_MAX_RATIO	0.9
+#define WD_TRANSFERS_COMPRESSION_DOWNLOADS	2
+#define WD_TRANSFERS_COMPRESSION_MAX_FILES	10000
+#define WD_TRANSFERS_COMPRESSION_QUEUE_SIZE	16
+
 
 enum _wd_transfers_statistics_type {
 	WD_TRANSFER_STATISTICS_ADD,
@@ -59,6 +79,8 @@ enum _wd_transfers_statistics_type {
 typedef enum _wd_transfers_statistics_type	wd_transfers_statistics_type_t;
 
 
+static void									wd_transfers_create_tables(void);
+
 static void									wd_transfers_queue_thread(wi_runtime_instance_t *);
 static wi_integer_t							wd_transfers_queue_compare(wi_runtime_instance_t *, wi_runtime_instance_t *);
 static wi_boolean_t							wd_transfers_wait_until_ready(wd_transfer_t *, wd_user_t *, wi_p7_message_t *);
@@ -68,6 +90,20 @@ static wi_string_t *						wd_transfers_transfer_key_for_user(wd_user_t *);
 static void									wd_transfers_add_or_remove_transfer(wd_transfer_t *, wi_boolean_t);
 static void									wd_transfers_note_statistics(wd_transfer_type_t, wd_transfers_statistics_type_t, wi_file_offset_t);
 
+static void									wd_transfers_deduplicate_upload(wd_transfer_t *, wi_string_t *);
+static wi_string_t *						wd_transfers_duplicate_path_for_digest(wi_string_t *, wi_file_offset_t, wi_uinteger_t, wi_boolean_t, wd_user_t *);
+static void									wd_transfers_add_digest_for_path(wi_string_t *, wi_string_t *);
+static wi_boolean_t							wd_transfers_clone_path(wi_string_t *, wi_string_t *);
+static wi_string_t *						wd_transfers_digest_string(unsigned char *);
+
+#ifdef HAVE_ZLIB_H
+static wi_boolean_t							wd_transfers_compress_download(wd_transfer_t *);
+static void									wd_transfers_compress_thread(wi_runtime_instance_t *);
+static void									wd_transfers_compress_path(wi_string_t *, wi_string_t *, wi_string_t *);
+static wi_boolean_t							wd_transfers_sample_is_compressible(int, wi_file_offset_t);
+static wi_boolean_t							wd_transfers_compress_file(int, wi_fs_stat_t *, wi_string_t *);
+#endif
+
 static wd_transfer_t *						wd_transfer_alloc(void);
 static wd_transfer_t *						wd_transfer_init(wd_transfer_t *);
 static void									wd_transfer_dealloc(wi_runtime_instance_t *);
@@ -90,6 +126,19 @@ static wi_uinteger_t						wd_transfers_active_downloads, wd_transfers_active_upl
 
 static wi_condition_lock_t					*wd_transfers_queue_lock;
 
+static wi_boolean_t							wd_transfers_deduplicate_uploads;
+
+static wi_boolean_t							wd_transfers_compress_downloads;
+static wi_lock_t							*wd_transfers_compression_lock;
+static wi_mutable_dictionary_t				*wd_transfers_compression_downloads;
+static wi_mutable_set_t						*wd_transfers_compression_running;
+static wi_mutable_dictionary_t				*wd_transfers_compression_sizes;
+static wi_mutable_array_t					*wd_transfers_compression_order;
+static wi_file_offset_t						wd_transfers_compression_size;
+static wi_file_offset_t						wd_transfers_compression_max_size;
+static wi_condition_lock_t					*wd_transfers_compression_queue_lock;
+static wi_mutable_array_t					*wd_transfers_compression_queue;
+
 static wi_runtime_id_t						wd_transfer_runtime_id = WI_RUNTIME_ID_NULL;
 static wi_runtime_class_t					wd_transfer_runtime_class = {
 	"wd_transfer_t",
@@ -116,6 +165,18 @@ void wd_transfers_initialize(void) {
 		0, wi_dictionary_default_key_callbacks, wi_dictionary_null_value_callbacks);
 	
 	wd_transfers_queue_lock = wi_condition_lock_init_with_condition(wi_condition_lock_alloc(), 0);
+	
+	wd_transfers_create_tables();
+	
+	wd_transfers_compression_lock		= wi_lock_init(wi_lock_alloc());
+	wd_transfers_compression_downloads	= wi_dictionary_init(wi_mutable_dictionary_alloc());
+	wd_transfers_compression_running	= wi_set_init(wi_mutable_set_alloc());
+	wd_transfers_compression_sizes		= wi_dictionary_init(wi_mutable_dictionary_alloc());
+	wd_transfers_compression_order		= wi_array_init(wi_mutable_array_alloc());
+	wd_transfers_compression_queue_lock	= wi_condition_lock_init_with_condition(wi_condition_lock_alloc(), 0);
+	wd_transfers_compression_queue		= wi_array_init(wi_mutable_array_alloc());
+	
+	wi_fs_delete_path(WI_STR(WD_TRANSFERS_COMPRESSION_PATH));
 }
 
 
@@ -125,6 +186,9 @@ void wd_transfers_apply_settings(wi_set_t *changes) {
 	wd_transfers_total_uploads			= wi_config_integer_for_name(wd_config, WI_STR("total uploads"));
 	wd_transfers_total_download_speed	= wi_config_integer_for_name(wd_config, WI_STR("total download speed"));
 	wd_transfers_total_upload_speed		= wi_config_integer_for_name(wd_config, WI_STR("total upload speed"));
+	wd_transfers_deduplicate_uploads	= wi_config_bool_for_name(wd_config, WI_STR("deduplicate uploads"));
+	wd_transfers_compress_downloads		= wi_config_bool_for_name(wd_config, WI_STR("compress transfers"));
+	wd_transfers_compression_max_size	= (wi_file_offset_t) wi_config_integer_for_name(wd_config, WI_STR("compression cache")) * 1024 * 1024;
 
 	wi_condition_lock_lock(wd_transfers_queue_lock);	
 	wi_condition_lock_unlock_with_condition(wd_transfers_queue_lock, 1);
@@ -135,6 +199,44 @@ void wd_transfers_apply_settings(wi_set_t *changes) {
 void wd_transfers_schedule(void) {
 	if(!wi_thread_create_thread(wd_transfers_queue_thread, NULL))
 		wi_log_fatal(WI_STR("Could not create a transfers queue thread: %m"));
+
+#ifdef HAVE_ZLIB_H
+	if(!wi_thread_create_thread_with_priority(wd_transfers_compress_thread, NULL, 0.0))
+		wi_log_fatal(WI_STR("Could not create a compression thread: %m"));
+#endif
+}
+
+
+
+#pragma mark -
+
+static void wd_transfers_create_tables(void) {
+	wi_uinteger_t		version;
+	
+	version = wd_database_version_for_table(WI_STR("digests"));
+	
+	switch(version) {
+		case 0:
+			if(!wi_sqlite3_execute_statement(wd_database, WI_STR("CREATE TABLE digests ( "
+																 "digest TEXT NOT NULL, "
+																 "size INTEGER NOT NULL, "
+																 "device INTEGER NOT NULL, "
+																 "inode INTEGER NOT NULL, "
+																 "real_path TEXT NOT NULL "
+																 ")"),
+											 NULL)) {
+				wi_log_fatal(WI_STR("Could not execute database statement: %m"));
+			}
+			
+			if(!wi_sqlite3_execute_statement(wd_database, WI_STR("CREATE INDEX digests_digest ON digests(digest)"), NULL))
+				wi_log_fatal(WI_STR("Could not execute database statement: %m"));
+			
+			if(!wi_sqlite3_execute_statement(wd_database, WI_STR("CREATE INDEX digests_real_path ON digests(real_path)"), NULL))
+				wi_log_fatal(WI_STR("Could not execute database statement: %m"));
+			break;
+	}
+	
+	wd_database_set_version_for_table(1, WI_STR("digests"));
 }
 
 
@@ -313,15 +415,33 @@ static wi_boolean_t wd_transfers_run_download(wd_transfer_t *transfer, wd_user_t
 	wi_p7_message_t		*reply;
 	wi_data_t			*data;
 	wi_p7_uint32_t		transaction;
+	wi_p7_enum_t		compression;
+	wi_file_offset_t	datasize;
 	wi_boolean_t		result;
 	
-	data = wi_fs_finder_info_for_path(transfer->realdatapath);
+	data		= wi_fs_finder_info_for_path(transfer->realdatapath);
+	datasize	= transfer->datasize;
+
+#ifdef HAVE_ZLIB_H
+	/* deflating again inside a compressed connection only costs cpu */
+	if(wd_transfers_compress_downloads && transfer->dataoffset == 0 &&
+	   !(wi_p7_socket_options(wd_user_p7_socket(user)) & WI_P7_COMPRESSION_DEFLATE) &&
+	   wi_p7_message_get_enum_for_name(message, &compression, WI_STR("wired.transfer.compression")) &&
+	   compression == WD_TRANSFER_COMPRESSION_DEFLATE) {
+		wd_transfers_compress_download(transfer);
+	}
+#endif
 	
 	reply = wi_p7_message_with_name(WI_STR("wired.transfer.download"), wd_p7_spec);
 	wi_p7_message_set_string_for_name(reply, transfer->path, WI_STR("wired.file.path"));
 	wi_p7_message_set_oobdata_for_name(reply, transfer->remainingdatasize, WI_STR("wired.transfer.data"));
 	wi_p7_message_set_oobdata_for_name(reply, transfer->remainingrsrcsize, WI_STR("wired.transfer.rsrc"));
 	wi_p7_message_set_data_for_name(reply, data ? data : wi_data(), WI_STR("wired.transfer.finderinfo"));
+	
+	if(transfer->compression != WD_TRANSFER_COMPRESSION_NONE) {
+		wi_p7_message_set_enum_for_name(reply, transfer->compression, WI_STR("wired.transfer.compression"));
+		wi_p7_message_set_uint64_for_name(reply, datasize, WI_STR("wired.transfer.data_size"));
+	}
 
 	if(wi_p7_message_get_uint32_for_name(message, &transaction, WI_STR("wired.transaction")))
 		wi_p7_message_set_uint32_for_name(reply, transaction, WI_STR("wired.transaction"));
@@ -415,6 +535,11 @@ static wi_boolean_t wd_transfers_run_upload(wd_transfer_t *transfer, wd_user_t *
 					wi_log_error(WI_STR("Could not set mode for \"%@\": %m"), path);
 			}
 			
+			if(transfer->digesting && wi_data_length(transfer->finderinfo) == 0)
+				wd_transfers_deduplicate_upload(transfer, path);
+			
+			wd_files_invalidate_path(path);
+			
 			wd_files_move_comment(transfer->realdatapath, path, NULL, NULL);
 			wd_files_move_label(transfer->realdatapath, path, NULL, NULL);
 			
@@ -767,6 +892,13 @@ wd_transfer_t * wd_transfer_upload_transfer(wi_string_t *path, wi_file_offset_t
 	else
 		dataoffset = 0;
 	
+	if(dataoffset > 0 && !wd_files_unshare_path(realdatapath)) {
+		wi_log_error(WI_STR("Could not copy \"%@\" for upload: %m"), realdatapath);
+		wd_user_reply_file_errno(user, message);
+		
+		return NULL;
+	}
+	
 	datafd = open(wi_string_cstring(realdatapath), O_WRONLY | O_APPEND | O_CREAT, 0666);
 	
 	if(datafd < 0) {
@@ -849,6 +981,12 @@ wd_transfer_t * wd_transfer_upload_transfer(wi_string_t *path, wi_file_offset_t
 	transfer->remainingdatasize		= datasize - dataoffset;
 	transfer->remainingrsrcsize		= rsrcsize - rsrcoffset;
 	
+	if(wd_transfers_deduplicate_uploads && dataoffset == 0 && rsrcsize == 0 && datasize >= WD_TRANSFERS_DEDUPLICATE_MIN_SIZE) {
+		SHA256_Init(&transfer->digest_context);
+		
+		transfer->digesting			= true;
+	}
+	
 	return wi_autorelease(transfer);
 }
 
@@ -1204,6 +1342,9 @@ static wi_boolean_t wd_transfer_upload(wd_transfer_t *transfer) {
 			break;
 		}
 
+		if(data && transfer->digesting)
+			SHA256_Update(&transfer->digest_context, buffer, writtenbytes);
+
 		if(data)
 			transfer->remainingdatasize		-= readbytes;
 		else
@@ -1260,3 +1401,548 @@ static wi_boolean_t wd_transfer_upload(wd_transfer_t *transfer) {
 	
 	return result;
 }
+
+
+
+#pragma mark -
+
+static void wd_transfers_deduplicate_upload(wd_transfer_t *transfer, wi_string_t *path) {
+	wi_string_t			*digest, *duplicatepath;
+	wi_fs_stat_t		sb;
+	unsigned char		buffer[SHA256_DIGEST_LENGTH];
+	
+	SHA256_Final(buffer, &transfer->digest_context);
+	
+	transfer->digesting = false;
+	
+	if(!wi_fs_lstat_path(path, &sb) || !S_ISREG(sb.mode) || (wi_file_offset_t) sb.size != transfer->datasize)
+		return;
+	
+	digest			= wd_transfers_digest_string(buffer);
+	duplicatepath	= wd_transfers_duplicate_path_for_digest(digest, sb.size, sb.dev, (sb.mode & 0111), NULL);
+	
+	if(duplicatepath && !wi_is_equal(duplicatepath, path)) {
+		/* the partial path is free again after the rename, use it to swap in the copy atomically */
+		if(!wd_transfers_clone_path(duplicatepath, transfer->realdatapath)) {
+			wi_log_error(WI_STR("Could not link \"%@\" to \"%@\": %m"),
+				duplicatepath, transfer->realdatapath);
+		}
+		else if(rename(wi_string_cstring(transfer->realdatapath), wi_string_cstring(path)) < 0) {
+			wi_log_error(WI_STR("Could not move \"%@\" to \"%@\": %s"),
+				transfer->realdatapath, path, strerror(errno));
+			
+			unlink(wi_string_cstring(transfer->realdatapath));
+		}
+		else {
+			wi_log_info(WI_STR("Linked uploaded \"%@\" to identical \"%@\", saving %@"),
+				path, duplicatepath, wd_files_string_for_bytes(sb.size));
+		}
+	}
+	
+	wd_transfers_add_digest_for_path(digest, path);
+}
+
+
+
+static wi_string_t * wd_transfers_duplicate_path_for_digest(wi_string_t *digest, wi_file_offset_t size, wi_uinteger_t device, wi_boolean_t executable, wd_user_t *user) {
+	wi_sqlite3_statement_t		*statement;
+	wi_dictionary_t				*results;
+	wi_mutable_array_t			*stalepaths;
+	wi_string_t					*path, *rootpath, *virtualpath, *duplicatepath = NULL;
+	wd_files_privileges_t		*privileges;
+	wi_fs_stat_t				sb;
+	wi_uinteger_t				i, count;
+	
+	statement = wi_sqlite3_prepare_statement(wd_database, WI_STR("SELECT real_path, inode FROM digests "
+																 "WHERE digest = ? AND size = ? AND device = ?"),
+											 digest,
+											 wi_number_with_int64(size),
+											 wi_number_with_int64(device),
+											 NULL);
+	
+	if(!statement) {
+		wi_log_error(WI_STR("Could not execute database statement: %m"));
+		
+		return NULL;
+	}
+	
+	if(user)
+		rootpath = wi_string_by_resolving_aliases_in_path(wd_files_real_path(WI_STR("/"), user));
+	else
+		rootpath = NULL;
+	
+	stalepaths = wi_mutable_array();
+	
+	while((results = wi_sqlite3_fetch_statement_results(wd_database, statement)) && wi_dictionary_count(results) > 0) {
+		path = wi_dictionary_data_for_key(results, WI_STR("real_path"));
+		
+		if(!wi_fs_lstat_path(path, &sb) || !S_ISREG(sb.mode) || (wi_file_offset_t) sb.size != size || sb.dev != device ||
+		   (int64_t) sb.ino != wi_number_int64(wi_dictionary_data_for_key(results, WI_STR("inode")))) {
+			wi_mutable_array_add_data(stalepaths, path);
+			
+			continue;
+		}
+		
+		/* links share the inode, so the mode has to agree already */
+		if(((sb.mode & 0111) != 0) != (executable != 0))
+			continue;
+		
+		if(rootpath) {
+			/* only hand out contents the user could have downloaded anyway */
+			if(!wi_string_has_prefix(path, rootpath))
+				continue;
+			
+			virtualpath = wi_string_substring_from_index(path, wi_string_length(rootpath));
+			
+			if(!wi_string_has_suffix(rootpath, WI_STR("/")) && !wi_string_has_prefix(virtualpath, WI_STR("/")))
+				continue;
+			
+			privileges = wd_files_privileges(virtualpath, user);
+			
+			if(privileges && !wd_files_privileges_is_readable_by_account(privileges, wd_user_account(user)))
+				continue;
+		}
+		
+		duplicatepath = path;
+		
+		break;
+	}
+	
+	count = wi_array_count(stalepaths);
+	
+	for(i = 0; i < count; i++) {
+		if(!wi_sqlite3_execute_statement(wd_database, WI_STR("DELETE FROM digests WHERE real_path = ?"), WI_ARRAY(stalepaths, i), NULL))
+			wi_log_error(WI_STR("Could not execute database statement: %m"));
+	}
+	
+	return duplicatepath;
+}
+
+
+
+static void wd_transfers_add_digest_for_path(wi_string_t *digest, wi_string_t *path) {
+	wi_fs_stat_t		sb;
+	
+	if(!wi_fs_lstat_path(path, &sb))
+		return;
+	
+	if(!wi_sqlite3_execute_statement(wd_database, WI_STR("DELETE FROM digests WHERE real_path = ?"), path, NULL))
+		wi_log_error(WI_STR("Could not execute database statement: %m"));
+	
+	if(!wi_sqlite3_execute_statement(wd_database, WI_STR("INSERT INTO digests "
+														 "(digest, size, device, inode, real_path) "
+														 "VALUES "
+														 "(?, ?, ?, ?, ?)"),
+									 digest,
+									 wi_number_with_int64(sb.size),
+									 wi_number_with_int64(sb.dev),
+									 wi_number_with_int64(sb.ino),
+									 path,
+									 NULL)) {
+		wi_log_error(WI_STR("Could not execute database statement: %m"));
+	}
+}
+
+
+
+static wi_boolean_t wd_transfers_clone_path(wi_string_t *frompath, wi_string_t *topath) {
+#ifdef FICLONE
+	wi_fs_stat_t		sb;
+	int					fromfd, tofd;
+	
+	/* a clone shares the blocks but not the inode, so the copies can change independently */
+	if(wi_fs_stat_path(frompath, &sb)) {
+		fromfd = open(wi_string_cstring(frompath), O_RDONLY, 0);
+		
+		if(fromfd >= 0) {
+			tofd = open(wi_string_cstring(topath), O_WRONLY | O_CREAT | O_EXCL, sb.mode & 0777);
+			
+			if(tofd >= 0) {
+				if(ioctl(tofd, FICLONE, fromfd) == 0) {
+					close(tofd);
+					close(fromfd);
+					
+					return true;
+				}
+				
+				close(tofd);
+				unlink(wi_string_cstring(topath));
+			}
+			
+			close(fromfd);
+		}
+	}
+#endif
+	
+	/* otherwise a hard link, wd_files_unshare_path() breaks it before either copy changes in place */
+	if(link(wi_string_cstring(frompath), wi_string_cstring(topath)) < 0) {
+		wi_error_set_errno(errno);
+		
+		return false;
+	}
+	
+	return true;
+}
+
+
+
+static wi_string_t * wd_transfers_digest_string(unsigned char *buffer) {
+	char				string[SHA256_DIGEST_LENGTH * 2 + 1];
+	wi_uinteger_t		i;
+	
+	for(i = 0; i < SHA256_DIGEST_LENGTH; i++)
+		snprintf(string + (i * 2), 3, "%02x", buffer[i]);
+	
+	return wi_string_with_cstring(string);
+}
+
+
+
+#ifdef HAVE_ZLIB_H
+
+static wi_boolean_t wd_transfers_compress_download(wd_transfer_t *transfer) {
+	wi_string_t			*key, *cachepath;
+	wi_number_t			*number;
+	wi_fs_stat_t		sb, csb;
+	wi_integer_t		downloads;
+	int					fd;
+	
+	if(!wi_fs_stat_path(transfer->realdatapath, &sb) || (wi_file_offset_t) sb.size != transfer->datasize)
+		return false;
+	
+	if(sb.size < WD_TRANSFERS_COMPRESSION_MIN_SIZE)
+		return false;
+	
+	/* a file replaced in place gets a new key, and with it a new verdict */
+	key			= wi_string_sha1(wi_string_with_format(WI_STR("%@:%llu:%lld:%u:%llu"),
+		transfer->realdatapath, transfer->datasize, (long long) sb.mtime, (unsigned int) sb.dev, (unsigned long long) sb.ino));
+	cachepath	= wi_string_by_appending_path_component(WI_STR(WD_TRANSFERS_COMPRESSION_PATH),
+		wi_string_by_appending_path_extension(key, WI_STR("deflate")));
+	
+	wi_lock_lock(wd_transfers_compression_lock);
+	
+	if(wi_dictionary_data_for_key(wd_transfers_compression_sizes, key)) {
+		wi_mutable_array_remove_data(wd_transfers_compression_order, key);
+		wi_mutable_array_add_data(wd_transfers_compression_order, key);
+		
+		/* opened under the lock, so eviction can't remove it in between */
+		fd = open(wi_string_cstring(cachepath), O_RDONLY, 0);
+		
+		wi_lock_unlock(wd_transfers_compression_lock);
+	} else {
+		if(wi_dictionary_count(wd_transfers_compression_downloads) > WD_TRANSFERS_COMPRESSION_MAX_FILES)
+			wi_mutable_dictionary_remove_all_data(wd_transfers_compression_downloads);
+		
+		number		= wi_dictionary_data_for_key(wd_transfers_compression_downloads, key);
+		downloads	= number ? wi_number_integer(number) : 0;
+		
+		if(downloads >= 0)
+			downloads++;
+		
+		wi_mutable_dictionary_set_data_for_key(wd_transfers_compression_downloads, wi_number_with_integer(downloads), key);
+		
+		/* compress once in the background, this and concurrent downloads go out as they are meanwhile */
+		if(downloads >= WD_TRANSFERS_COMPRESSION_DOWNLOADS && !wi_set_contains_data(wd_transfers_compression_running, key)) {
+			wi_condition_lock_lock(wd_transfers_compression_queue_lock);
+			
+			/* a full queue drops the request, a later download asks again */
+			if(wi_array_count(wd_transfers_compression_queue) < WD_TRANSFERS_COMPRESSION_QUEUE_SIZE) {
+				wi_mutable_array_add_data(wd_transfers_compression_queue,
+					wi_array_with_data(transfer->realdatapath, key, cachepath, NULL));
+				wi_mutable_set_add_data(wd_transfers_compression_running, key);
+			}
+			
+			wi_condition_lock_unlock_with_condition(wd_transfers_compression_queue_lock,
+				(wi_array_count(wd_transfers_compression_queue) > 0) ? 1 : 0);
+		}
+		
+		wi_lock_unlock(wd_transfers_compression_lock);
+		
+		return false;
+	}
+	
+	if(fd < 0) {
+		wi_log_error(WI_STR("Could not open \"%@\" for download: %s"),
+			cachepath, strerror(errno));
+		
+		return false;
+	}
+	
+	if(!wi_fs_stat_path(cachepath, &csb)) {
+		close(fd);
+		
+		return false;
+	}
+	
+	close(transfer->datafd);
+	
+	transfer->datafd				= fd;
+	transfer->compression			= WD_TRANSFER_COMPRESSION_DEFLATE;
+	transfer->datasize				= csb.size;
+	transfer->remainingdatasize		= csb.size;
+	transfer->transferred			= transfer->rsrcoffset;
+	
+	return true;
+}
+
+
+
+static void wd_transfers_compress_thread(wi_runtime_instance_t *argument) {
+	wi_pool_t			*pool;
+	wi_array_t			*array;
+	
+	pool = wi_pool_init(wi_pool_alloc());
+	
+	/* one file at a time, however many downloads ask for it */
+	while(true) {
+		wi_condition_lock_lock_when_condition(wd_transfers_compression_queue_lock, 1, 0.0);
+		
+		array = wi_autorelease(wi_retain(WI_ARRAY(wd_transfers_compression_queue, 0)));
+		
+		wi_mutable_array_remove_data_at_index(wd_transfers_compression_queue, 0);
+		
+		wi_condition_lock_unlock_with_condition(wd_transfers_compression_queue_lock,
+			(wi_array_count(wd_transfers_compression_queue) > 0) ? 1 : 0);
+		
+		wd_transfers_compress_path(WI_ARRAY(array, 0), WI_ARRAY(array, 1), WI_ARRAY(array, 2));
+		
+		wi_pool_drain(pool);
+	}
+	
+	wi_release(pool);
+}
+
+
+
+static void wd_transfers_compress_path(wi_string_t *path, wi_string_t *key, wi_string_t *cachepath) {
+	wi_string_t			*oldest;
+	wi_fs_stat_t		sb, csb;
+	int					fd;
+	wi_boolean_t		result = false;
+	
+	fd = open(wi_string_cstring(path), O_RDONLY, 0);
+	
+	if(fd >= 0) {
+		if(wi_fs_stat_path(path, &sb) && wd_transfers_sample_is_compressible(fd, sb.size))
+			result = wd_transfers_compress_file(fd, &sb, cachepath);
+		
+		close(fd);
+	}
+	
+	if(result && !wi_fs_stat_path(cachepath, &csb))
+		result = false;
+	
+	wi_lock_lock(wd_transfers_compression_lock);
+	
+	wi_mutable_set_remove_data(wd_transfers_compression_running, key);
+	
+	if(result && (wi_file_offset_t) csb.size <= wd_transfers_compression_max_size) {
+		/* evict the least recently downloaded variants, open transfers keep reading theirs */
+		while(wi_array_count(wd_transfers_compression_order) > 0 &&
+			  wd_transfers_compression_size + csb.size > wd_transfers_compression_max_size) {
+			oldest = WI_ARRAY(wd_transfers_compression_order, 0);
+			
+			wd_transfers_compression_size -= wi_number_int64(wi_dictionary_data_for_key(wd_transfers_compression_sizes, oldest));
+			
+			unlink(wi_string_cstring(wi_string_by_appending_path_component(WI_STR(WD_TRANSFERS_COMPRESSION_PATH),
+				wi_string_by_appending_path_extension(oldest, WI_STR("deflate")))));
+			
+			wi_mutable_dictionary_remove_data_for_key(wd_transfers_compression_sizes, oldest);
+			wi_mutable_array_remove_data_at_index(wd_transfers_compression_order, 0);
+		}
+		
+		wi_mutable_dictionary_set_data_for_key(wd_transfers_compression_sizes, wi_number_with_int64(csb.size), key);
+		wi_mutable_array_add_data(wd_transfers_compression_order, key);
+		wi_mutable_dictionary_remove_data_for_key(wd_transfers_compression_downloads, key);
+		
+		wd_transfers_compression_size += csb.size;
+	} else {
+		if(result)
+			unlink(wi_string_cstring(cachepath));
+		
+		wi_mutable_dictionary_set_data_for_key(wd_transfers_compression_downloads, wi_number_with_integer(-1), key);
+	}
+	
+	wi_lock_unlock(wd_transfers_compression_lock);
+}
+
+
+
+static wi_boolean_t wd_transfers_sample_is_compressible(int fd, wi_file_offset_t size) {
+	Bytef				*sample, *compressed;
+	uLongf				compressedsize;
+	ssize_t				samplesize;
+	wi_boolean_t		result = false;
+	
+	/* deflating a sample at the fastest level is a cheap estimate of its entropy */
+	sample			= wi_malloc(WD_TRANSFERS_COMPRESSION_SAMPLE_SIZE);
+	compressed		= wi_malloc(compressBound(WD_TRANSFERS_COMPRESSION_SAMPLE_SIZE));
+	samplesize		= pread(fd, sample, WD_TRANSFERS_COMPRESSION_SAMPLE_SIZE, (size > WD_TRANSFERS_COMPRESSION_SAMPLE_SIZE * 2)
+		? (size / 2) - (WD_TRANSFERS_COMPRESSION_SAMPLE_SIZE / 2)
+		: 0);
+	
+	if(samplesize > 0) {
+		compressedsize = compressBound(WD_TRANSFERS_COMPRESSION_SAMPLE_SIZE);
+		
+		if(compress2(compressed, &compressedsize, sample, samplesize, Z_BEST_SPEED) == Z_OK)
+			result = (compressedsize < samplesize * WD_TRANSFERS_COMPRESSION_MAX_RATIO);
+	}
+	
+	wi_free(sample);
+	wi_free(compressed);
+	
+	return result;
+}
+
+
+
+static wi_boolean_t wd_transfers_compress_file(int fd, wi_fs_stat_t *sbp, wi_string_t *path) {
+	z_stream			stream;
+	struct timeval		tv[2];
+	char				temporarypath[WI_PATH_SIZE];
+	Bytef				*inbuffer, *outbuffer;
+	wi_file_offset_t	offset, compressedsize;
+	ssize_t				readbytes;
+	int					outfd, flush, status;
+	wi_boolean_t		result = true;
+	
+	if(!wi_fs_path_exists(WI_STR(WD_TRANSFERS_COMPRESSION_PATH), NULL)) {
+		if(!wi_fs_create_directory(WI_STR(WD_TRANSFERS_COMPRESSION_PATH), 0700)) {
+			wi_log_error(WI_STR("Could not create \"%@\": %m"), WI_STR(WD_TRANSFERS_COMPRESSION_PATH));
+			
+			return false;
+		}
+	}
+	
+	snprintf(temporarypath, sizeof(temporarypath), "%s.XXXXXX", wi_string_cstring(path));
+	
+	outfd = mkstemp(temporarypath);
+	
+	if(outfd < 0) {
+		wi_log_error(WI_STR("Could not open \"%s\": %s"), temporarypath, strerror(errno));
+		
+		return false;
+	}
+	
+	memset(&stream, 0, sizeof(stream));
+	
+	if(deflateInit(&stream, Z_BEST_SPEED) != Z_OK) {
+		close(outfd);
+		unlink(temporarypath);
+		
+		return false;
+	}
+	
+	inbuffer		= wi_malloc(WD_TRANSFER_BUFFER_SIZE * 4);
+	outbuffer		= wi_malloc(WD_TRANSFER_BUFFER_SIZE * 4);
+	offset			= 0;
+	compressedsize	= 0;
+	
+	do {
+		readbytes = pread(fd, inbuffer, WD_TRANSFER_BUFFER_SIZE * 4, offset);
+		
+		if(readbytes < 0) {
+			wi_log_error(WI_STR("Could not read from file: %s"), strerror(errno));
+			
+			result = false;
+			break;
+		}
+		
+		offset				+= readbytes;
+		flush				= (readbytes == 0) ? Z_FINISH : Z_NO_FLUSH;
+		stream.next_in		= inbuffer;
+		stream.avail_in		= readbytes;
+		
+		do {
+			stream.next_out		= outbuffer;
+			stream.avail_out	= WD_TRANSFER_BUFFER_SIZE * 4;
+			status				= deflate(&stream, flush);
+			
+			if(status == Z_STREAM_ERROR) {
+				result = false;
+				break;
+			}
+			
+			if(write(outfd, outbuffer, (WD_TRANSFER_BUFFER_SIZE * 4) - stream.avail_out) < 0) {
+				wi_log_error(WI_STR("Could not write to \"%s\": %s"), temporarypath, strerror(errno));
+				
+				result = false;
+				break;
+			}
+			
+			compressedsize += (WD_TRANSFER_BUFFER_SIZE * 4) - stream.avail_out;
+		} while(stream.avail_out == 0);
+		
+		/* give up early once the file turns out not to shrink enough */
+		if(compressedsize > sbp->size * WD_TRANSFERS_COMPRESSION_MAX_RATIO)
+			result = false;
+	} while(result && flush != Z_FINISH);
+	
+	deflateEnd(&stream);
+	close(outfd);
+	
+	wi_free(inbuffer);
+	wi_free(outbuffer);
+	
+	if(result) {
+		tv[0].tv_sec	= sbp->mtime;
+		tv[0].tv_usec	= 0;
+		tv[1].tv_sec	= sbp->mtime;
+		tv[1].tv_usec	= 0;
+		
+		if(utimes(temporarypath, tv) < 0 || rename(temporarypath, wi_string_cstring(path)) < 0) {
+			wi_log_error(WI_STR("Could not move \"%s\" to \"%@\": %s"), temporarypath, path, strerror(errno));
+			
+			result = false;
+		}
+	}
+	
+	if(!result)
+		unlink(temporarypath);
+	
+	return result;
+}
+
+#endif
+
+
+
+wi_boolean_t wd_transfers_link_upload_with_digest(wi_string_t *path, wi_string_t *digest, wi_file_offset_t datasize, wi_boolean_t executable, wd_user_t *user) {
+	wi_string_t			*realpath, *duplicatepath;
+	wi_fs_stat_t		sb;
+	
+	if(!wd_transfers_deduplicate_uploads || datasize < WD_TRANSFERS_DEDUPLICATE_MIN_SIZE)
+		return false;
+	
+	if(wi_string_length(digest) != SHA256_DIGEST_LENGTH * 2)
+		return false;
+	
+	realpath = wi_string_by_resolving_aliases_in_path(wd_files_real_path(path, user));
+	
+	if(wi_fs_lstat_path(realpath, &sb))
+		return false;
+	
+	if(!wi_fs_stat_path(wi_string_by_deleting_last_path_component(realpath), &sb))
+		return false;
+	
+	duplicatepath = wd_transfers_duplicate_path_for_digest(digest, datasize, sb.dev, executable, user);
+	
+	if(!duplicatepath)
+		return false;
+	
+	if(!wd_transfers_clone_path(duplicatepath, realpath)) {
+		wi_log_error(WI_STR("Could not link \"%@\" to \"%@\": %m"),
+			duplicatepath, realpath);
+		
+		return false;
+	}
+	
+	wi_log_info(WI_STR("Linked upload of \"%@\" to identical \"%@\", skipping %@"),
+		realpath, duplicatepath, wd_files_string_for_bytes(datasize));
+	
+	wd_transfers_add_digest_for_path(digest, realpath);
+	wd_files_invalidate_path(realpath);
+	wd_index_add_file(realpath);
+	
+	return true;
+}
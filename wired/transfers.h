@@ -29,6 +29,7 @@
 #ifndef WD_TRANFERS_H
 #define WD_TRANFERS_H 1
 
+#include <openssl/sha.h>
 #include <wired/wired.h>
 
 #include "files.h"
@@ -41,6 +42,13 @@ enum _wd_transfer_type {
 typedef enum _wd_transfer_type			wd_transfer_type_t;
 
 
+enum _wd_transfer_compression {
+	WD_TRANSFER_COMPRESSION_NONE		= 0,
+	WD_TRANSFER_COMPRESSION_DEFLATE
+};
+typedef enum _wd_transfer_compression	wd_transfer_compression_t;
+
+
 enum _wd_transfer_state {
 	WD_TRANSFER_QUEUED					= 0,
 	WD_TRANSFER_RUNNING
@@ -63,6 +71,7 @@ struct _wd_transfer {
 	wd_transfer_state_t					state;
 	wd_transfer_type_t					type;
 	wi_boolean_t						executable;
+	wd_transfer_compression_t			compression;
 
 	wi_condition_lock_t					*queue_lock;
 	wi_integer_t						queue;
@@ -75,6 +84,9 @@ struct _wd_transfer {
 	uint32_t							speed;
 	
 	wi_data_t							*finderinfo;
+
+	wi_boolean_t						digesting;
+	SHA256_CTX							digest_context;
 };
 typedef struct _wd_transfer				wd_transfer_t;
 
@@ -86,6 +98,7 @@ void									wd_transfers_schedule(void);
 wi_boolean_t							wd_transfers_run_transfer(wd_transfer_t *, wd_user_t *, wi_p7_message_t *);
 void									wd_transfers_remove_user(wd_user_t *, wi_boolean_t);
 wd_transfer_t *							wd_transfers_transfer_with_path(wd_user_t *, wi_string_t *);
+wi_boolean_t							wd_transfers_link_upload_with_digest(wi_string_t *, wi_string_t *, wi_file_offset_t, wi_boolean_t, wd_user_t *);
 
 wd_transfer_t *							wd_transfer_download_transfer(wi_string_t *, wi_file_offset_t, wi_file_offset_t, wd_user_t *, wi_p7_message_t *);
 wd_transfer_t *							wd_transfer_upload_transfer(wi_string_t *, wi_file_offset_t, wi_file_offset_t, wi_boolean_t, wd_user_t *, wi_p7_message_t *);
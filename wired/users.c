@@ -135,12 +135,17 @@ static wi_string_t *					wd_user_description(wi_runtime_instance_t *);
 
 static wd_uid_t							wd_user_next_id(void);
 
+static void								wd_users_add_subscriber(wi_string_t *, wd_user_t *);
+static void								wd_users_remove_subscriber(wi_string_t *, wd_user_t *);
+
 
 static wi_timer_t						*wd_users_timer;
 
 static wd_uid_t							wd_users_current_id;
 static wi_lock_t						*wd_users_id_lock;
 
+static wi_mutable_dictionary_t			*wd_users_subscriptions;
+
 wi_mutable_dictionary_t					*wd_users;
 
 static wi_runtime_id_t					wd_user_runtime_id = WI_RUNTIME_ID_NULL;
@@ -192,6 +197,8 @@ void wd_users_initialize(void) {
 	wd_users = wi_dictionary_init(wi_mutable_dictionary_alloc());
 	
 	wd_users_id_lock = wi_lock_init(wi_lock_alloc());
+	
+	wd_users_subscriptions = wi_dictionary_init(wi_mutable_dictionary_alloc());
 		
 	wd_users_timer = wi_timer_init_with_function(wi_timer_alloc(),
 												 wd_users_update_idle,
@@ -837,6 +844,7 @@ void wd_user_subscribe_path(wd_user_t *user, wi_string_t *path, wi_string_t *rea
 	wi_recursive_lock_lock(user->user_lock);
 
 	wi_mutable_set_add_data(user->subscribed_paths, realpath);
+	wd_users_add_subscriber(realpath, user);
 
 	if(wd_files_fsevents)
 		wi_fsevents_add_path(wd_files_fsevents, realpath);
@@ -844,6 +852,7 @@ void wd_user_subscribe_path(wd_user_t *user, wi_string_t *path, wi_string_t *rea
 	metapath = wi_string_by_appending_path_component(realpath, WI_STR(WD_FILES_META_PATH));
 		
 	wi_mutable_set_add_data(user->subscribed_paths, metapath);
+	wd_users_add_subscriber(metapath, user);
 
 	if(wd_files_fsevents)
 		wi_fsevents_add_path(wd_files_fsevents, metapath);
@@ -861,16 +870,18 @@ void wd_user_unsubscribe_path(wd_user_t *user, wi_string_t *realpath) {
 	wi_recursive_lock_lock(user->user_lock);
 		
 	wi_mutable_set_remove_data(user->subscribed_paths, realpath);
+	wd_users_remove_subscriber(realpath, user);
 
 	if(wd_files_fsevents)
 		wi_fsevents_remove_path(wd_files_fsevents, realpath);
 		
 	metapath = wi_string_by_appending_path_component(realpath, WI_STR(WD_FILES_META_PATH));
 		
-	wi_mutable_set_add_data(user->subscribed_paths, metapath);
+	wi_mutable_set_remove_data(user->subscribed_paths, metapath);
+	wd_users_remove_subscriber(metapath, user);
 
 	if(wd_files_fsevents)
-		wi_fsevents_add_path(wd_files_fsevents, metapath);
+		wi_fsevents_remove_path(wd_files_fsevents, metapath);
 
 	wi_mutable_dictionary_remove_data_for_key(user->subscribed_virtualpaths, realpath);
 	
@@ -895,6 +906,7 @@ void wd_user_unsubscribe_paths(wd_user_t *user) {
 				wi_fsevents_remove_path(wd_files_fsevents, path);
 
 			wi_mutable_set_remove_data(user->subscribed_paths, path);
+			wd_users_remove_subscriber(path, user);
 		}
 			
 		wi_release(path);
@@ -907,6 +919,61 @@ void wd_user_unsubscribe_paths(wd_user_t *user) {
 
 
 
+static void wd_users_add_subscriber(wi_string_t *path, wd_user_t *user) {
+	wi_mutable_set_t		*users;
+	
+	wi_dictionary_wrlock(wd_users_subscriptions);
+	
+	users = wi_dictionary_data_for_key(wd_users_subscriptions, path);
+	
+	if(!users) {
+		users = wi_set_init_with_capacity(wi_mutable_set_alloc(), 0, true);
+		wi_mutable_dictionary_set_data_for_key(wd_users_subscriptions, users, path);
+		wi_release(users);
+	}
+	
+	wi_mutable_set_add_data(users, user);
+	
+	wi_dictionary_unlock(wd_users_subscriptions);
+}
+
+
+
+static void wd_users_remove_subscriber(wi_string_t *path, wd_user_t *user) {
+	wi_mutable_set_t		*users;
+	
+	wi_dictionary_wrlock(wd_users_subscriptions);
+	
+	users = wi_dictionary_data_for_key(wd_users_subscriptions, path);
+	
+	if(users) {
+		wi_mutable_set_remove_data(users, user);
+		
+		if(wi_set_count(users) == 0)
+			wi_mutable_dictionary_remove_data_for_key(wd_users_subscriptions, path);
+	}
+	
+	wi_dictionary_unlock(wd_users_subscriptions);
+}
+
+
+
+wi_array_t * wd_users_subscribers_for_path(wi_string_t *path) {
+	wi_mutable_set_t		*users;
+	wi_array_t				*array;
+	
+	wi_dictionary_rdlock(wd_users_subscriptions);
+	
+	users = wi_dictionary_data_for_key(wd_users_subscriptions, path);
+	array = users ? wi_set_all_data(users) : NULL;
+	
+	wi_dictionary_unlock(wd_users_subscriptions);
+	
+	return array;
+}
+
+
+
 wi_set_t * wd_user_subscribed_paths(wd_user_t *user) {
 	WD_USER_RETURN_INSTANCE(user, user->subscribed_paths);
 }